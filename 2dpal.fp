@@ -0,0 +1,15 @@
+#version 330 core
+// 2d.fp for indexed images, uploaded by SDLSurfaceToGLImage with a palette
+in vec2 uv;
+out vec4 gl_FragColor;
+
+// Indices, in red
+uniform sampler2D theTexture;
+// 256x1
+uniform sampler2D palette;
+
+void main()
+{
+    int index = int(texture(theTexture, uv).r * 255.0 + 0.5);
+    gl_FragColor = texelFetch(palette, ivec2(index, 0), 0);
+}
@@ -0,0 +1,117 @@
+#include "glad.h"
+#include "bufferpool.h"
+#include "glstate.h"
+#include "vertexlayout.h"
+#include <iostream>
+
+// Smaller buffers aren't worth telling apart
+static const std::size_t MIN_CAPACITY = 256;
+// A free buffer up to this many times the rounded up size will do
+static const std::size_t MAX_WASTE = 4;
+
+KPooledBuffer::KPooledBuffer(KPooledBuffer&& previous) : pool(previous.pool), buffer(previous.buffer), capacity(previous.capacity)
+{
+    previous.pool = nullptr;
+    previous.buffer = 0;
+    previous.capacity = 0;
+}
+
+KPooledBuffer& KPooledBuffer::operator= (KPooledBuffer&& previous)
+{
+    if (this != &previous)
+    {
+        release();
+        pool = previous.pool;
+        buffer = previous.buffer;
+        capacity = previous.capacity;
+        previous.pool = nullptr;
+        previous.buffer = 0;
+        previous.capacity = 0;
+    }
+    return *this;
+}
+
+void KPooledBuffer::release()
+{
+    if (pool != nullptr)
+    {
+        pool->giveBack(buffer);
+    }
+    pool = nullptr;
+    buffer = 0;
+    capacity = 0;
+}
+
+KBufferPool::~KBufferPool()
+{
+    if (!lent.empty())
+    {
+        std::cerr << lent.size() << " pooled buffers weren't given back!" << std::endl;
+    }
+    trim();
+}
+
+KPooledBuffer KBufferPool::acquire(std::size_t size, unsigned int usage)
+{
+    std::size_t capacity = MIN_CAPACITY;
+    while (capacity < size)
+    {
+        capacity *= 2;
+    }
+    // The smallest free buffer that's big enough, but not so big that most
+    // of it would go to waste
+    std::size_t best = freeBuffers.size();
+    for (std::size_t i = 0; i < freeBuffers.size(); i++)
+    {
+        const Entry& entry = freeBuffers[i];
+        if (entry.usage == usage && entry.capacity >= capacity && entry.capacity <= capacity * MAX_WASTE &&
+            (best == freeBuffers.size() || entry.capacity < freeBuffers[best].capacity))
+        {
+            best = i;
+        }
+    }
+    if (best < freeBuffers.size())
+    {
+        Entry entry = freeBuffers[best];
+        freeBuffers[best] = freeBuffers.back();
+        freeBuffers.pop_back();
+        lent.push_back(entry);
+        hits++;
+        return KPooledBuffer(this, entry.buffer, entry.capacity);
+    }
+    Entry entry = {0, capacity, usage};
+    glGenBuffers(1, &entry.buffer);
+    // Not bound anywhere a VAO would notice
+    KGLState::bindBuffer(GL_COPY_WRITE_BUFFER, entry.buffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, capacity, nullptr, usage);
+    KGLState::bindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    lent.push_back(entry);
+    misses++;
+    return KPooledBuffer(this, entry.buffer, capacity);
+}
+
+void KBufferPool::trim()
+{
+    for (const Entry& entry : freeBuffers)
+    {
+        KGLState::forgetBuffer(entry.buffer);
+        KVAOCache::forgetBuffer(entry.buffer);
+        glDeleteBuffers(1, &entry.buffer);
+    }
+    freeBuffers.clear();
+}
+
+void KBufferPool::giveBack(unsigned int buffer)
+{
+    for (std::size_t i = 0; i < lent.size(); i++)
+    {
+        if (lent[i].buffer == buffer)
+        {
+            freeBuffers.push_back(lent[i]);
+            lent[i] = lent.back();
+            lent.pop_back();
+            return;
+        }
+    }
+    std::cerr << "Buffer " << buffer << " wasn't lent out by this pool, or was given back twice!" << std::endl;
+}
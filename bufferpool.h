@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+class KBufferPool;
+
+// A buffer object borrowed from a KBufferPool, given back when this goes
+// away. Move only, like the other GL objects.
+class KPooledBuffer
+{
+public:
+    KPooledBuffer() : pool(nullptr), buffer(0), capacity(0) {}
+    KPooledBuffer(KPooledBuffer&& previous);
+    KPooledBuffer& operator= (KPooledBuffer&& previous);
+    KPooledBuffer(const KPooledBuffer&) = delete;
+    KPooledBuffer& operator= (const KPooledBuffer&) = delete;
+    ~KPooledBuffer() { release(); }
+
+    // Gives the buffer back early
+    void release();
+
+    unsigned int getId() const { return buffer; }
+    // The buffer's real size, at least what was asked for
+    std::size_t getCapacity() const { return capacity; }
+
+private:
+    friend class KBufferPool;
+    KPooledBuffer(KBufferPool* pool, unsigned int buffer, std::size_t capacity) : pool(pool), buffer(buffer), capacity(capacity) {}
+
+    KBufferPool* pool;
+    unsigned int buffer;
+    std::size_t capacity;
+};
+
+// Buffer objects to be used again, instead of deleted and made again, when
+// the things drawn from them change size or come and go. Sizes are rounded
+// up to a power of two, and a buffer given back does for anything from its
+// own size down to a quarter of it, so growing and shrinking again finds
+// the old buffer still there. The contents are undefined; fill them with
+// glBufferSubData (or a compute pass).
+//
+// Every buffer has to be given back before the pool goes away, which then
+// deletes them, so it needs the GL context still.
+class KBufferPool
+{
+public:
+    KBufferPool() : hits(0), misses(0) {}
+    ~KBufferPool();
+    KBufferPool(const KBufferPool&) = delete;
+    KBufferPool& operator= (const KBufferPool&) = delete;
+
+    // A buffer of at least size bytes, made with usage (GL_STATIC_DRAW etc.)
+    KPooledBuffer acquire(std::size_t size, unsigned int usage);
+    // Deletes the buffers nothing is using
+    void trim();
+
+    unsigned int getHits() const { return hits; }
+    unsigned int getMisses() const { return misses; }
+    // Of all acquire() calls, 0 to 1
+    float getHitRate() const { return hits + misses > 0 ? (float)hits / (hits + misses) : 0.f; }
+    unsigned int getFreeCount() const { return freeBuffers.size(); }
+
+private:
+    friend class KPooledBuffer;
+    struct Entry
+    {
+        unsigned int buffer;
+        std::size_t capacity;
+        unsigned int usage;
+    };
+    std::vector<Entry> freeBuffers;
+    // Usage of the buffers out on loan, which KPooledBuffer doesn't keep
+    std::vector<Entry> lent;
+    unsigned int hits;
+    unsigned int misses;
+
+    void giveBack(unsigned int buffer);
+};
@@ -0,0 +1,49 @@
+#version 430 core
+// Builds the model matrix of each cube, one invocation per cube
+layout (local_size_x = 16) in;
+
+layout (std430, binding = 0) readonly buffer CubePositions
+{
+    vec4 positions[];
+};
+
+layout (std430, binding = 1) writeonly buffer CubeModels
+{
+    mat4 models[];
+};
+
+uniform uint cubeCount;
+// Extra rotation for every third cube, in radians
+uniform float spin;
+
+// Same as glm::rotate(mat4(1.), angle, axis)
+mat4 rotation(float angle, vec3 axis)
+{
+    axis = normalize(axis);
+    float c = cos(angle);
+    float s = sin(angle);
+    vec3 t = (1.0 - c) * axis;
+    return mat4(
+        vec4(c + t.x * axis.x, t.x * axis.y + s * axis.z, t.x * axis.z - s * axis.y, 0.0),
+        vec4(t.y * axis.x - s * axis.z, c + t.y * axis.y, t.y * axis.z + s * axis.x, 0.0),
+        vec4(t.z * axis.x + s * axis.y, t.z * axis.y - s * axis.x, c + t.z * axis.z, 0.0),
+        vec4(0.0, 0.0, 0.0, 1.0)
+    );
+}
+
+void main()
+{
+    uint cube = gl_GlobalInvocationID.x;
+    if (cube >= cubeCount)
+    {
+        return;
+    }
+    float angle = radians(20.0 * cube);
+    if (cube % 3 == 0)
+    {
+        angle += spin;
+    }
+    mat4 translation = mat4(1.0);
+    translation[3] = vec4(positions[cube].xyz, 1.0);
+    models[cube] = translation * rotation(angle, vec3(0.5, 1.0, 0.0));
+}
@@ -44,6 +44,17 @@ api=gles1%3Dnone&\
 api=gles2%3Dnone&\
 api=glsc2%3Dnone&\
 profile=core&\
+extensions=GL_ARB_separate_shader_objects&\
+extensions=GL_ARB_tessellation_shader&\
+extensions=GL_ARB_compute_shader&\
+extensions=GL_ARB_shader_storage_buffer_object&\
+extensions=GL_ARB_shader_image_load_store&\
+extensions=GL_EXT_texture_compression_s3tc&\
+extensions=GL_ARB_texture_compression_bptc&\
+extensions=GL_ARB_ES3_compatibility&\
+extensions=GL_ARB_bindless_texture&\
+extensions=GL_NV_gpu_shader5&\
+extensions=GL_ARB_buffer_storage&\
 loader=on&\
 localfiles=on"
 templatefname="glad.tmp.html"
@@ -0,0 +1,109 @@
+#include <iostream>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "textformat.h"
+
+// KTextWriter against snprintf, formatting the stats block tut6.3 draws
+// every frame, and checking that they agree.
+//
+// Usage: formatbench [iterations]
+
+static const char* statsFormat = "========== STATS ==========\n"
+    "X Offset: %0.4f\n"
+    "Y Offset: %0.4f\n"
+    "Z Offset: %0.4f\n"
+    "FOV: %0.4f degrees\n"
+    "Aspect Ratio X: %0.4f\n"
+    "Aspect Ratio Y: %0.4f\n"
+    "Yaw: %0.4f\n"
+    "Pitch: %0.4f\n"
+    "GL state calls: %u sent, %u elided\n"
+    "Text: %u cells changed, %u bytes in %u uploads\n";
+
+struct Stats
+{
+    float values[8];
+    unsigned int counts[5];
+};
+
+template <typename Format>
+static double timeBlocks(const std::vector<Stats>& stats, int iterations, char* buffer, std::size_t size, unsigned long long& checksum, const Format& format)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++)
+    {
+        const Stats& s = stats[i % stats.size()];
+        format(buffer, size, s);
+        checksum += (unsigned char)buffer[i % 200];
+    }
+    std::chrono::duration<double> spent = std::chrono::steady_clock::now() - start;
+    return spent.count();
+}
+
+int main(int argc, char** argv)
+{
+    int iterations = argc > 1 ? std::atoi(argv[1]) : 1000000;
+    // Values like the camera's, plus some big and negative ones
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> small(-360.f, 360.f);
+    std::uniform_real_distribution<float> big(-1e7f, 1e7f);
+    std::uniform_int_distribution<unsigned int> counts(0, 100000);
+    std::vector<Stats> stats(1024);
+    for (std::size_t i = 0; i < stats.size(); i++)
+    {
+        for (int v = 0; v < 8; v++)
+        {
+            stats[i].values[v] = i % 16 == 0 ? big(random) : small(random);
+        }
+        for (int c = 0; c < 5; c++)
+        {
+            stats[i].counts[c] = counts(random);
+        }
+    }
+
+    auto printfBlock = [](char* buffer, std::size_t size, const Stats& s)
+    {
+        std::snprintf(buffer, size, statsFormat, s.values[0], s.values[1], s.values[2], s.values[3], s.values[4],
+            s.values[5], s.values[6], s.values[7], s.counts[0], s.counts[1], s.counts[2], s.counts[3], s.counts[4]);
+    };
+    auto writerBlock = [](char* buffer, std::size_t size, const Stats& s)
+    {
+        KTextWriter writer(buffer, size);
+        writer.format(statsFormat, s.values[0], s.values[1], s.values[2], s.values[3], s.values[4],
+            s.values[5], s.values[6], s.values[7], s.counts[0], s.counts[1], s.counts[2], s.counts[3], s.counts[4]);
+    };
+
+    // Same text, truncated the same way too
+    char expected[1024];
+    char got[1024];
+    unsigned int mismatches = 0;
+    for (const Stats& s : stats)
+    {
+        for (std::size_t size : {sizeof(expected), (std::size_t)100, (std::size_t)1})
+        {
+            printfBlock(expected, size, s);
+            writerBlock(got, size, s);
+            if (std::strcmp(expected, got) != 0)
+            {
+                if (mismatches++ < 5)
+                {
+                    std::cerr << "Mismatch:" << std::endl << expected << std::endl << got << std::endl;
+                }
+            }
+        }
+    }
+    std::cout << stats.size() * 3 << " blocks compared, " << mismatches << " different" << std::endl;
+
+    unsigned long long printfChecksum = 0;
+    unsigned long long writerChecksum = 0;
+    double printfSeconds = timeBlocks(stats, iterations, expected, sizeof(expected), printfChecksum, printfBlock);
+    double writerSeconds = timeBlocks(stats, iterations, got, sizeof(got), writerChecksum, writerBlock);
+    std::cout << "snprintf:    " << printfSeconds * 1e9 / iterations << " ns per block" << std::endl;
+    std::cout << "KTextWriter: " << writerSeconds * 1e9 / iterations << " ns per block (" <<
+        printfSeconds / writerSeconds << "x)" << std::endl;
+    return printfChecksum == writerChecksum && mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,331 @@
+#include "glad.h"
+#include "glstate.h"
+#include <cstring>
+
+unsigned int KGLState::program = KGLState::UNKNOWN;
+unsigned int KGLState::pipeline = KGLState::UNKNOWN;
+unsigned int KGLState::vertexArray = KGLState::UNKNOWN;
+unsigned int KGLState::buffers[KGLState::BUFFER_SLOT_COUNT];
+unsigned int KGLState::activeUnit = KGLState::UNKNOWN;
+unsigned int KGLState::textures[KGLState::MAX_TEXTURE_UNITS][KGLState::TEXTURE_SLOT_COUNT];
+unsigned int KGLState::polygonModeValue = KGLState::UNKNOWN;
+unsigned int KGLState::capabilities[KGLState::CAP_SLOT_COUNT];
+int KGLState::viewportRect[4];
+bool KGLState::viewportKnown = false;
+KGLState::FrameStats KGLState::thisFrame;
+KGLState::FrameStats KGLState::lastFrame;
+
+// The arrays above start out zeroed, which would mean "bound to 0", so mark
+// everything as unknown before the first GL call goes through the cache.
+static struct KGLStateInit
+{
+    KGLStateInit() { KGLState::invalidate(); }
+} glStateInit;
+
+unsigned int KGLState::FrameStats::totalIssued() const
+{
+    unsigned int total = 0;
+    for (unsigned int i = 0; i < CALL_TYPE_COUNT; i++)
+    {
+        total += issued[i];
+    }
+    return total;
+}
+
+unsigned int KGLState::FrameStats::totalElided() const
+{
+    unsigned int total = 0;
+    for (unsigned int i = 0; i < CALL_TYPE_COUNT; i++)
+    {
+        total += elided[i];
+    }
+    return total;
+}
+
+int KGLState::bufferSlot(unsigned int target)
+{
+    switch (target)
+    {
+        case GL_ARRAY_BUFFER:
+            return BUFFER_ARRAY;
+        case GL_ELEMENT_ARRAY_BUFFER:
+            return BUFFER_ELEMENT_ARRAY;
+        case GL_UNIFORM_BUFFER:
+            return BUFFER_UNIFORM;
+        case GL_PIXEL_UNPACK_BUFFER:
+            return BUFFER_PIXEL_UNPACK;
+        case GL_PIXEL_PACK_BUFFER:
+            return BUFFER_PIXEL_PACK;
+        case GL_COPY_READ_BUFFER:
+            return BUFFER_COPY_READ;
+        case GL_COPY_WRITE_BUFFER:
+            return BUFFER_COPY_WRITE;
+        case GL_SHADER_STORAGE_BUFFER:
+            return BUFFER_SHADER_STORAGE;
+    }
+    return -1;
+}
+
+int KGLState::textureSlot(unsigned int target)
+{
+    switch (target)
+    {
+        case GL_TEXTURE_2D:
+            return TEXTURE_2D;
+        case GL_TEXTURE_2D_ARRAY:
+            return TEXTURE_2D_ARRAY;
+        case GL_TEXTURE_3D:
+            return TEXTURE_3D;
+        case GL_TEXTURE_CUBE_MAP:
+            return TEXTURE_CUBE_MAP;
+    }
+    return -1;
+}
+
+int KGLState::capabilitySlot(unsigned int capability)
+{
+    switch (capability)
+    {
+        case GL_DEPTH_TEST:
+            return CAP_DEPTH_TEST;
+        case GL_BLEND:
+            return CAP_BLEND;
+        case GL_CULL_FACE:
+            return CAP_CULL_FACE;
+        case GL_SCISSOR_TEST:
+            return CAP_SCISSOR_TEST;
+    }
+    return -1;
+}
+
+void KGLState::useProgram(unsigned int program)
+{
+    if (KGLState::program == program)
+    {
+        count(CALL_PROGRAM, false);
+        return;
+    }
+    glUseProgram(program);
+    KGLState::program = program;
+    count(CALL_PROGRAM, true);
+}
+
+void KGLState::bindProgramPipeline(unsigned int pipeline)
+{
+    if (KGLState::pipeline == pipeline)
+    {
+        count(CALL_PROGRAM, false);
+        return;
+    }
+    glBindProgramPipeline(pipeline);
+    KGLState::pipeline = pipeline;
+    count(CALL_PROGRAM, true);
+}
+
+void KGLState::bindVertexArray(unsigned int vao)
+{
+    if (vertexArray == vao)
+    {
+        count(CALL_VERTEX_ARRAY, false);
+        return;
+    }
+    glBindVertexArray(vao);
+    vertexArray = vao;
+    // The element array buffer binding is part of the VAO, so we no longer
+    // know what it is.
+    buffers[BUFFER_ELEMENT_ARRAY] = UNKNOWN;
+    count(CALL_VERTEX_ARRAY, true);
+}
+
+void KGLState::bindBuffer(unsigned int target, unsigned int buffer)
+{
+    int slot = bufferSlot(target);
+    if (slot >= 0 && buffers[slot] == buffer)
+    {
+        count(CALL_BUFFER, false);
+        return;
+    }
+    glBindBuffer(target, buffer);
+    if (slot >= 0)
+    {
+        buffers[slot] = buffer;
+    }
+    count(CALL_BUFFER, true);
+}
+
+void KGLState::bindBufferBase(unsigned int target, unsigned int index, unsigned int buffer)
+{
+    glBindBufferBase(target, index, buffer);
+    int slot = bufferSlot(target);
+    if (slot >= 0)
+    {
+        buffers[slot] = buffer;
+    }
+    count(CALL_BUFFER, true);
+}
+
+void KGLState::activeTexture(unsigned int unit)
+{
+    if (activeUnit == unit)
+    {
+        count(CALL_ACTIVE_TEXTURE, false);
+        return;
+    }
+    glActiveTexture(unit);
+    activeUnit = unit;
+    count(CALL_ACTIVE_TEXTURE, true);
+}
+
+void KGLState::bindTexture(unsigned int unit, unsigned int target, unsigned int texture)
+{
+    unsigned int unitIndex = unit - GL_TEXTURE0;
+    int slot = textureSlot(target);
+    bool cacheable = slot >= 0 && unitIndex < MAX_TEXTURE_UNITS;
+    if (cacheable && textures[unitIndex][slot] == texture)
+    {
+        count(CALL_TEXTURE, false);
+        return;
+    }
+    activeTexture(unit);
+    glBindTexture(target, texture);
+    if (cacheable)
+    {
+        textures[unitIndex][slot] = texture;
+    }
+    count(CALL_TEXTURE, true);
+}
+
+void KGLState::polygonMode(unsigned int mode)
+{
+    if (polygonModeValue == mode)
+    {
+        count(CALL_POLYGON_MODE, false);
+        return;
+    }
+    glPolygonMode(GL_FRONT_AND_BACK, mode);
+    polygonModeValue = mode;
+    count(CALL_POLYGON_MODE, true);
+}
+
+void KGLState::setEnabled(unsigned int capability, bool enabled)
+{
+    int slot = capabilitySlot(capability);
+    unsigned int value = enabled ? 1 : 0;
+    if (slot >= 0 && capabilities[slot] == value)
+    {
+        count(CALL_CAPABILITY, false);
+        return;
+    }
+    if (enabled)
+    {
+        glEnable(capability);
+    }
+    else
+    {
+        glDisable(capability);
+    }
+    if (slot >= 0)
+    {
+        capabilities[slot] = value;
+    }
+    count(CALL_CAPABILITY, true);
+}
+
+void KGLState::viewport(int x, int y, int width, int height)
+{
+    if (viewportKnown &&
+        viewportRect[0] == x && viewportRect[1] == y &&
+        viewportRect[2] == width && viewportRect[3] == height)
+    {
+        count(CALL_VIEWPORT, false);
+        return;
+    }
+    glViewport(x, y, width, height);
+    viewportRect[0] = x;
+    viewportRect[1] = y;
+    viewportRect[2] = width;
+    viewportRect[3] = height;
+    viewportKnown = true;
+    count(CALL_VIEWPORT, true);
+}
+
+void KGLState::forgetProgram(unsigned int program)
+{
+    if (KGLState::program == program)
+    {
+        KGLState::program = UNKNOWN;
+    }
+}
+
+void KGLState::forgetProgramPipeline(unsigned int pipeline)
+{
+    if (KGLState::pipeline == pipeline)
+    {
+        KGLState::pipeline = UNKNOWN;
+    }
+}
+
+void KGLState::forgetVertexArray(unsigned int vao)
+{
+    if (vertexArray == vao)
+    {
+        vertexArray = UNKNOWN;
+        buffers[BUFFER_ELEMENT_ARRAY] = UNKNOWN;
+    }
+}
+
+void KGLState::forgetBuffer(unsigned int buffer)
+{
+    for (unsigned int slot = 0; slot < BUFFER_SLOT_COUNT; slot++)
+    {
+        if (buffers[slot] == buffer)
+        {
+            buffers[slot] = UNKNOWN;
+        }
+    }
+}
+
+void KGLState::forgetTexture(unsigned int texture)
+{
+    for (unsigned int unit = 0; unit < MAX_TEXTURE_UNITS; unit++)
+    {
+        for (unsigned int slot = 0; slot < TEXTURE_SLOT_COUNT; slot++)
+        {
+            if (textures[unit][slot] == texture)
+            {
+                textures[unit][slot] = UNKNOWN;
+            }
+        }
+    }
+}
+
+void KGLState::invalidate()
+{
+    program = UNKNOWN;
+    pipeline = UNKNOWN;
+    vertexArray = UNKNOWN;
+    activeUnit = UNKNOWN;
+    polygonModeValue = UNKNOWN;
+    viewportKnown = false;
+    for (unsigned int slot = 0; slot < BUFFER_SLOT_COUNT; slot++)
+    {
+        buffers[slot] = UNKNOWN;
+    }
+    for (unsigned int unit = 0; unit < MAX_TEXTURE_UNITS; unit++)
+    {
+        for (unsigned int slot = 0; slot < TEXTURE_SLOT_COUNT; slot++)
+        {
+            textures[unit][slot] = UNKNOWN;
+        }
+    }
+    for (unsigned int slot = 0; slot < CAP_SLOT_COUNT; slot++)
+    {
+        capabilities[slot] = UNKNOWN;
+    }
+}
+
+void KGLState::beginFrame()
+{
+    lastFrame = thisFrame;
+    std::memset(&thisFrame, 0, sizeof(thisFrame));
+}
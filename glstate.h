@@ -0,0 +1,125 @@
+#pragma once
+
+// Thin cache over the bits of GL state the render loops touch every frame.
+// Binding something which is already bound is skipped instead of being sent
+// to the driver. Anything which changes this state behind the cache's back
+// (e.g. init code calling glBindTexture directly) must be followed by
+// KGLState::invalidate().
+class KGLState
+{
+public:
+    enum CallType
+    {
+        CALL_PROGRAM,
+        CALL_VERTEX_ARRAY,
+        CALL_BUFFER,
+        CALL_ACTIVE_TEXTURE,
+        CALL_TEXTURE,
+        CALL_POLYGON_MODE,
+        CALL_CAPABILITY,
+        CALL_VIEWPORT,
+        CALL_TYPE_COUNT
+    };
+
+    struct FrameStats
+    {
+        unsigned int issued[CALL_TYPE_COUNT];
+        unsigned int elided[CALL_TYPE_COUNT];
+        unsigned int totalIssued() const;
+        unsigned int totalElided() const;
+    };
+
+    static const unsigned int MAX_TEXTURE_UNITS = 32;
+
+    static void useProgram(unsigned int program);
+    // Only takes effect while no program is in use
+    static void bindProgramPipeline(unsigned int pipeline);
+    static void bindVertexArray(unsigned int vao);
+    static void bindBuffer(unsigned int target, unsigned int buffer);
+    // Indexed bindings aren't cached, but this keeps the generic binding
+    // for the target up to date
+    static void bindBufferBase(unsigned int target, unsigned int index, unsigned int buffer);
+    // unit is GL_TEXTURE0 + n, as with glActiveTexture
+    static void activeTexture(unsigned int unit);
+    static void bindTexture(unsigned int unit, unsigned int target, unsigned int texture);
+    static void polygonMode(unsigned int mode);
+    static void setEnabled(unsigned int capability, bool enabled);
+    static void viewport(int x, int y, int width, int height);
+
+    // Call these when deleting objects, otherwise a recycled ID would be
+    // considered "already bound"
+    static void forgetProgram(unsigned int program);
+    static void forgetProgramPipeline(unsigned int pipeline);
+    static void forgetVertexArray(unsigned int vao);
+    static void forgetBuffer(unsigned int buffer);
+    static void forgetTexture(unsigned int texture);
+
+    // Forget everything, so the next call of each kind goes to the driver
+    static void invalidate();
+
+    // Start counting a new frame. Stats for the previous one are kept.
+    static void beginFrame();
+    static const FrameStats& getLastFrameStats() { return lastFrame; }
+    static const FrameStats& getFrameStats() { return thisFrame; }
+
+private:
+    static const unsigned int UNKNOWN = ~0u;
+    enum BufferSlot
+    {
+        BUFFER_ARRAY,
+        BUFFER_ELEMENT_ARRAY,
+        BUFFER_UNIFORM,
+        BUFFER_PIXEL_UNPACK,
+        BUFFER_PIXEL_PACK,
+        BUFFER_COPY_READ,
+        BUFFER_COPY_WRITE,
+        BUFFER_SHADER_STORAGE,
+        BUFFER_SLOT_COUNT
+    };
+    enum TextureSlot
+    {
+        TEXTURE_2D,
+        TEXTURE_2D_ARRAY,
+        TEXTURE_3D,
+        TEXTURE_CUBE_MAP,
+        TEXTURE_SLOT_COUNT
+    };
+    enum CapabilitySlot
+    {
+        CAP_DEPTH_TEST,
+        CAP_BLEND,
+        CAP_CULL_FACE,
+        CAP_SCISSOR_TEST,
+        CAP_SLOT_COUNT
+    };
+
+    static int bufferSlot(unsigned int target);
+    static int textureSlot(unsigned int target);
+    static int capabilitySlot(unsigned int capability);
+    static void count(CallType type, bool issued)
+    {
+        if (issued)
+        {
+            thisFrame.issued[type]++;
+        }
+        else
+        {
+            thisFrame.elided[type]++;
+        }
+    }
+
+    static unsigned int program;
+    static unsigned int pipeline;
+    static unsigned int vertexArray;
+    static unsigned int buffers[BUFFER_SLOT_COUNT];
+    static unsigned int activeUnit;
+    static unsigned int textures[MAX_TEXTURE_UNITS][TEXTURE_SLOT_COUNT];
+    static unsigned int polygonModeValue;
+    // 0 = disabled, 1 = enabled, UNKNOWN = unknown
+    static unsigned int capabilities[CAP_SLOT_COUNT];
+    static int viewportRect[4];
+    static bool viewportKnown;
+
+    static FrameStats thisFrame;
+    static FrameStats lastFrame;
+};
@@ -0,0 +1,282 @@
+#include "glad.h"
+#include "gltrace.h"
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <string>
+#include <vector>
+
+// Entry points to trace. Only GL 3.3 core functions go here, since those are
+// always present in our glad build.
+#define KGL_TRACED_CALLS(X) \
+    X(glActiveTexture) \
+    X(glAttachShader) \
+    X(glBindBuffer) \
+    X(glBindBufferBase) \
+    X(glBindFramebuffer) \
+    X(glBindTexture) \
+    X(glBindVertexArray) \
+    X(glBufferData) \
+    X(glBufferSubData) \
+    X(glClear) \
+    X(glClearBufferuiv) \
+    X(glClearColor) \
+    X(glClientWaitSync) \
+    X(glCompileShader) \
+    X(glCompressedTexImage2D) \
+    X(glCreateProgram) \
+    X(glCreateShader) \
+    X(glDeleteBuffers) \
+    X(glDeleteProgram) \
+    X(glDeleteShader) \
+    X(glDeleteSync) \
+    X(glDeleteTextures) \
+    X(glDeleteVertexArrays) \
+    X(glDisable) \
+    X(glDrawArrays) \
+    X(glDrawArraysInstanced) \
+    X(glDrawElements) \
+    X(glDrawElementsBaseVertex) \
+    X(glDrawElementsInstanced) \
+    X(glEnable) \
+    X(glEnableVertexAttribArray) \
+    X(glFenceSync) \
+    X(glFinish) \
+    X(glGenBuffers) \
+    X(glGenTextures) \
+    X(glGenVertexArrays) \
+    X(glGenerateMipmap) \
+    X(glGetError) \
+    X(glGetIntegerv) \
+    X(glGetProgramInfoLog) \
+    X(glGetProgramiv) \
+    X(glGetShaderInfoLog) \
+    X(glGetShaderiv) \
+    X(glGetUniformLocation) \
+    X(glLinkProgram) \
+    X(glMapBufferRange) \
+    X(glPixelStorei) \
+    X(glPolygonMode) \
+    X(glReadPixels) \
+    X(glShaderSource) \
+    X(glTexImage2D) \
+    X(glTexImage3D) \
+    X(glTexParameteri) \
+    X(glTexSubImage2D) \
+    X(glTexSubImage3D) \
+    X(glUniform1f) \
+    X(glUniform1i) \
+    X(glUniform1ui) \
+    X(glUniform2f) \
+    X(glUniform2fv) \
+    X(glUniform3f) \
+    X(glUniform4f) \
+    X(glUniformMatrix2fv) \
+    X(glUniformMatrix3fv) \
+    X(glUniformMatrix4fv) \
+    X(glUnmapBuffer) \
+    X(glUseProgram) \
+    X(glVertexAttribDivisor) \
+    X(glVertexAttribIPointer) \
+    X(glVertexAttribPointer) \
+    X(glViewport)
+
+// Extension entry points, which are only hooked if the driver has them
+// (install() leaves null pointers alone)
+#define KGL_TRACED_EXTENSION_CALLS(X) \
+    X(glActiveShaderProgram) \
+    X(glBindProgramPipeline) \
+    X(glBufferStorage) \
+    X(glDispatchCompute) \
+    X(glDispatchComputeIndirect) \
+    X(glGetTextureHandleARB) \
+    X(glMakeTextureHandleNonResidentARB) \
+    X(glMakeTextureHandleResidentARB) \
+    X(glMemoryBarrier) \
+    X(glProgramUniform1f) \
+    X(glProgramUniform1i) \
+    X(glProgramUniform1ui) \
+    X(glProgramUniform2f) \
+    X(glProgramUniform3f) \
+    X(glProgramUniform4f) \
+    X(glProgramUniformMatrix2fv) \
+    X(glProgramUniformMatrix3fv) \
+    X(glProgramUniformMatrix4fv)
+
+#define KGL_ALL_TRACED_CALLS(X) \
+    KGL_TRACED_CALLS(X) \
+    KGL_TRACED_EXTENSION_CALLS(X)
+
+enum KGLTracedCall
+{
+#define X(fn) TRACE_##fn,
+    KGL_ALL_TRACED_CALLS(X)
+#undef X
+    TRACE_COUNT
+};
+
+static KGLTrace::CallStats thisFrame[TRACE_COUNT];
+static KGLTrace::CallStats lastFrame[TRACE_COUNT];
+
+bool KGLTrace::enabled = false;
+
+namespace
+{
+
+// Records the time between construction and destruction, i.e. the time it
+// took the wrapped call to return.
+struct KGLTraceTimer
+{
+    unsigned int entryPoint;
+    std::chrono::steady_clock::time_point start;
+    KGLTraceTimer(unsigned int entryPoint) :
+        entryPoint(entryPoint), start(std::chrono::steady_clock::now()) {}
+    ~KGLTraceTimer()
+    {
+        std::chrono::nanoseconds elapsed = std::chrono::steady_clock::now() - start;
+        KGLTrace::record(entryPoint, elapsed.count());
+    }
+};
+
+// One instantiation per traced entry point, each with its own copy of the
+// original function pointer.
+template<unsigned int N, typename F> struct KGLTraceHook;
+template<unsigned int N, typename R, typename... Args>
+struct KGLTraceHook<N, R (APIENTRYP)(Args...)>
+{
+    typedef R (APIENTRYP Function)(Args...);
+    static Function original;
+
+    static R APIENTRY wrapper(Args... args)
+    {
+        KGLTraceTimer timer(N);
+        return original(args...);
+    }
+
+    static void install(Function& pointer)
+    {
+        original = pointer;
+        if (pointer != nullptr)
+        {
+            pointer = wrapper;
+        }
+    }
+
+    static void uninstall(Function& pointer)
+    {
+        if (pointer == wrapper)
+        {
+            pointer = original;
+        }
+    }
+};
+
+template<unsigned int N, typename R, typename... Args>
+typename KGLTraceHook<N, R (APIENTRYP)(Args...)>::Function KGLTraceHook<N, R (APIENTRYP)(Args...)>::original = nullptr;
+
+}
+
+bool KGLTrace::enable()
+{
+    if (enabled)
+    {
+        return true;
+    }
+    if (glad_glGetString == nullptr)
+    {
+        // GLAD hasn't been loaded yet
+        return false;
+    }
+#define X(fn) \
+    thisFrame[TRACE_##fn].name = #fn; \
+    lastFrame[TRACE_##fn].name = #fn; \
+    KGLTraceHook<TRACE_##fn, decltype(glad_##fn)>::install(glad_##fn);
+    KGL_ALL_TRACED_CALLS(X)
+#undef X
+    enabled = true;
+    return true;
+}
+
+void KGLTrace::disable()
+{
+    if (!enabled)
+    {
+        return;
+    }
+#define X(fn) KGLTraceHook<TRACE_##fn, decltype(glad_##fn)>::uninstall(glad_##fn);
+    KGL_ALL_TRACED_CALLS(X)
+#undef X
+    enabled = false;
+}
+
+void KGLTrace::record(unsigned int entryPoint, unsigned long long nanoseconds)
+{
+    thisFrame[entryPoint].calls++;
+    thisFrame[entryPoint].nanoseconds += nanoseconds;
+}
+
+void KGLTrace::endFrame()
+{
+    for (unsigned int i = 0; i < TRACE_COUNT; i++)
+    {
+        lastFrame[i] = thisFrame[i];
+        thisFrame[i].calls = 0;
+        thisFrame[i].nanoseconds = 0;
+    }
+}
+
+unsigned int KGLTrace::getEntryPointCount()
+{
+    return TRACE_COUNT;
+}
+
+const KGLTrace::CallStats& KGLTrace::getLastFrameStats(unsigned int entryPoint)
+{
+    return lastFrame[entryPoint];
+}
+
+unsigned long KGLTrace::getLastFrameCallCount()
+{
+    unsigned long total = 0;
+    for (unsigned int i = 0; i < TRACE_COUNT; i++)
+    {
+        total += lastFrame[i].calls;
+    }
+    return total;
+}
+
+void KGLTrace::dumpLastFrame(std::ostream& out)
+{
+    std::vector<const CallStats*> sorted;
+    unsigned long maxCalls = 0;
+    unsigned long long totalTime = 0;
+    for (unsigned int i = 0; i < TRACE_COUNT; i++)
+    {
+        if (lastFrame[i].calls > 0)
+        {
+            sorted.push_back(&lastFrame[i]);
+            maxCalls = std::max(maxCalls, lastFrame[i].calls);
+            totalTime += lastFrame[i].nanoseconds;
+        }
+    }
+    std::sort(sorted.begin(), sorted.end(), [](const CallStats* a, const CallStats* b) {
+        return a->calls > b->calls;
+    });
+
+    // Put back afterwards, since out is usually std::cout
+    std::ios::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+    const unsigned int barWidth = 40;
+    out << "===== GL calls: " << getLastFrameCallCount() << " in " <<
+        totalTime / 1000. << " us =====" << std::endl;
+    for (const CallStats* stats : sorted)
+    {
+        unsigned int barLength = (unsigned int)(stats->calls * barWidth / maxCalls);
+        out << std::left << std::setw(26) << stats->name << std::right <<
+            std::setw(6) << stats->calls << std::setw(10) << std::fixed <<
+            std::setprecision(1) << stats->nanoseconds / 1000. << " us " <<
+            std::string(std::max(barLength, 1u), '#') << std::endl;
+    }
+    out.flags(flags);
+    out.precision(precision);
+}
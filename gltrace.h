@@ -0,0 +1,42 @@
+#pragma once
+
+#include <ostream>
+
+// Per-frame GL call statistics.
+//
+// When enabled, the glad function pointers listed in gltrace.cpp are swapped
+// for wrappers which count each call and time how long it took to return.
+// Disabling puts the original pointers back, so there is no cost at all when
+// tracing is off. Nothing here is driver specific, so it works the same on
+// Mesa's software rasterizer (LIBGL_ALWAYS_SOFTWARE=1).
+//
+// Must be enabled after gladLoadGLLoader, and only used from the GL thread.
+class KGLTrace
+{
+public:
+    struct CallStats
+    {
+        const char* name;
+        unsigned long calls;
+        unsigned long long nanoseconds;
+    };
+
+    static bool enable();
+    static void disable();
+    static bool isEnabled() { return enabled; }
+
+    // Finish the current frame; its stats become the "last frame" stats
+    static void endFrame();
+    // Print a histogram of the last frame's calls, most frequent first
+    static void dumpLastFrame(std::ostream& out);
+
+    static unsigned int getEntryPointCount();
+    static const CallStats& getLastFrameStats(unsigned int entryPoint);
+    static unsigned long getLastFrameCallCount();
+
+    // Used by the wrappers
+    static void record(unsigned int entryPoint, unsigned long long nanoseconds);
+
+private:
+    static bool enabled;
+};
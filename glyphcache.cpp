@@ -0,0 +1,278 @@
+#include "glad.h"
+#include "glyphcache.h"
+#include "glstate.h"
+#include <ft2build.h>
+#include FT_FREETYPE_H
+#include <iostream>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+static const unsigned int REPLACEMENT_CHARACTER = 0xFFFD;
+static const unsigned int EMPTY_SLOT = ~0u;
+
+unsigned int decodeUtf8(const char*& text)
+{
+    const unsigned char* bytes = (const unsigned char*)text;
+    unsigned int lead = bytes[0];
+    if (lead < 0x80)
+    {
+        text++;
+        return lead;
+    }
+    int length;
+    unsigned int codePoint;
+    // The smallest code point that needs this many bytes
+    unsigned int minimum;
+    if ((lead & 0xE0) == 0xC0)
+    {
+        length = 2;
+        codePoint = lead & 0x1F;
+        minimum = 0x80;
+    }
+    else if ((lead & 0xF0) == 0xE0)
+    {
+        length = 3;
+        codePoint = lead & 0x0F;
+        minimum = 0x800;
+    }
+    else if ((lead & 0xF8) == 0xF0)
+    {
+        length = 4;
+        codePoint = lead & 0x07;
+        minimum = 0x10000;
+    }
+    else
+    {
+        text++;
+        return REPLACEMENT_CHARACTER;
+    }
+    for (int i = 1; i < length; i++)
+    {
+        // Also stops at the terminator
+        if ((bytes[i] & 0xC0) != 0x80)
+        {
+            text++;
+            return REPLACEMENT_CHARACTER;
+        }
+        codePoint = (codePoint << 6) | (bytes[i] & 0x3F);
+    }
+    if (codePoint < minimum || codePoint > 0x10FFFF || (codePoint >= 0xD800 && codePoint <= 0xDFFF))
+    {
+        text++;
+        return REPLACEMENT_CHARACTER;
+    }
+    text += length;
+    return codePoint;
+}
+
+KGlyphCache::KGlyphCache(const char* fontPath, int pixelHeight, unsigned int textureUnit, int pageSize, unsigned int maxPages) :
+    library(nullptr), face(nullptr), textureUnit(textureUnit), pageSize(pageSize), maxPages(std::max(maxPages, 1u)),
+    pageCount(0), cellWidth(1), cellHeight(1), ascender(0), pageColumns(1), pageRows(1), texture(0),
+    frame(1), misses(0), uploadedBytes(0), evictions(0)
+{
+    if (FT_Init_FreeType(&library) != 0)
+    {
+        std::cerr << "Failed to start FreeType!" << std::endl;
+        library = nullptr;
+    }
+    else if (FT_New_Face(library, fontPath, 0, &face) != 0)
+    {
+        std::cerr << "Failed to load the font " << fontPath << std::endl;
+        face = nullptr;
+    }
+    else if (FT_Set_Pixel_Sizes(face, 0, pixelHeight) != 0)
+    {
+        std::cerr << "Font " << fontPath << " has no " << pixelHeight << " pixel size" << std::endl;
+        FT_Done_Face(face);
+        face = nullptr;
+    }
+    if (face != nullptr)
+    {
+        // The metrics are 26.6 fixed point, and already rounded to pixels
+        const FT_Size_Metrics& metrics = face->size->metrics;
+        ascender = metrics.ascender >> 6;
+        cellHeight = std::min(std::max((int)((metrics.ascender - metrics.descender) >> 6), 1), pageSize);
+        // The widest advance of a proportional font is usually some symbol
+        // far wider than the letters, so go by an M instead
+        FT_Pos advance = metrics.max_advance;
+        if (!FT_IS_FIXED_WIDTH(face) && FT_Load_Char(face, 'M', FT_LOAD_DEFAULT) == 0)
+        {
+            advance = face->glyph->advance.x;
+        }
+        cellWidth = std::min(std::max((int)((advance + 63) >> 6), 1), cellHeight);
+        pageColumns = pageSize / cellWidth;
+        pageRows = pageSize / cellHeight;
+    }
+
+    glGenTextures(1, &texture);
+    KGLState::bindTexture(textureUnit, GL_TEXTURE_2D_ARRAY, texture);
+    // Drawn a texel per pixel
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    addPage();
+
+    // Slot 0 is never handed out or thrown away
+    freeSlots.pop_back();
+    if (face != nullptr)
+    {
+        rasterize(0, FT_Get_Char_Index(face, REPLACEMENT_CHARACTER) != 0 ? REPLACEMENT_CHARACTER : '?');
+    }
+}
+
+KGlyphCache::~KGlyphCache()
+{
+    KGLState::forgetTexture(texture);
+    glDeleteTextures(1, &texture);
+    if (face != nullptr)
+    {
+        FT_Done_Face(face);
+    }
+    if (library != nullptr)
+    {
+        FT_Done_FreeType(library);
+    }
+}
+
+void KGlyphCache::beginFrame()
+{
+    frame++;
+    misses = 0;
+    uploadedBytes = 0;
+}
+
+unsigned int KGlyphCache::getSlot(unsigned int codePoint)
+{
+    std::unordered_map<unsigned int, unsigned int>::iterator found = slotOf.find(codePoint);
+    if (found != slotOf.end())
+    {
+        Slot& slot = slots[found->second];
+        // Code points the font doesn't have are remembered as slot 0
+        if (found->second != 0 && slot.lastFrame != frame)
+        {
+            slot.lastFrame = frame;
+            lru.splice(lru.end(), lru, slot.lruEntry);
+        }
+        return found->second;
+    }
+    if (face == nullptr)
+    {
+        return 0;
+    }
+    if (FT_Get_Char_Index(face, codePoint) == 0)
+    {
+        slotOf[codePoint] = 0;
+        return 0;
+    }
+    unsigned int index = takeSlot();
+    if (index == 0)
+    {
+        return 0;
+    }
+    misses++;
+    rasterize(index, codePoint);
+    Slot& slot = slots[index];
+    slot.codePoint = codePoint;
+    slot.lastFrame = frame;
+    slot.lruEntry = lru.insert(lru.end(), index);
+    slotOf[codePoint] = index;
+    return index;
+}
+
+bool KGlyphCache::addPage()
+{
+    if (pageCount >= maxPages)
+    {
+        return false;
+    }
+    unsigned int first = pageCount * getPageSlots();
+    pageCount++;
+    pages.resize((std::size_t)pageSize * pageSize * pageCount, 0);
+    Slot empty = {EMPTY_SLOT, 0, lru.end()};
+    slots.resize(pageCount * getPageSlots(), empty);
+    // Handed out from the back, so lowest first
+    for (unsigned int index = pageCount * getPageSlots(); index > first; index--)
+    {
+        freeSlots.push_back(index - 1);
+    }
+
+    // Respecifying the texture loses what's in it, so the old pages go up
+    // again too. It only happens maxPages times.
+    KGLState::bindTexture(textureUnit, GL_TEXTURE_2D_ARRAY, texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_R8, pageSize, pageSize, pageCount, 0, GL_RED, GL_UNSIGNED_BYTE, pages.data());
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    uploadedBytes += pages.size();
+    return true;
+}
+
+unsigned int KGlyphCache::takeSlot()
+{
+    if (freeSlots.empty())
+    {
+        addPage();
+    }
+    if (!freeSlots.empty())
+    {
+        unsigned int index = freeSlots.back();
+        freeSlots.pop_back();
+        return index;
+    }
+    // Throw out the least recently used glyph, unless even that one has
+    // been drawn this frame
+    if (lru.empty() || slots[lru.front()].lastFrame == frame)
+    {
+        return 0;
+    }
+    unsigned int index = lru.front();
+    lru.pop_front();
+    slotOf.erase(slots[index].codePoint);
+    slots[index].codePoint = EMPTY_SLOT;
+    slots[index].lruEntry = lru.end();
+    evictions++;
+    return index;
+}
+
+void KGlyphCache::rasterize(unsigned int slot, unsigned int codePoint)
+{
+    scratch.assign((std::size_t)cellWidth * cellHeight, 0);
+    if (FT_Load_Char(face, codePoint, FT_LOAD_RENDER) == 0 && face->glyph->bitmap.pixel_mode == FT_PIXEL_MODE_GRAY)
+    {
+        // Sat on the baseline, and cut off at the slot's edges
+        const FT_GlyphSlot glyph = face->glyph;
+        const FT_Bitmap& bitmap = glyph->bitmap;
+        for (int y = 0; y < (int)bitmap.rows; y++)
+        {
+            int cellY = ascender - glyph->bitmap_top + y;
+            if (cellY < 0 || cellY >= cellHeight)
+            {
+                continue;
+            }
+            // A negative pitch means the rows are stored bottom up
+            const unsigned char* row = bitmap.buffer + (bitmap.pitch >= 0 ? y : bitmap.rows - 1 - y) * std::abs(bitmap.pitch);
+            int left = std::max(glyph->bitmap_left, 0);
+            int right = std::min(glyph->bitmap_left + (int)bitmap.width, cellWidth);
+            if (left < right)
+            {
+                std::memcpy(&scratch[(std::size_t)cellY * cellWidth + left], row + left - glyph->bitmap_left, right - left);
+            }
+        }
+    }
+
+    unsigned int layer = slot / getPageSlots();
+    unsigned int x = slot % pageColumns * cellWidth;
+    unsigned int y = slot / pageColumns % pageRows * cellHeight;
+    unsigned char* page = &pages[(std::size_t)layer * pageSize * pageSize];
+    for (int row = 0; row < cellHeight; row++)
+    {
+        std::memcpy(page + (std::size_t)(y + row) * pageSize + x, &scratch[(std::size_t)row * cellWidth], cellWidth);
+    }
+    KGLState::bindTexture(textureUnit, GL_TEXTURE_2D_ARRAY, texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, x, y, layer, cellWidth, cellHeight, 1, GL_RED, GL_UNSIGNED_BYTE, scratch.data());
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    uploadedBytes += scratch.size();
+}
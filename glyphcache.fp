@@ -0,0 +1,12 @@
+#version 330 core
+// Glyphs from a KGlyphCache, which only has coverage
+in vec3 uv;
+out vec4 gl_FragColor;
+
+uniform sampler2DArray theTexture;
+uniform vec4 textColor;
+
+void main()
+{
+    gl_FragColor = textColor * texture(theTexture, uv).r;
+}
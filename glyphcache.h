@@ -0,0 +1,115 @@
+#pragma once
+
+#include <vector>
+#include <list>
+#include <unordered_map>
+
+struct FT_LibraryRec_;
+struct FT_FaceRec_;
+
+// The next code point of UTF-8 text, moving text past it. Bad sequences
+// (stray continuation bytes, overlong forms, surrogates, truncation) come
+// out as U+FFFD a byte at a time, so nothing is ever skipped silently.
+unsigned int decodeUtf8(const char*& text);
+
+// Glyphs of a TrueType/OpenType font, rasterized by FreeType the first time
+// they're asked for, for text in any script without a 256 cell font.
+//
+// Every glyph gets a slot of the same size, a grid of them to a page, and
+// the pages are layers of one GL_R8 GL_TEXTURE_2D_ARRAY. Pages are added as
+// they fill up, to at most maxPages; after that the least recently used
+// glyph is thrown out to make room. Only the slot a new glyph lands in is
+// uploaded.
+//
+// A glyph's slot can be given to another once it hasn't been asked for in
+// the current frame, so text has to look up its glyphs again every frame
+// it's drawn (GlyphText::setText() does this, and only uploads what moved).
+// Slot 0 is the replacement glyph, for code points the font doesn't have,
+// and for when a frame uses more glyphs than fit.
+//
+// The slots are the font's line height tall and its advance wide (an M's,
+// for proportional fonts, but no wider than tall), so this suits monospaced
+// fonts; anything wider than that is cut off.
+class KGlyphCache
+{
+public:
+    // pixelHeight is the font size; pageSize the width and height of each
+    // page in texels. The texture is kept bound to textureUnit
+    // (GL_TEXTURE0 + n).
+    KGlyphCache(const char* fontPath, int pixelHeight, unsigned int textureUnit, int pageSize = 512, unsigned int maxPages = 4);
+    ~KGlyphCache();
+    KGlyphCache(const KGlyphCache&) = delete;
+    KGlyphCache& operator= (const KGlyphCache&) = delete;
+
+    // False if the font couldn't be loaded; everything is then slot 0
+    bool isLoaded() const { return face != nullptr; }
+
+    // Starts a frame: glyphs looked up before the next one stay put
+    void beginFrame();
+    // The slot of a code point, rasterizing and uploading it if it isn't
+    // cached. Slot s is at column s % getPageColumns(), row
+    // s / getPageColumns() % getPageRows() of layer s / getPageSlots().
+    unsigned int getSlot(unsigned int codePoint);
+
+    unsigned int getTexture() const { return texture; }
+    int getCellWidth() const { return cellWidth; }
+    int getCellHeight() const { return cellHeight; }
+    unsigned int getPageColumns() const { return pageColumns; }
+    unsigned int getPageRows() const { return pageRows; }
+    unsigned int getPageSlots() const { return pageColumns * pageRows; }
+    unsigned int getPageCount() const { return pageCount; }
+    // Size of a slot in texture coordinates
+    float getCellU() const { return (float)cellWidth / pageSize; }
+    float getCellV() const { return (float)cellHeight / pageSize; }
+
+    // Since beginFrame()
+    unsigned int getMisses() const { return misses; }
+    unsigned int getUploadedBytes() const { return uploadedBytes; }
+    // Since the cache was made
+    unsigned int getEvictions() const { return evictions; }
+
+private:
+    struct Slot
+    {
+        // ~0u if empty
+        unsigned int codePoint;
+        unsigned int lastFrame;
+        // Where it is in the LRU list, if it's in there
+        std::list<unsigned int>::iterator lruEntry;
+    };
+
+    FT_LibraryRec_* library;
+    FT_FaceRec_* face;
+    unsigned int textureUnit;
+    int pageSize;
+    unsigned int maxPages;
+    unsigned int pageCount;
+    int cellWidth;
+    int cellHeight;
+    // From the top of a slot to the baseline
+    int ascender;
+    unsigned int pageColumns;
+    unsigned int pageRows;
+    unsigned int texture;
+    // A copy of the pages, so they can be put in a bigger texture when one
+    // is added. GL 3.3 has no glCopyImageSubData.
+    std::vector<unsigned char> pages;
+    std::vector<Slot> slots;
+    std::unordered_map<unsigned int, unsigned int> slotOf;
+    // Empty slots, on pages already in the texture
+    std::vector<unsigned int> freeSlots;
+    // Occupied slots, least recently used at the front
+    std::list<unsigned int> lru;
+    std::vector<unsigned char> scratch;
+    unsigned int frame;
+    unsigned int misses;
+    unsigned int uploadedBytes;
+    unsigned int evictions;
+
+    // Puts another page in the texture. False if there are maxPages already.
+    bool addPage();
+    // A slot for a new glyph, or 0 if every one is in use this frame
+    unsigned int takeSlot();
+    // Draws the glyph into its slot of pages, and uploads the slot
+    void rasterize(unsigned int slot, unsigned int codePoint);
+};
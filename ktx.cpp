@@ -0,0 +1,177 @@
+#include "ktx.h"
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <algorithm>
+
+static const unsigned char ktxIdentifier[12] = {
+    0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n'
+};
+
+// The header after the identifier
+struct KKTXHeader
+{
+    std::uint32_t endianness;
+    std::uint32_t glType;
+    std::uint32_t glTypeSize;
+    std::uint32_t glFormat;
+    std::uint32_t glInternalFormat;
+    std::uint32_t glBaseInternalFormat;
+    std::uint32_t pixelWidth;
+    std::uint32_t pixelHeight;
+    std::uint32_t pixelDepth;
+    std::uint32_t numberOfArrayElements;
+    std::uint32_t numberOfFaces;
+    std::uint32_t numberOfMipmapLevels;
+    std::uint32_t bytesOfKeyValueData;
+};
+
+static const std::uint32_t ktxEndianness = 0x04030201;
+
+bool KKTXFile::parse(const std::vector<unsigned char>& data, const char* name)
+{
+    KKTXHeader header;
+    if (data.size() < sizeof(ktxIdentifier) + sizeof(header) ||
+        std::memcmp(data.data(), ktxIdentifier, sizeof(ktxIdentifier)) != 0)
+    {
+        std::cerr << name << " is not a KTX file!" << std::endl;
+        return false;
+    }
+    std::memcpy(&header, data.data() + sizeof(ktxIdentifier), sizeof(header));
+    if (header.endianness != ktxEndianness)
+    {
+        std::cerr << name << " has the wrong endianness!" << std::endl;
+        return false;
+    }
+    if (header.pixelDepth > 1 || header.numberOfArrayElements > 0 || header.numberOfFaces != 1)
+    {
+        std::cerr << name << " is not a 2D texture!" << std::endl;
+        return false;
+    }
+    internalFormat = header.glInternalFormat;
+    baseInternalFormat = header.glBaseInternalFormat;
+    type = header.glType;
+    format = header.glFormat;
+    width = header.pixelWidth;
+    height = header.pixelHeight;
+    std::uint32_t levelCount = header.numberOfMipmapLevels > 0 ? header.numberOfMipmapLevels : 1;
+
+    std::size_t offset = sizeof(ktxIdentifier) + sizeof(header);
+    std::size_t keyValueEnd = offset + header.bytesOfKeyValueData;
+    if (keyValueEnd > data.size())
+    {
+        std::cerr << name << " is truncated!" << std::endl;
+        return false;
+    }
+    // Each pair is its size, then "key\0value", padded to 4 bytes
+    keyValues.clear();
+    while (offset + sizeof(std::uint32_t) <= keyValueEnd)
+    {
+        std::uint32_t pairSize;
+        std::memcpy(&pairSize, data.data() + offset, sizeof(pairSize));
+        offset += sizeof(pairSize);
+        if (offset + pairSize > keyValueEnd)
+        {
+            std::cerr << name << " has bad key/value data!" << std::endl;
+            return false;
+        }
+        const char* pair = (const char*)data.data() + offset;
+        std::size_t keySize = std::find(pair, pair + pairSize, '\0') - pair;
+        std::string value(pair + std::min<std::size_t>(keySize + 1, pairSize), pair + pairSize);
+        // Values which are strings include their terminator
+        if (!value.empty() && value.back() == '\0')
+        {
+            value.pop_back();
+        }
+        keyValues.emplace_back(std::string(pair, keySize), value);
+        offset += (pairSize + 3) & ~3u;
+    }
+
+    offset = keyValueEnd;
+    levels.clear();
+    for (std::uint32_t level = 0; level < levelCount; level++)
+    {
+        std::uint32_t imageSize;
+        if (offset + sizeof(imageSize) > data.size())
+        {
+            std::cerr << name << " is truncated!" << std::endl;
+            return false;
+        }
+        std::memcpy(&imageSize, data.data() + offset, sizeof(imageSize));
+        offset += sizeof(imageSize);
+        if (offset + imageSize > data.size())
+        {
+            std::cerr << name << " is truncated!" << std::endl;
+            return false;
+        }
+        levels.emplace_back(data.begin() + offset, data.begin() + offset + imageSize);
+        // Mip levels start on 4 byte boundaries
+        offset += (imageSize + 3) & ~3u;
+    }
+    return true;
+}
+
+bool KKTXFile::write(const char* path) const
+{
+    std::ofstream file(path, std::ios::binary);
+    if (!file)
+    {
+        std::cerr << "Failed to open " << path << " for writing!" << std::endl;
+        return false;
+    }
+    KKTXHeader header;
+    header.endianness = ktxEndianness;
+    header.glType = type;
+    header.glTypeSize = 1;
+    header.glFormat = format;
+    header.glInternalFormat = internalFormat;
+    header.glBaseInternalFormat = baseInternalFormat;
+    header.pixelWidth = width;
+    header.pixelHeight = height;
+    header.pixelDepth = 0;
+    header.numberOfArrayElements = 0;
+    header.numberOfFaces = 1;
+    header.numberOfMipmapLevels = levels.size();
+    header.bytesOfKeyValueData = 0;
+    for (const std::pair<std::string, std::string>& keyValue : keyValues)
+    {
+        std::uint32_t pairSize = keyValue.first.size() + keyValue.second.size() + 2;
+        header.bytesOfKeyValueData += sizeof(pairSize) + ((pairSize + 3) & ~3u);
+    }
+    file.write((const char*)ktxIdentifier, sizeof(ktxIdentifier));
+    file.write((const char*)&header, sizeof(header));
+    const char padding[3] = {0, 0, 0};
+    for (const std::pair<std::string, std::string>& keyValue : keyValues)
+    {
+        std::uint32_t pairSize = keyValue.first.size() + keyValue.second.size() + 2;
+        file.write((const char*)&pairSize, sizeof(pairSize));
+        file.write(keyValue.first.c_str(), keyValue.first.size() + 1);
+        file.write(keyValue.second.c_str(), keyValue.second.size() + 1);
+        file.write(padding, (4 - pairSize % 4) % 4);
+    }
+    for (const std::vector<unsigned char>& level : levels)
+    {
+        std::uint32_t imageSize = level.size();
+        file.write((const char*)&imageSize, sizeof(imageSize));
+        file.write((const char*)level.data(), level.size());
+        file.write(padding, (4 - imageSize % 4) % 4);
+    }
+    if (!file)
+    {
+        std::cerr << "Failed to write " << path << "!" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+std::string KKTXFile::getValue(const std::string& key) const
+{
+    for (const std::pair<std::string, std::string>& keyValue : keyValues)
+    {
+        if (keyValue.first == key)
+        {
+            return keyValue.second;
+        }
+    }
+    return std::string();
+}
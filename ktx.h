@@ -0,0 +1,36 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <utility>
+#include <cstdint>
+
+// A 2D texture in a KTX (version 1) container, the format GL texture tools
+// write. Only what we use is supported: one face, no array layers, and
+// little endian files.
+//
+// Doesn't need GL, so the offline tools can use it too.
+struct KKTXFile
+{
+    // GL enums, e.g. GL_COMPRESSED_RGB_S3TC_DXT1_EXT and GL_RGB
+    std::uint32_t internalFormat;
+    std::uint32_t baseInternalFormat;
+    // Both 0 for compressed formats, e.g. GL_UNSIGNED_BYTE and GL_RGBA
+    // otherwise. Rows of uncompressed levels are padded to 4 bytes.
+    std::uint32_t type;
+    std::uint32_t format;
+    std::uint32_t width;
+    std::uint32_t height;
+    // Mip level 0 first
+    std::vector<std::vector<unsigned char> > levels;
+    std::vector<std::pair<std::string, std::string> > keyValues;
+
+    KKTXFile() : internalFormat(0), baseInternalFormat(0), type(0), format(0), width(0), height(0) {}
+
+    // Empty if the key isn't there
+    std::string getValue(const std::string& key) const;
+
+    // Both print what went wrong and return false on failure
+    bool parse(const std::vector<unsigned char>& data, const char* name);
+    bool write(const char* path) const;
+};
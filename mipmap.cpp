@@ -0,0 +1,460 @@
+#include "mipmap.h"
+#include "ktx.h"
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <thread>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// From glcorearb.h. This doesn't use GL, so doesn't include it.
+static const std::uint32_t GL_UNSIGNED_BYTE_ENUM = 0x1401;
+static const std::uint32_t formatEnums[4] = {0x1903, 0x8227, 0x1907, 0x1908};        // GL_RED to GL_RGBA
+static const std::uint32_t internalFormatEnums[4] = {0x8229, 0x822B, 0x8051, 0x8058}; // GL_R8 to GL_RGBA8
+
+static const char* sourceKeyName = "KMipSource";
+
+// One texel, 4 floats: premultiplied linear RGBA. One SSE register when
+// there is SSE.
+#ifdef __SSE2__
+typedef __m128 KTexel;
+static inline KTexel loadTexel(const float* p) { return _mm_loadu_ps(p); }
+static inline void storeTexel(float* p, KTexel t) { _mm_storeu_ps(p, t); }
+static inline KTexel splat(float f) { return _mm_set1_ps(f); }
+static inline KTexel add(KTexel a, KTexel b) { return _mm_add_ps(a, b); }
+static inline KTexel mul(KTexel a, KTexel b) { return _mm_mul_ps(a, b); }
+#else
+struct KTexel { float v[4]; };
+static inline KTexel loadTexel(const float* p) { KTexel t; std::memcpy(t.v, p, sizeof(t.v)); return t; }
+static inline void storeTexel(float* p, KTexel t) { std::memcpy(p, t.v, sizeof(t.v)); }
+static inline KTexel splat(float f) { KTexel t = {{f, f, f, f}}; return t; }
+static inline KTexel add(KTexel a, KTexel b) { for (int i = 0; i < 4; i++) a.v[i] += b.v[i]; return a; }
+static inline KTexel mul(KTexel a, KTexel b) { for (int i = 0; i < 4; i++) a.v[i] *= b.v[i]; return a; }
+#endif
+
+struct KLinearImage
+{
+    int width;
+    int height;
+    std::vector<float> texels;
+
+    void resize(int width, int height)
+    {
+        this->width = width;
+        this->height = height;
+        texels.resize((std::size_t)width * height * 4);
+    }
+    float* row(int y) { return &texels[(std::size_t)y * width * 4]; }
+    const float* row(int y) const { return &texels[(std::size_t)y * width * 4]; }
+};
+
+struct KGammaTables
+{
+    float toLinear[256];
+    // Indexed by linear value * 4095
+    unsigned char toSRGB[4096];
+
+    KGammaTables()
+    {
+        for (int i = 0; i < 256; i++)
+        {
+            float c = i / 255.f;
+            toLinear[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+        }
+        for (int i = 0; i < 4096; i++)
+        {
+            float l = i / 4095.f;
+            float c = l <= 0.0031308f ? l * 12.92f : 1.055f * std::pow(l, 1 / 2.4f) - 0.055f;
+            toSRGB[i] = (unsigned char)(c * 255.f + 0.5f);
+        }
+    }
+};
+
+static const KGammaTables& gammaTables()
+{
+    static KGammaTables tables;
+    return tables;
+}
+
+// 8 taps for halving: source texels 2x-3 to 2x+4 for destination texel x
+struct KKaiserKernel
+{
+    float weights[8];
+
+    static double besselI0(double x)
+    {
+        double sum = 1, term = 1;
+        for (int k = 1; k < 20; k++)
+        {
+            term *= (x / (2 * k)) * (x / (2 * k));
+            sum += term;
+        }
+        return sum;
+    }
+
+    KKaiserKernel()
+    {
+        const double pi = 3.14159265358979323846;
+        const double alpha = 4, radius = 2;
+        double total = 0;
+        for (int i = 0; i < 8; i++)
+        {
+            // Distance between the texel centres, in destination texels
+            double t = (i - 3.5) / 2;
+            double sinc = std::sin(pi * t) / (pi * t);
+            double window = besselI0(alpha * std::sqrt(1 - (t / radius) * (t / radius))) / besselI0(alpha);
+            weights[i] = sinc * window;
+            total += weights[i];
+        }
+        for (float& weight : weights)
+        {
+            weight /= total;
+        }
+    }
+};
+
+// Calls work(begin, end) over ranges of rows, split between threads
+template <typename Work>
+static void parallelRows(int rows, int width, unsigned int threads, const Work& work)
+{
+    // Not worth starting threads for the small levels
+    if (threads > (unsigned int)rows)
+    {
+        threads = rows;
+    }
+    if (threads <= 1 || (std::size_t)rows * width < 64 * 64)
+    {
+        work(0, rows);
+        return;
+    }
+    std::vector<std::thread> workers;
+    for (unsigned int i = 1; i < threads; i++)
+    {
+        workers.emplace_back(work, rows * i / threads, rows * (i + 1) / threads);
+    }
+    work(0, rows / threads);
+    for (std::thread& worker : workers)
+    {
+        worker.join();
+    }
+}
+
+// Which of the 4 floats each channel goes in. Grey goes in red, and alpha
+// always goes last.
+static int laneFor(int channel, int channels)
+{
+    return channels == 2 && channel == 1 ? 3 : channel;
+}
+
+static void toLinear(const unsigned char* pixels, int width, int height, int channels, bool gammaCorrect, unsigned int threads, KLinearImage& image)
+{
+    const KGammaTables& tables = gammaTables();
+    bool hasAlpha = channels == 2 || channels == 4;
+    image.resize(width, height);
+    parallelRows(height, width, threads, [&](int begin, int end)
+    {
+        for (int y = begin; y < end; y++)
+        {
+            const unsigned char* in = pixels + (std::size_t)y * width * channels;
+            float* out = image.row(y);
+            for (int x = 0; x < width; x++, in += channels, out += 4)
+            {
+                out[0] = out[1] = out[2] = 0;
+                out[3] = 1;
+                for (int c = 0; c < channels; c++)
+                {
+                    int lane = laneFor(c, channels);
+                    out[lane] = lane != 3 && gammaCorrect ? tables.toLinear[in[c]] : in[c] / 255.f;
+                }
+                if (hasAlpha)
+                {
+                    out[0] *= out[3];
+                    out[1] *= out[3];
+                    out[2] *= out[3];
+                }
+            }
+        }
+    });
+}
+
+static void fromLinear(const KLinearImage& image, int channels, bool gammaCorrect, unsigned int threads, KMipLevel& level)
+{
+    const KGammaTables& tables = gammaTables();
+    bool hasAlpha = channels == 2 || channels == 4;
+    level.width = image.width;
+    level.height = image.height;
+    level.pixels.resize((std::size_t)image.width * image.height * channels);
+    parallelRows(image.height, image.width, threads, [&](int begin, int end)
+    {
+        for (int y = begin; y < end; y++)
+        {
+            const float* in = image.row(y);
+            unsigned char* out = &level.pixels[(std::size_t)y * image.width * channels];
+            for (int x = 0; x < image.width; x++, in += 4, out += channels)
+            {
+                // The Kaiser filter can overshoot
+                float alpha = std::min(std::max(in[3], 0.f), 1.f);
+                float scale = !hasAlpha ? 1 : alpha > 0 ? 1 / alpha : 0;
+                for (int c = 0; c < channels; c++)
+                {
+                    int lane = laneFor(c, channels);
+                    float value = lane == 3 ? alpha : std::min(std::max(in[lane] * scale, 0.f), 1.f);
+                    out[c] = lane != 3 && gammaCorrect ? tables.toSRGB[(int)(value * 4095.f + 0.5f)] : (unsigned char)(value * 255.f + 0.5f);
+                }
+            }
+        }
+    });
+}
+
+// The source texels one output texel of a box filter covers along an axis,
+// and their weights. For odd sizes, the last output texel takes the last 3
+// source texels, 1/4, 1/2, 1/4, so nothing is dropped.
+static int boxTaps(int out, int srcSize, int outSize, int* taps, float* weights)
+{
+    if (srcSize == 1)
+    {
+        taps[0] = 0;
+        weights[0] = 1;
+        return 1;
+    }
+    taps[0] = out * 2;
+    taps[1] = out * 2 + 1;
+    if (srcSize % 2 == 1 && out == outSize - 1)
+    {
+        taps[2] = out * 2 + 2;
+        weights[0] = 0.25f;
+        weights[1] = 0.5f;
+        weights[2] = 0.25f;
+        return 3;
+    }
+    weights[0] = 0.5f;
+    weights[1] = 0.5f;
+    return 2;
+}
+
+// 2x2 texels to 1, or 3 wide or high for the last texel of odd sizes
+static void halveBox(const KLinearImage& src, unsigned int threads, KLinearImage& dst)
+{
+    dst.resize(std::max(1, src.width / 2), std::max(1, src.height / 2));
+    parallelRows(dst.height, dst.width, threads, [&](int begin, int end)
+    {
+        KTexel quarter = splat(0.25f);
+        for (int y = begin; y < end; y++)
+        {
+            int rowTaps[3];
+            float rowWeights[3];
+            int rowCount = boxTaps(y, src.height, dst.height, rowTaps, rowWeights);
+            float* out = dst.row(y);
+            for (int x = 0; x < dst.width; x++)
+            {
+                int colTaps[3];
+                float colWeights[3];
+                int colCount = boxTaps(x, src.width, dst.width, colTaps, colWeights);
+                if (rowCount == 2 && colCount == 2)
+                {
+                    // Almost every texel
+                    const float* row0 = src.row(rowTaps[0]);
+                    const float* row1 = src.row(rowTaps[1]);
+                    int x0 = colTaps[0] * 4;
+                    int x1 = colTaps[1] * 4;
+                    KTexel sum = add(add(loadTexel(row0 + x0), loadTexel(row0 + x1)), add(loadTexel(row1 + x0), loadTexel(row1 + x1)));
+                    storeTexel(out + x * 4, mul(sum, quarter));
+                    continue;
+                }
+                KTexel sum = splat(0.f);
+                for (int j = 0; j < rowCount; j++)
+                {
+                    const float* row = src.row(rowTaps[j]);
+                    for (int i = 0; i < colCount; i++)
+                    {
+                        sum = add(sum, mul(loadTexel(row + colTaps[i] * 4), splat(rowWeights[j] * colWeights[i])));
+                    }
+                }
+                storeTexel(out + x * 4, sum);
+            }
+        }
+    });
+}
+
+// Separable: across each row into scratch, then down each column. Taps past
+// the edges repeat the edge texels.
+static void halveKaiser(const KLinearImage& src, unsigned int threads, KLinearImage& scratch, KLinearImage& dst)
+{
+    static const KKaiserKernel kernel;
+    KTexel weights[8];
+    for (int i = 0; i < 8; i++)
+    {
+        weights[i] = splat(kernel.weights[i]);
+    }
+    scratch.resize(std::max(1, src.width / 2), src.height);
+    parallelRows(scratch.height, scratch.width, threads, [&](int begin, int end)
+    {
+        for (int y = begin; y < end; y++)
+        {
+            const float* in = src.row(y);
+            float* out = scratch.row(y);
+            for (int x = 0; x < scratch.width; x++)
+            {
+                KTexel sum = splat(0);
+                for (int i = 0; i < 8; i++)
+                {
+                    int sx = std::min(std::max(x * 2 - 3 + i, 0), src.width - 1);
+                    sum = add(sum, mul(loadTexel(in + sx * 4), weights[i]));
+                }
+                storeTexel(out + x * 4, sum);
+            }
+        }
+    });
+    dst.resize(scratch.width, std::max(1, src.height / 2));
+    parallelRows(dst.height, dst.width, threads, [&](int begin, int end)
+    {
+        for (int y = begin; y < end; y++)
+        {
+            const float* rows[8];
+            for (int i = 0; i < 8; i++)
+            {
+                rows[i] = scratch.row(std::min(std::max(y * 2 - 3 + i, 0), scratch.height - 1));
+            }
+            float* out = dst.row(y);
+            for (int x = 0; x < dst.width * 4; x += 4)
+            {
+                KTexel sum = splat(0);
+                for (int i = 0; i < 8; i++)
+                {
+                    sum = add(sum, mul(loadTexel(rows[i] + x), weights[i]));
+                }
+                storeTexel(out + x, sum);
+            }
+        }
+    });
+}
+
+void KMipChain::generate(const unsigned char* pixels, int width, int height, int channels, KMipFilter filter, bool gammaCorrect, unsigned int threads)
+{
+    this->channels = channels;
+    levels.clear();
+    if (threads == 0)
+    {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    // Each level is made from the unrounded one above
+    KLinearImage image, smaller, scratch;
+    toLinear(pixels, width, height, channels, gammaCorrect, threads, image);
+    while (image.width > 1 || image.height > 1)
+    {
+        if (filter == MIP_KAISER)
+        {
+            halveKaiser(image, threads, scratch, smaller);
+        }
+        else
+        {
+            halveBox(image, threads, smaller);
+        }
+        levels.emplace_back();
+        fromLinear(smaller, channels, gammaCorrect, threads, levels.back());
+        std::swap(image, smaller);
+    }
+}
+
+bool KMipChain::save(const char* path, const std::string& sourceKey, const unsigned char* pixels, int width, int height) const
+{
+    KKTXFile ktx;
+    ktx.internalFormat = internalFormatEnums[channels - 1];
+    ktx.baseInternalFormat = formatEnums[channels - 1];
+    ktx.type = GL_UNSIGNED_BYTE_ENUM;
+    ktx.format = formatEnums[channels - 1];
+    ktx.width = width;
+    ktx.height = height;
+    ktx.keyValues.emplace_back(sourceKeyName, sourceKey);
+    for (int level = 0; level <= (int)levels.size(); level++)
+    {
+        int levelWidth = level == 0 ? width : levels[level - 1].width;
+        int levelHeight = level == 0 ? height : levels[level - 1].height;
+        const unsigned char* levelPixels = level == 0 ? pixels : levels[level - 1].pixels.data();
+        // KTX pads rows to 4 bytes
+        std::size_t rowSize = (std::size_t)levelWidth * channels;
+        std::size_t paddedSize = (rowSize + 3) & ~(std::size_t)3;
+        ktx.levels.emplace_back(paddedSize * levelHeight);
+        for (int y = 0; y < levelHeight; y++)
+        {
+            std::memcpy(&ktx.levels.back()[y * paddedSize], levelPixels + y * rowSize, rowSize);
+        }
+    }
+    return ktx.write(path);
+}
+
+bool KMipChain::load(const char* path, const std::string& sourceKey, std::vector<unsigned char>& pixels, int& width, int& height)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        return false;
+    }
+    std::vector<unsigned char> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    KKTXFile ktx;
+    if (!ktx.parse(data, path) || ktx.getValue(sourceKeyName) != sourceKey)
+    {
+        return false;
+    }
+    channels = std::find(formatEnums, formatEnums + 4, ktx.format) - formatEnums + 1;
+    if (ktx.type != GL_UNSIGNED_BYTE_ENUM || channels > 4)
+    {
+        std::cerr << path << " is not an 8 bit image!" << std::endl;
+        return false;
+    }
+    width = ktx.width;
+    height = ktx.height;
+    levels.clear();
+    pixels.clear();
+    for (std::size_t level = 0; level < ktx.levels.size(); level++)
+    {
+        int levelWidth = std::max(1, width >> level);
+        int levelHeight = std::max(1, height >> level);
+        std::size_t rowSize = (std::size_t)levelWidth * channels;
+        std::size_t paddedSize = (rowSize + 3) & ~(std::size_t)3;
+        if (ktx.levels[level].size() != paddedSize * levelHeight)
+        {
+            std::cerr << path << " has the wrong size mip levels!" << std::endl;
+            return false;
+        }
+        std::vector<unsigned char>* out = &pixels;
+        if (level > 0)
+        {
+            levels.emplace_back();
+            levels.back().width = levelWidth;
+            levels.back().height = levelHeight;
+            out = &levels.back().pixels;
+        }
+        out->resize(rowSize * levelHeight);
+        for (int y = 0; y < levelHeight; y++)
+        {
+            std::memcpy(out->data() + y * rowSize, &ktx.levels[level][y * paddedSize], rowSize);
+        }
+    }
+    // Must go all the way down, or the texture would be incomplete
+    if (levels.empty() ? (width > 1 || height > 1) : (levels.back().width > 1 || levels.back().height > 1))
+    {
+        std::cerr << path << " is missing mip levels!" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+const char* KMipChain::getFilterName(KMipFilter filter)
+{
+    switch (filter)
+    {
+        case MIP_DRIVER:
+            return "driver";
+        case MIP_BOX:
+            return "box";
+        case MIP_KAISER:
+            return "kaiser";
+    }
+    return "unknown";
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// How the mip levels below an image are made
+enum KMipFilter
+{
+    // glGenerateMipmap: whatever the driver does, which is usually a box
+    // filter on the sRGB values
+    MIP_DRIVER,
+    // Average of 2x2 texels, in linear light. The last texel of an odd
+    // size takes in 3 instead (1/4, 1/2, 1/4), so no row or column is lost.
+    MIP_BOX,
+    // Kaiser windowed sinc over 8x8 texels. Sharper, and about 4 times the work.
+    MIP_KAISER
+};
+
+struct KMipLevel
+{
+    int width;
+    int height;
+    // Tightly packed, with the image's channels
+    std::vector<unsigned char> pixels;
+};
+
+// The mip chain of an 8 bit image, made on the CPU. With gammaCorrect the
+// colour channels are taken to be sRGB and filtered in linear light, so
+// smaller levels don't come out darker. Colour is weighted by alpha, so
+// transparent texels don't bleed into their neighbours.
+//
+// Doesn't need GL, so the offline tools can use it too.
+class KMipChain
+{
+public:
+    int channels;
+    // Level 1 onwards, down to 1x1
+    std::vector<KMipLevel> levels;
+
+    KMipChain() : channels(0) {}
+
+    // Each level's rows are split over the threads, 0 meaning one per core.
+    // MIP_DRIVER is treated as MIP_BOX.
+    void generate(const unsigned char* pixels, int width, int height, int channels, KMipFilter filter, bool gammaCorrect, unsigned int threads = 1);
+
+    // Write an uncompressed KTX file with the image and its chain.
+    // sourceKey says what they were made from, and how.
+    bool save(const char* path, const std::string& sourceKey, const unsigned char* pixels, int width, int height) const;
+    // Read one back, image and all. Fails, quietly if there's no file, unless
+    // it was saved with the same sourceKey.
+    bool load(const char* path, const std::string& sourceKey, std::vector<unsigned char>& pixels, int& width, int& height);
+
+    static const char* getFilterName(KMipFilter filter);
+};
@@ -0,0 +1,96 @@
+#include "glad.h"
+#include "pipeline.h"
+#include "glstate.h"
+#include <iostream>
+
+std::unordered_map<std::string, KShaderProgram*> KProgramPipeline::stageCache;
+std::unordered_map<std::string, KShaderProgram*> KProgramPipeline::linkedCache;
+
+bool KProgramPipeline::isSupported()
+{
+    return GLAD_GL_ARB_separate_shader_objects;
+}
+
+KShaderProgram* KProgramPipeline::getStage(const char* shaderFilePath, unsigned int type)
+{
+    std::string key = std::to_string(type) + ":" + shaderFilePath;
+    auto cached = stageCache.find(key);
+    if (cached != stageCache.end())
+    {
+        return cached->second;
+    }
+    KShaderProgram* stage = new KShaderProgram(shaderFilePath, type);
+    stageCache.emplace(key, stage);
+    return stage;
+}
+
+KProgramPipeline::KProgramPipeline(const char* vertexShaderFilePath, const char* fragmentShaderFilePath) :
+    pipelineId(0), vertexStage(nullptr), fragmentStage(nullptr), linkedProgram(nullptr)
+{
+    if (isSupported())
+    {
+        vertexStage = getStage(vertexShaderFilePath, GL_VERTEX_SHADER);
+        fragmentStage = getStage(fragmentShaderFilePath, GL_FRAGMENT_SHADER);
+        usable = vertexStage->isUsable() && fragmentStage->isUsable();
+        glGenProgramPipelines(1, &pipelineId);
+        if (usable)
+        {
+            glUseProgramStages(pipelineId, GL_VERTEX_SHADER_BIT, vertexStage->getProgramId());
+            glUseProgramStages(pipelineId, GL_FRAGMENT_SHADER_BIT, fragmentStage->getProgramId());
+        }
+    }
+    else
+    {
+        std::string key = std::string(vertexShaderFilePath) + "|" + fragmentShaderFilePath;
+        auto cached = linkedCache.find(key);
+        if (cached != linkedCache.end())
+        {
+            linkedProgram = cached->second;
+        }
+        else
+        {
+            linkedProgram = new KShaderProgram(vertexShaderFilePath, fragmentShaderFilePath);
+            linkedCache.emplace(key, linkedProgram);
+        }
+        usable = linkedProgram->isUsable();
+    }
+}
+
+KProgramPipeline::~KProgramPipeline()
+{
+    if (pipelineId != 0)
+    {
+        KGLState::forgetProgramPipeline(pipelineId);
+        glDeleteProgramPipelines(1, &pipelineId);
+    }
+}
+
+bool KProgramPipeline::use()
+{
+    if (!usable)
+    {
+        return false;
+    }
+    if (linkedProgram)
+    {
+        return linkedProgram->use();
+    }
+    // A program in use takes priority over the bound pipeline
+    KShaderProgram::useNone();
+    KGLState::bindProgramPipeline(pipelineId);
+    return true;
+}
+
+void KProgramPipeline::clearCache()
+{
+    for (auto& entry : stageCache)
+    {
+        delete entry.second;
+    }
+    stageCache.clear();
+    for (auto& entry : linkedCache)
+    {
+        delete entry.second;
+    }
+    linkedCache.clear();
+}
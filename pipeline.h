@@ -0,0 +1,57 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include "shader.h"
+
+// A vertex and a fragment stage combined at bind time.
+//
+// With separate shader objects (ARB_separate_shader_objects, core in 4.1), each
+// stage is linked once on its own and shared by every pipeline that uses it,
+// so new vertex/fragment combinations don't need a link step. Without them,
+// each combination is linked into a regular program, once.
+class KProgramPipeline
+{
+protected:
+    unsigned int pipelineId;
+    KShaderProgram* vertexStage;
+    KShaderProgram* fragmentStage;
+    // Used instead of the stages if separate shader objects are unavailable
+    KShaderProgram* linkedProgram;
+    bool usable;
+
+    static std::unordered_map<std::string, KShaderProgram*> stageCache;
+    static std::unordered_map<std::string, KShaderProgram*> linkedCache;
+    static KShaderProgram* getStage(const char* shaderFilePath, unsigned int type);
+public:
+    KProgramPipeline(const char* vertexShaderFilePath, const char* fragmentShaderFilePath);
+    ~KProgramPipeline();
+    KProgramPipeline(const KProgramPipeline&) = delete;
+    KProgramPipeline& operator= (const KProgramPipeline&) = delete;
+
+    static bool isSupported();
+
+    bool use();
+    bool isUsable() const { return usable; }
+    bool isSeparable() const { return linkedProgram == nullptr; }
+
+    // The program that receives vertex attributes, for reflection
+    const KShaderProgram& getVertexProgram() const { return linkedProgram ? *linkedProgram : *vertexStage; }
+
+    // Same as KShaderProgram::setUniform. Without separate shader objects the
+    // pipeline must be in use; with them, each stage that has the uniform
+    // gets it straight away through glProgramUniform*.
+    template<typename... Args> bool setUniform(const char* name, Args... args)
+    {
+        if (linkedProgram)
+        {
+            return linkedProgram->setUniform(name, args...);
+        }
+        bool set = vertexStage->setUniform(name, args...);
+        return fragmentStage->setUniform(name, args...) || set;
+    }
+
+    // Delete all cached stages and linked programs. Pipelines using them
+    // must be gone by then.
+    static void clearCache();
+};
@@ -0,0 +1,90 @@
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+#include <cstdint>
+
+// Use stb_image.h. meson builds this as pngbench, pngbench_scalar (without
+// the SSE2 unfiltering) and pngbench_zlib (inflating with zlib) to compare.
+#define STB_IMAGE_IMPLEMENTATION
+#define STBI_ONLY_PNG
+#include "stb_image.h"
+
+// PNG decode benchmark over our textures.
+//
+// Usage: pngbench [iterations] [file.png ...]
+// The checksum is of the decoded pixels, so it should match between builds.
+
+int main(int argc, char** argv)
+{
+    int iterations = argc > 1 ? std::atoi(argv[1]) : 50;
+    std::vector<const char*> files;
+    for (int arg = 2; arg < argc; arg++)
+    {
+        files.push_back(argv[arg]);
+    }
+    if (files.empty())
+    {
+        files = {"dirbri18.png", "awesomeface.png", "bitmapfont.png"};
+    }
+#if defined(STBI_NO_SIMD)
+    std::cout << "Scalar unfiltering";
+#else
+    std::cout << "SSE2 unfiltering";
+#endif
+#if defined(STBI_USE_ZLIB)
+    std::cout << ", zlib inflate" << std::endl;
+#else
+    std::cout << ", stb_image inflate" << std::endl;
+#endif
+
+    double totalSeconds = 0;
+    double totalMegabytes = 0;
+    for (const char* path : files)
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+        {
+            std::cerr << "Failed to open " << path << std::endl;
+            continue;
+        }
+        std::vector<unsigned char> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+        int width = 0, height = 0, channels = 0;
+        std::uint32_t checksum = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; i++)
+        {
+            unsigned char* pixels = stbi_load_from_memory(data.data(), data.size(), &width, &height, &channels, 0);
+            if (!pixels)
+            {
+                std::cerr << "Failed to decode " << path << ": " << stbi_failure_reason() << std::endl;
+                break;
+            }
+            if (i == 0)
+            {
+                // FNV-1a
+                checksum = 2166136261u;
+                for (int byte = 0; byte < width * height * channels; byte++)
+                {
+                    checksum = (checksum ^ pixels[byte]) * 16777619u;
+                }
+            }
+            stbi_image_free(pixels);
+        }
+        std::chrono::duration<double> spent = std::chrono::steady_clock::now() - start;
+        double megabytes = (double)width * height * channels * iterations / (1024.0 * 1024.0);
+        totalSeconds += spent.count();
+        totalMegabytes += megabytes;
+        std::cout << path << ": " << width << "x" << height << "x" << channels << ", " <<
+            spent.count() * 1000.0 / iterations << " ms per decode, " <<
+            megabytes / spent.count() << " MB/s, checksum " << std::hex << checksum << std::dec << std::endl;
+    }
+    if (totalSeconds > 0)
+    {
+        std::cout << "Total: " << totalMegabytes / totalSeconds << " MB/s" << std::endl;
+    }
+    return 0;
+}
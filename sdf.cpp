@@ -0,0 +1,174 @@
+#include "sdf.h"
+#include <thread>
+#include <cmath>
+#include <algorithm>
+#include <limits>
+
+// Squared distance for texels with nothing in range. Big, but far enough
+// from FLT_MAX that adding to it doesn't overflow.
+static const float farAway = 1e20f;
+
+// Calls work(begin, end) over ranges of count lines, split between threads
+template <typename Work>
+static void parallelLines(int count, int length, unsigned int threads, const Work& work)
+{
+    if (threads > (unsigned int)count)
+    {
+        threads = count;
+    }
+    // Not worth starting threads for small images
+    if (threads <= 1 || (std::size_t)count * length < 64 * 64)
+    {
+        work(0, count);
+        return;
+    }
+    std::vector<std::thread> workers;
+    for (unsigned int i = 1; i < threads; i++)
+    {
+        workers.emplace_back(work, count * i / threads, count * (i + 1) / threads);
+    }
+    work(0, count / threads);
+    for (std::thread& worker : workers)
+    {
+        worker.join();
+    }
+}
+
+// Scratch space for distance1D, a line's worth
+struct KLineScratch
+{
+    std::vector<float> f;
+    std::vector<float> d;
+    std::vector<int> v;
+    std::vector<float> z;
+
+    explicit KLineScratch(int length) : f(length), d(length), v(length), z(length + 1) {}
+};
+
+// The 1D transform: d[q] is the smallest (q - p)^2 + f[p] over the line,
+// found from the lower envelope of the parabolas rooted at each p
+static void distance1D(KLineScratch& line, int n)
+{
+    const float* f = line.f.data();
+    float* d = line.d.data();
+    int* v = line.v.data();
+    float* z = line.z.data();
+    int k = 0;
+    v[0] = 0;
+    z[0] = -std::numeric_limits<float>::infinity();
+    z[1] = std::numeric_limits<float>::infinity();
+    for (int q = 1; q < n; q++)
+    {
+        // Where this parabola crosses the last one in the envelope. Drop
+        // the ones it hides completely.
+        float s = ((f[q] + (float)q * q) - (f[v[k]] + (float)v[k] * v[k])) / (2.f * (q - v[k]));
+        while (s <= z[k])
+        {
+            k--;
+            s = ((f[q] + (float)q * q) - (f[v[k]] + (float)v[k] * v[k])) / (2.f * (q - v[k]));
+        }
+        k++;
+        v[k] = q;
+        z[k] = s;
+        z[k + 1] = std::numeric_limits<float>::infinity();
+    }
+    k = 0;
+    for (int q = 0; q < n; q++)
+    {
+        while (z[k + 1] < q)
+        {
+            k++;
+        }
+        float offset = (float)(q - v[k]);
+        d[q] = offset * offset + f[v[k]];
+    }
+}
+
+// Squared distance from each texel to the nearest one where source is 0,
+// transforming the columns then the rows, a cell at a time
+static void transform(std::vector<float>& field, int width, int height, int cellWidth, int cellHeight, unsigned int threads)
+{
+    parallelLines(width, height, threads, [&](int begin, int end)
+    {
+        KLineScratch line(cellHeight);
+        for (int x = begin; x < end; x++)
+        {
+            for (int top = 0; top < height; top += cellHeight)
+            {
+                int n = std::min(cellHeight, height - top);
+                for (int y = 0; y < n; y++)
+                {
+                    line.f[y] = field[(std::size_t)(top + y) * width + x];
+                }
+                distance1D(line, n);
+                for (int y = 0; y < n; y++)
+                {
+                    field[(std::size_t)(top + y) * width + x] = line.d[y];
+                }
+            }
+        }
+    });
+    parallelLines(height, width, threads, [&](int begin, int end)
+    {
+        KLineScratch line(cellWidth);
+        for (int y = begin; y < end; y++)
+        {
+            float* row = &field[(std::size_t)y * width];
+            for (int left = 0; left < width; left += cellWidth)
+            {
+                int n = std::min(cellWidth, width - left);
+                std::copy(row + left, row + left + n, line.f.begin());
+                distance1D(line, n);
+                std::copy(line.d.begin(), line.d.begin() + n, row + left);
+            }
+        }
+    });
+}
+
+void KDistanceField::generate(const unsigned char* image, int width, int height, int channels, int pitch, int channel,
+    int scale, float spread, int cellWidth, int cellHeight, unsigned int threads)
+{
+    if (pitch == 0)
+    {
+        pitch = width * channels;
+    }
+    if (threads == 0)
+    {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    this->width = width * scale;
+    this->height = height * scale;
+    cellWidth = (cellWidth > 0 ? cellWidth : width) * scale;
+    cellHeight = (cellHeight > 0 ? cellHeight : height) * scale;
+
+    // Distances to the nearest texel inside, and to the nearest outside
+    std::size_t count = (std::size_t)this->width * this->height;
+    std::vector<float> toInside(count);
+    std::vector<float> toOutside(count);
+    for (int y = 0; y < this->height; y++)
+    {
+        const unsigned char* row = image + (std::size_t)(y / scale) * pitch;
+        for (int x = 0; x < this->width; x++)
+        {
+            bool inside = row[(x / scale) * channels + channel] >= 128;
+            toInside[(std::size_t)y * this->width + x] = inside ? 0.f : farAway;
+            toOutside[(std::size_t)y * this->width + x] = inside ? farAway : 0.f;
+        }
+    }
+    transform(toInside, this->width, this->height, cellWidth, cellHeight, threads);
+    transform(toOutside, this->width, this->height, cellWidth, cellHeight, threads);
+
+    // The distances are between texel centres, and the edge is half a texel
+    // from the centres either side of it
+    pixels.resize(count);
+    float toByte = 127.f / spread;
+    parallelLines(this->height, this->width, threads, [&](int begin, int end)
+    {
+        for (std::size_t i = (std::size_t)begin * this->width; i < (std::size_t)end * this->width; i++)
+        {
+            float distance = toInside[i] > 0 ? -(std::sqrt(toInside[i]) - .5f) : std::sqrt(toOutside[i]) - .5f;
+            float value = 128.f + distance * toByte;
+            pixels[i] = (unsigned char)std::min(std::max(value + .5f, 0.f), 255.f);
+        }
+    });
+}
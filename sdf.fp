@@ -0,0 +1,26 @@
+#version 330 core
+// Text from a distance field made by KDistanceField, in place of 2d.fp. The
+// edge is at 0.5, and is smoothed over about a pixel whatever the scale, so
+// one texture does for every size.
+in vec2 uv;
+out vec4 gl_FragColor;
+
+uniform sampler2D theTexture;
+uniform vec4 textColor;
+// Drawn under the text, shadowOffset away in UV units. The field has to
+// reach at least that far from the glyphs.
+uniform vec4 shadowColor;
+uniform vec2 shadowOffset;
+
+float coverage(float distance)
+{
+    float width = max(fwidth(distance) * 0.5, 1e-4);
+    return smoothstep(0.5 - width, 0.5 + width, distance);
+}
+
+void main()
+{
+    float text = coverage(texture(theTexture, uv).r);
+    float shadow = coverage(texture(theTexture, uv - shadowOffset).r);
+    gl_FragColor = mix(shadowColor * shadow, textColor, text);
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <vector>
+
+// A signed distance field of an 8 bit image, for drawing it sharp at any
+// size with sdf.fp. Each texel is the distance to the nearest edge: 128 on
+// the edge, up to 255 inside and down to 0 outside, saturating at spread
+// texels away.
+//
+// One channel of the image is thresholded at 128, scaled up with nearest
+// filtering (which is what suits a pixel font), and then put through the
+// exact Euclidean distance transform of Felzenszwalb and Huttenlocher. Its
+// column and row passes are split over threads. Distances don't cross cell
+// boundaries, so the glyphs of a font don't bleed into each other.
+//
+// Doesn't need GL, so the offline tools can use it too.
+class KDistanceField
+{
+public:
+    int width;
+    int height;
+    // One byte per texel, tightly packed
+    std::vector<unsigned char> pixels;
+
+    KDistanceField() : width(0), height(0) {}
+
+    // pitch is the bytes per row of the image, 0 if tightly packed. The
+    // field is scale times the size of the image, and cellWidth and
+    // cellHeight are in image texels, 0 for the whole image. threads 0
+    // means one per core.
+    void generate(const unsigned char* image, int width, int height, int channels, int pitch, int channel,
+        int scale, float spread, int cellWidth = 0, int cellHeight = 0, unsigned int threads = 0);
+};
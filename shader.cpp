@@ -2,6 +2,8 @@
 #include "shader.h"
 #include <iostream>
 #include <fstream>
+#include <algorithm>
+#include <cstring>
 #include <sys/stat.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
@@ -9,47 +11,106 @@
 // Static members are initialized outside of the constructor
 KShaderProgram* KShaderProgram::currentProgram = nullptr;
 
-KShaderProgram::KShaderProgram(const char* vertexShaderFilePath, const char* fragmentShaderFilePath)
+KShaderProgram::KShaderProgram(const char* vertexShaderFilePath, const char* fragmentShaderFilePath) :
+    KShaderProgram({{vertexShaderFilePath, GL_VERTEX_SHADER}, {fragmentShaderFilePath, GL_FRAGMENT_SHADER}})
+{
+}
+
+KShaderProgram::KShaderProgram(std::initializer_list<KShaderSource> stages)
 {
     // Required according to the terms of the Happy Bunny License (Modified MIT license)
     std::cout << "GLM: Copyright (c) 2005 - G-Truc Creation" << std::endl;
-    usable = true;
-    if (!compileShader(vertexShaderFilePath, GL_VERTEX_SHADER, vertexId))
+    separable = false;
+    usable = build(stages.begin(), stages.size());
+}
+
+KShaderProgram::KShaderProgram(const char* shaderFilePath, unsigned int type)
+{
+    separable = true;
+    KShaderSource stage = {shaderFilePath, type};
+    usable = build(&stage, 1);
+}
+
+bool KShaderProgram::build(const KShaderSource* stages, unsigned int stageCount)
+{
+    bool success = true;
+    bool hasVertexStage = false;
+    computeStage = false;
+    std::vector<unsigned int> shaderIds;
+    programId = glCreateProgram();
+    for (unsigned int stage = 0; stage < stageCount; stage++)
     {
-        usable = false;
-        // Error messages are printed inside compileShader
+        unsigned int shaderId;
+        if (!compileShader(stages[stage].path, stages[stage].type, shaderId))
+        {
+            // Error messages are printed inside compileShader
+            success = false;
+            continue;
+        }
+        shaderIds.push_back(shaderId);
+        hasVertexStage = hasVertexStage || stages[stage].type == GL_VERTEX_SHADER;
+        computeStage = computeStage || stages[stage].type == GL_COMPUTE_SHADER;
     }
-    if (!compileShader(fragmentShaderFilePath, GL_FRAGMENT_SHADER, fragmentId))
+
+    if (success)
     {
-        usable = false;
+        if (separable)
+        {
+            glProgramParameteri(programId, GL_PROGRAM_SEPARABLE, GL_TRUE);
+        }
+        for (unsigned int shaderId : shaderIds)
+        {
+            glAttachShader(programId, shaderId);
+        }
+        success = linkProgram();
+        for (unsigned int shaderId : shaderIds)
+        {
+            glDetachShader(programId, shaderId);
+        }
     }
 
-    programId = glCreateProgram();
-    glAttachShader(programId, vertexId);
-    glAttachShader(programId, fragmentId);
-    glLinkProgram(programId);
-
-    int linkStatus;
-    char infoLog[512];
-    glGetProgramiv(programId, GL_LINK_STATUS, &linkStatus);
-    if (!linkStatus)
+    // Free shaders
+    for (unsigned int shaderId : shaderIds)
     {
-        glGetProgramInfoLog(programId, 512, nullptr, infoLog);
-        std::cerr << "Failed to link shader program for some reason: " << std::endl << infoLog << std::endl;
-        usable = false;
+        glDeleteShader(shaderId);
     }
 
-    // Free shaders
-    glDeleteShader(vertexId);
-    glDeleteShader(fragmentId);
+    if (success && hasVertexStage)
+    {
+        reflectAttributes();
+    }
+    if (success && computeStage)
+    {
+        glGetProgramiv(programId, GL_COMPUTE_WORK_GROUP_SIZE, workGroupSize);
+    }
+    return success;
 }
 
 KShaderProgram::~KShaderProgram()
 {
     if (currentProgram == this)
     {
-        glUseProgram(0);
+        KGLState::useProgram(0);
+        currentProgram = nullptr;
     }
+    KGLState::forgetProgram(programId);
+    glDeleteProgram(programId);
+}
+
+bool KShaderProgram::linkProgram()
+{
+    glLinkProgram(programId);
+
+    int linkStatus;
+    char infoLog[512];
+    glGetProgramiv(programId, GL_LINK_STATUS, &linkStatus);
+    if (!linkStatus)
+    {
+        glGetProgramInfoLog(programId, 512, nullptr, infoLog);
+        std::cerr << "Failed to link shader program for some reason: " << std::endl << infoLog << std::endl;
+        return false;
+    }
+    return true;
 }
 
 bool KShaderProgram::compileShader(const char* filename, unsigned int type, unsigned int &id)
@@ -64,8 +125,7 @@ bool KShaderProgram::compileShader(const char* filename, unsigned int type, unsi
         case GL_FRAGMENT_SHADER:
             shaderType = "fragment";
             break;
-            /*
-             // Only available in newer GL versions?
+        // GL 4.0/4.3 or ARB_tessellation_shader/ARB_compute_shader
         case GL_TESS_CONTROL_SHADER:
             shaderType = "tesselation control";
             break;
@@ -75,7 +135,6 @@ bool KShaderProgram::compileShader(const char* filename, unsigned int type, unsi
         case GL_COMPUTE_SHADER:
             shaderType = "compute";
             break;
-            */
         case GL_GEOMETRY_SHADER:
             shaderType = "geometry";
             break;
@@ -126,6 +185,82 @@ bool KShaderProgram::compileShader(const char* filename, unsigned int type, unsi
     return true;
 }
 
+void KShaderProgram::reflectAttributes()
+{
+    int attributeCount = 0;
+    int maxNameLength = 0;
+    glGetProgramiv(programId, GL_ACTIVE_ATTRIBUTES, &attributeCount);
+    glGetProgramiv(programId, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &maxNameLength);
+    std::vector<char> nameBuffer(maxNameLength + 1);
+    attributes.clear();
+    for (int index = 0; index < attributeCount; index++)
+    {
+        KShaderAttribute attribute;
+        int nameLength = 0;
+        glGetActiveAttrib(programId, index, nameBuffer.size(), &nameLength, &attribute.size, &attribute.type, nameBuffer.data());
+        attribute.name.assign(nameBuffer.data(), nameLength);
+        attribute.location = glGetAttribLocation(programId, attribute.name.c_str());
+        // Built-ins like gl_VertexID show up here with location -1
+        if (attribute.location >= 0)
+        {
+            attributes.push_back(attribute);
+        }
+    }
+    std::sort(attributes.begin(), attributes.end(), [](const KShaderAttribute& a, const KShaderAttribute& b) {
+        return a.location < b.location;
+    });
+    attributeSignature.clear();
+    for (const KShaderAttribute& attribute : attributes)
+    {
+        attributeSignature += attribute.name + ":" + std::to_string(attribute.location) + ":" +
+            std::to_string(attribute.type) + ":" + std::to_string(attribute.size) + ";";
+    }
+}
+
+const KShaderAttribute* KShaderProgram::findAttribute(const char* name) const
+{
+    for (const KShaderAttribute& attribute : attributes)
+    {
+        if (std::strcmp(attribute.name.c_str(), name) == 0)
+        {
+            return &attribute;
+        }
+    }
+    return nullptr;
+}
+
+bool KShaderProgram::isComputeSupported()
+{
+    return GLAD_GL_ARB_compute_shader && GLAD_GL_ARB_shader_storage_buffer_object;
+}
+
+bool KShaderProgram::dispatch(unsigned int invocationsX, unsigned int invocationsY, unsigned int invocationsZ)
+{
+    if (!computeStage || !use())
+    {
+        return false;
+    }
+    // Round up to whole work groups. The shader has to skip invocations
+    // past the end itself.
+    glDispatchCompute(
+        (invocationsX + workGroupSize[0] - 1) / workGroupSize[0],
+        (invocationsY + workGroupSize[1] - 1) / workGroupSize[1],
+        (invocationsZ + workGroupSize[2] - 1) / workGroupSize[2]);
+    return true;
+}
+
+bool KShaderProgram::dispatchIndirect(unsigned int buffer, long offset)
+{
+    if (!computeStage || !use())
+    {
+        return false;
+    }
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, buffer);
+    glDispatchComputeIndirect(offset);
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+    return true;
+}
+
 int KShaderProgram::getUniformLocation(const char* name)
 {
     int uniformLocation;
@@ -147,7 +282,14 @@ bool KShaderProgram::setUniform(const char* name, float x)
     int uniformLocation = getUniformLocation(name);
     if (uniformLocation >= 0)
     {
-        glUniform1f(uniformLocation, x);
+        if (separable)
+        {
+            glProgramUniform1f(programId, uniformLocation, x);
+        }
+        else
+        {
+            glUniform1f(uniformLocation, x);
+        }
         return true;
     }
     return false;
@@ -158,7 +300,14 @@ bool KShaderProgram::setUniform(const char* name, float x, float y)
     int uniformLocation = getUniformLocation(name);
     if (uniformLocation >= 0)
     {
-        glUniform2f(uniformLocation, x, y);
+        if (separable)
+        {
+            glProgramUniform2f(programId, uniformLocation, x, y);
+        }
+        else
+        {
+            glUniform2f(uniformLocation, x, y);
+        }
         return true;
     }
     return false;
@@ -169,7 +318,14 @@ bool KShaderProgram::setUniform(const char* name, float x, float y, float z)
     int uniformLocation = getUniformLocation(name);
     if (uniformLocation >= 0)
     {
-        glUniform3f(uniformLocation, x, y, z);
+        if (separable)
+        {
+            glProgramUniform3f(programId, uniformLocation, x, y, z);
+        }
+        else
+        {
+            glUniform3f(uniformLocation, x, y, z);
+        }
         return true;
     }
     return false;
@@ -180,7 +336,14 @@ bool KShaderProgram::setUniform(const char* name, float x, float y, float z, flo
     int uniformLocation = getUniformLocation(name);
     if (uniformLocation >= 0)
     {
-        glUniform4f(uniformLocation, x, y, z, w);
+        if (separable)
+        {
+            glProgramUniform4f(programId, uniformLocation, x, y, z, w);
+        }
+        else
+        {
+            glUniform4f(uniformLocation, x, y, z, w);
+        }
         return true;
     }
     return false;
@@ -191,7 +354,32 @@ bool KShaderProgram::setUniform(const char* name, int x)
     int uniformLocation = getUniformLocation(name);
     if (uniformLocation >= 0)
     {
-        glUniform1i(uniformLocation, x);
+        if (separable)
+        {
+            glProgramUniform1i(programId, uniformLocation, x);
+        }
+        else
+        {
+            glUniform1i(uniformLocation, x);
+        }
+        return true;
+    }
+    return false;
+}
+
+bool KShaderProgram::setUniform(const char* name, unsigned int x)
+{
+    int uniformLocation = getUniformLocation(name);
+    if (uniformLocation >= 0)
+    {
+        if (separable)
+        {
+            glProgramUniform1ui(programId, uniformLocation, x);
+        }
+        else
+        {
+            glUniform1ui(uniformLocation, x);
+        }
         return true;
     }
     return false;
@@ -202,7 +390,14 @@ bool KShaderProgram::setUniform(const char* name, glm::mat4 matrix)
     int uniformLocation = getUniformLocation(name);
     if (uniformLocation >= 0)
     {
-        glUniformMatrix4fv(uniformLocation, 1, GL_FALSE, glm::value_ptr(matrix));
+        if (separable)
+        {
+            glProgramUniformMatrix4fv(programId, uniformLocation, 1, GL_FALSE, glm::value_ptr(matrix));
+        }
+        else
+        {
+            glUniformMatrix4fv(uniformLocation, 1, GL_FALSE, glm::value_ptr(matrix));
+        }
         return true;
     }
     return false;
@@ -213,7 +408,14 @@ bool KShaderProgram::setUniform(const char* name, KMatrix matrix)
     int uniformLocation = getUniformLocation(name);
     if (uniformLocation >= 0)
     {
-        glUniformMatrix4fv(uniformLocation, 1, GL_FALSE, matrix.GetEntryPtr());
+        if (separable)
+        {
+            glProgramUniformMatrix4fv(programId, uniformLocation, 1, GL_FALSE, matrix.GetEntryPtr());
+        }
+        else
+        {
+            glUniformMatrix4fv(uniformLocation, 1, GL_FALSE, matrix.GetEntryPtr());
+        }
         return true;
     }
     return false;
@@ -226,15 +428,36 @@ bool KShaderProgram::setUniform(const char* name, unsigned int mtxDim, float* ma
     {
         if (mtxDim == 2)
         {
-            glUniformMatrix2fv(uniformLocation, 1, GL_FALSE, matrix);
+            if (separable)
+            {
+                glProgramUniformMatrix2fv(programId, uniformLocation, 1, GL_FALSE, matrix);
+            }
+            else
+            {
+                glUniformMatrix2fv(uniformLocation, 1, GL_FALSE, matrix);
+            }
         }
         else if (mtxDim == 3)
         {
-            glUniformMatrix3fv(uniformLocation, 1, GL_FALSE, matrix);
+            if (separable)
+            {
+                glProgramUniformMatrix3fv(programId, uniformLocation, 1, GL_FALSE, matrix);
+            }
+            else
+            {
+                glUniformMatrix3fv(uniformLocation, 1, GL_FALSE, matrix);
+            }
         }
         else if (mtxDim == 4)
         {
-            glUniformMatrix4fv(uniformLocation, 1, GL_FALSE, matrix);
+            if (separable)
+            {
+                glProgramUniformMatrix4fv(programId, uniformLocation, 1, GL_FALSE, matrix);
+            }
+            else
+            {
+                glUniformMatrix4fv(uniformLocation, 1, GL_FALSE, matrix);
+            }
         }
     }
     return false;
@@ -1,43 +1,107 @@
 #pragma once
 
 #include <unordered_map>
+#include <initializer_list>
+#include <string>
+#include <vector>
 #include <glm/glm.hpp>
 #include "kmatrix.h"
+#include "glstate.h"
+
+// A vertex attribute as reported by glGetActiveAttrib
+struct KShaderAttribute
+{
+    std::string name;
+    int location;
+    unsigned int type; // GL_FLOAT_VEC3, GL_INT, etc.
+    int size; // Array size, 1 for non-arrays
+};
+
+// One stage of a program: a file with GLSL source, and the stage type
+// (GL_VERTEX_SHADER, GL_GEOMETRY_SHADER, GL_COMPUTE_SHADER, etc.)
+struct KShaderSource
+{
+    const char* path;
+    unsigned int type;
+};
 
 class KShaderProgram
 {
 protected:
     unsigned int programId;
-    unsigned int vertexId;
-    unsigned int fragmentId;
     static KShaderProgram *currentProgram;
     bool usable;
+    // Linked with GL_PROGRAM_SEPARABLE, for use in a program pipeline
+    bool separable;
+    bool computeStage;
+    // Local size of the compute stage, from the shader's layout qualifier
+    int workGroupSize[3];
     // Map of names to uniforms
     std::unordered_map<const char*, int> uniformMap;
+    // Active vertex attributes, sorted by location
+    std::vector<KShaderAttribute> attributes;
+    // Identifies the attribute interface, so programs with the same inputs
+    // can share vertex array objects
+    std::string attributeSignature;
 
     bool compileShader(const char* source, unsigned int type, unsigned int &id);
+    bool linkProgram();
+    bool build(const KShaderSource* stages, unsigned int stageCount);
+    void reflectAttributes();
 public:
     KShaderProgram(const char* vertexShaderFilePath, const char* fragmentShaderFilePath);
+    // Any combination of stages, e.g. vertex + geometry + fragment, or just
+    // a compute stage
+    KShaderProgram(std::initializer_list<KShaderSource> stages);
+    // Link a single stage on its own, to be combined with other stages in a
+    // KProgramPipeline. Requires separate shader object support.
+    KShaderProgram(const char* shaderFilePath, unsigned int type);
     ~KShaderProgram();
+    KShaderProgram(const KShaderProgram&) = delete;
+    KShaderProgram& operator= (const KShaderProgram&) = delete;
 
     bool use()
     {
-        if (usable)
+        // Separable programs are bound through their pipeline instead
+        if (usable && !separable)
         {
-            glUseProgram(programId);
+            KGLState::useProgram(programId);
             currentProgram = this;
         }
-        return usable;
+        return usable && !separable;
+    }
+    // Unbinds whichever program is in use, e.g. for a program pipeline
+    static void useNone()
+    {
+        KGLState::useProgram(0);
+        currentProgram = nullptr;
     }
 
     int getUniformLocation(const char* name);
+    // The program must be in use, unless it's separable
     bool setUniform(const char* name, float x);
     bool setUniform(const char* name, float x, float y);
     bool setUniform(const char* name, float x, float y, float z);
     bool setUniform(const char* name, float x, float y, float z, float w);
     bool setUniform(const char* name, int x);
+    bool setUniform(const char* name, unsigned int x);
     bool setUniform(const char* name, glm::mat4 matrix);
     bool setUniform(const char* name, KMatrix matrix);
     bool setUniform(const char* name, unsigned int mtxDim, float* matrix);
     unsigned int getProgramId() { return programId; }
+    bool isUsable() const { return usable; }
+    bool isSeparable() const { return separable; }
+    bool isCompute() const { return computeStage; }
+
+    // GL 4.3 compute shaders with shader storage buffers
+    static bool isComputeSupported();
+    // Run at least this many invocations of the compute stage, in as many
+    // work groups as needed. Uses the program.
+    bool dispatch(unsigned int invocationsX, unsigned int invocationsY = 1, unsigned int invocationsZ = 1);
+    // Same, with the work group counts read from a buffer
+    bool dispatchIndirect(unsigned int buffer, long offset = 0);
+
+    const std::vector<KShaderAttribute>& getAttributes() const { return attributes; }
+    const KShaderAttribute* findAttribute(const char* name) const;
+    const std::string& getAttributeSignature() const { return attributeSignature; }
 };
\ No newline at end of file
@@ -0,0 +1,180 @@
+#include "glad.h"
+#include "spritebatch.h"
+#include "glstate.h"
+#include <algorithm>
+#include <cstring>
+
+KSpriteBatch::KSpriteBatch(unsigned int maxQuads, unsigned int frameCount) : maxQuads(maxQuads), buffer(0), elementBuffer(0),
+    persistent(nullptr), fences(std::max(frameCount, 1u), nullptr), frame(0), quadCount(0), drawCalls(0), droppedQuads(0)
+{
+    quads.reserve(maxQuads);
+    order.reserve(maxQuads);
+    std::size_t size = (std::size_t)maxQuads * 4 * fences.size() * sizeof(KSpriteVertex);
+    glGenBuffers(1, &buffer);
+    KGLState::bindBuffer(GL_ARRAY_BUFFER, buffer);
+    if (GLAD_GL_ARB_buffer_storage)
+    {
+        // Coherent, so what's written is seen by draws without flushing
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_ARRAY_BUFFER, size, nullptr, flags);
+        persistent = (KSpriteVertex*)glMapBufferRange(GL_ARRAY_BUFFER, 0, size, flags);
+    }
+    else
+    {
+        glBufferData(GL_ARRAY_BUFFER, size, nullptr, GL_STREAM_DRAW);
+    }
+
+    // The same two triangles for every quad; flush() picks the frame's
+    // vertices with the base vertex
+    //   2   3
+    //   +---+
+    //   |  /|
+    //   |/  |
+    //   +---+
+    //   0   1
+    std::vector<unsigned int> elements((std::size_t)maxQuads * 6);
+    unsigned int corners[] = { 0, 1, 2, 1, 2, 3 };
+    for (unsigned int quad = 0; quad < maxQuads; quad++)
+    {
+        for (unsigned int i = 0; i < 6; i++)
+        {
+            elements[quad * 6 + i] = quad * 4 + corners[i];
+        }
+    }
+    // Not GL_ELEMENT_ARRAY_BUFFER, which would change whatever VAO is bound
+    glGenBuffers(1, &elementBuffer);
+    KGLState::bindBuffer(GL_COPY_WRITE_BUFFER, elementBuffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, elements.size() * sizeof(unsigned int), elements.data(), GL_STATIC_DRAW);
+    KGLState::bindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+KSpriteBatch::~KSpriteBatch()
+{
+    for (GLsync fence : fences)
+    {
+        if (fence)
+        {
+            glDeleteSync(fence);
+        }
+    }
+    if (persistent)
+    {
+        KGLState::bindBuffer(GL_ARRAY_BUFFER, buffer);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+    }
+    KGLState::forgetBuffer(buffer);
+    KGLState::forgetBuffer(elementBuffer);
+    KVAOCache::forgetBuffer(buffer);
+    KVAOCache::forgetBuffer(elementBuffer);
+    glDeleteBuffers(1, &buffer);
+    glDeleteBuffers(1, &elementBuffer);
+}
+
+KVertexLayout KSpriteBatch::getLayout()
+{
+    KVertexLayout layout;
+    layout.add("aPos", 2, GL_FLOAT).add("aUv", 2, GL_FLOAT);
+    return layout;
+}
+
+void KSpriteBatch::begin()
+{
+    quads.clear();
+    droppedQuads = 0;
+}
+
+void KSpriteBatch::add(unsigned int texture, const KSpriteVertex* corners, int layer)
+{
+    if (quads.size() >= maxQuads)
+    {
+        droppedQuads++;
+        return;
+    }
+    quads.emplace_back();
+    Quad& quad = quads.back();
+    quad.layer = layer;
+    quad.texture = texture;
+    std::memcpy(quad.corners, corners, sizeof(quad.corners));
+}
+
+void KSpriteBatch::addRect(unsigned int texture, float x0, float y0, float x1, float y1,
+    float u0, float v0, float u1, float v1, int layer)
+{
+    KSpriteVertex corners[] = {
+        {x0, y0, u0, v0},
+        {x1, y0, u1, v0},
+        {x0, y1, u0, v1},
+        {x1, y1, u1, v1},
+    };
+    add(texture, corners, layer);
+}
+
+void KSpriteBatch::flush(unsigned int textureUnit)
+{
+    quadCount = quads.size();
+    drawCalls = 0;
+    if (quads.empty())
+    {
+        return;
+    }
+    order.resize(quads.size());
+    for (unsigned int i = 0; i < order.size(); i++)
+    {
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [this](unsigned int a, unsigned int b)
+    {
+        const Quad& quadA = quads[a];
+        const Quad& quadB = quads[b];
+        return quadA.layer != quadB.layer ? quadA.layer < quadB.layer : quadA.texture < quadB.texture;
+    });
+
+    // This frame's part of the ring was last drawn from frameCount frames
+    // ago, so the GPU is almost always done with it already
+    GLsync& fence = fences[frame];
+    if (fence)
+    {
+        glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ull);
+        glDeleteSync(fence);
+        fence = nullptr;
+    }
+    unsigned int firstVertex = frame * maxQuads * 4;
+    std::size_t bytes = quads.size() * 4 * sizeof(KSpriteVertex);
+    KSpriteVertex* vertices = persistent ? persistent + firstVertex : nullptr;
+    KGLState::bindBuffer(GL_ARRAY_BUFFER, buffer);
+    if (!persistent)
+    {
+        // The fence already did the waiting, so don't let the driver
+        vertices = (KSpriteVertex*)glMapBufferRange(GL_ARRAY_BUFFER, firstVertex * sizeof(KSpriteVertex), bytes,
+            GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+        if (vertices == nullptr)
+        {
+            quads.clear();
+            return;
+        }
+    }
+    for (unsigned int i = 0; i < order.size(); i++)
+    {
+        std::memcpy(vertices + i * 4, quads[order[i]].corners, sizeof(quads[0].corners));
+    }
+    if (!persistent)
+    {
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+    }
+
+    // A draw for each run of quads with the same texture
+    unsigned int run = 0;
+    for (unsigned int i = 1; i <= order.size(); i++)
+    {
+        if (i == order.size() || quads[order[i]].texture != quads[order[run]].texture)
+        {
+            KGLState::bindTexture(textureUnit, GL_TEXTURE_2D, quads[order[run]].texture);
+            glDrawElementsBaseVertex(GL_TRIANGLES, (i - run) * 6, GL_UNSIGNED_INT, nullptr, firstVertex + run * 4);
+            drawCalls++;
+            run = i;
+        }
+    }
+    fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    frame = (frame + 1) % fences.size();
+    quads.clear();
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <vector>
+#include "glad.h"
+#include "vertexlayout.h"
+
+// A corner of a batched quad, in clip space, with its texture coordinates
+struct KSpriteVertex
+{
+    float x;
+    float y;
+    float u;
+    float v;
+};
+
+// Collects the 2D quads of a frame, from however many widgets, and draws
+// them with 2d.vp and 2d.fp in one draw call per texture. Quads are sorted
+// by layer, then texture, keeping the order they were added in otherwise,
+// so anything that overlaps and has to be drawn in order needs a layer of
+// its own.
+//
+// The vertices are written straight into a ring of frames in one vertex
+// buffer, each fenced after its draws so the next write to it waits for
+// the GPU to finish with it (which is frameCount frames later, so it
+// rarely does). With GL_ARB_buffer_storage the buffer stays mapped for
+// good; otherwise each frame's part is mapped unsynchronized, which the
+// fences make safe too. Nothing goes through glBufferSubData.
+class KSpriteBatch
+{
+public:
+    // Room for maxQuads quads a frame; any more are dropped
+    KSpriteBatch(unsigned int maxQuads = 4096, unsigned int frameCount = 3);
+    ~KSpriteBatch();
+    KSpriteBatch(const KSpriteBatch&) = delete;
+    KSpriteBatch& operator= (const KSpriteBatch&) = delete;
+
+    // The vertex buffer's layout, for 2d.vp
+    static KVertexLayout getLayout();
+    unsigned int getBuffer() const { return buffer; }
+    unsigned int getElementBuffer() const { return elementBuffer; }
+
+    // Starts collecting quads for a frame
+    void begin();
+    // 4 corners in QuadGrid order: bottom left, bottom right, top left, top
+    // right. texture is a GL_TEXTURE_2D.
+    void add(unsigned int texture, const KSpriteVertex* corners, int layer = 0);
+    // A rectangle, from (x0, y0) to (x1, y1) in clip space and (u0, v0) to
+    // (u1, v1) in the texture, in the same order
+    void addRect(unsigned int texture, float x0, float y0, float x1, float y1,
+        float u0, float v0, float u1, float v1, int layer = 0);
+    // Sorts and writes the quads, and draws them. The program (2d.vp with
+    // scale 1, translate 0 and uvRect 0, 0, 1, 1) and the VAO from
+    // getLayout() have to be in use, and the textures go on textureUnit
+    // (GL_TEXTURE0 + n), which theTexture should be set to.
+    void flush(unsigned int textureUnit);
+
+    unsigned int getQuadCount() const { return quadCount; }
+    unsigned int getDrawCalls() const { return drawCalls; }
+    unsigned int getDroppedQuads() const { return droppedQuads; }
+    bool isPersistent() const { return persistent != nullptr; }
+
+private:
+    struct Quad
+    {
+        int layer;
+        unsigned int texture;
+        KSpriteVertex corners[4];
+    };
+
+    unsigned int maxQuads;
+    unsigned int buffer;
+    // Quads as two triangles each, for every quad of a frame
+    unsigned int elementBuffer;
+    // The whole buffer, if it's persistently mapped
+    KSpriteVertex* persistent;
+    // One per frame of the ring, set after its draws
+    std::vector<GLsync> fences;
+    unsigned int frame;
+    std::vector<Quad> quads;
+    // Stops stable_sort having to copy whole quads around
+    std::vector<unsigned int> order;
+    unsigned int quadCount;
+    unsigned int drawCalls;
+    unsigned int droppedQuads;
+};
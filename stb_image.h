@@ -314,6 +314,11 @@ RECENT REVISION HISTORY:
 //   - If you use STBI_NO_PNG (or _ONLY_ without PNG), and you still
 //     want the zlib decoder to be available, #define STBI_SUPPORT_ZLIB
 //
+//   - #define STBI_USE_ZLIB to inflate PNG image data with zlib instead of
+//     the built in decoder, and link with zlib. Whether that's faster
+//     depends on the zlib: it checks the Adler-32 this decoder skips, so
+//     the stock one often isn't, but zlib-ng and friends are.
+//
 
 
 #ifndef STBI_NO_STDIO
@@ -675,7 +680,7 @@ static int stbi__cpuid3(void)
 
 #define STBI_SIMD_ALIGN(type, name) __declspec(align(16)) type name
 
-#if !defined(STBI_NO_JPEG) && defined(STBI_SSE2)
+#if (!defined(STBI_NO_JPEG) || !defined(STBI_NO_PNG)) && defined(STBI_SSE2)
 static int stbi__sse2_available(void)
 {
    int info3 = stbi__cpuid3();
@@ -686,7 +691,7 @@ static int stbi__sse2_available(void)
 #else // assume GCC-style if not VC++
 #define STBI_SIMD_ALIGN(type, name) type name __attribute__((aligned(16)))
 
-#if !defined(STBI_NO_JPEG) && defined(STBI_SSE2)
+#if (!defined(STBI_NO_JPEG) || !defined(STBI_NO_PNG)) && defined(STBI_SSE2)
 static int stbi__sse2_available(void)
 {
    // If we're even attempting to compile this on GCC/Clang, that means
@@ -4241,6 +4246,63 @@ static int stbi__do_zlib(stbi__zbuf *a, char *obuf, int olen, int exp, int parse
    return stbi__parse_zlib(a, parse_header);
 }
 
+#if defined(STBI_USE_ZLIB) && !defined(STBI_NO_PNG)
+#include <zlib.h>
+
+// Same as stbi_zlib_decode_malloc_guesssize_headerflag, but using zlib
+static char *stbi__zlib_inflate_malloc(const char *buffer, int len, int initial_size, int *outlen, int parse_header)
+{
+   z_stream stream;
+   int size = initial_size > 0 ? initial_size : 16384;
+   int result;
+   char *out = (char *) stbi__malloc(size);
+   if (out == NULL) return (char *) (stbi__errpuc("outofmem", "Out of memory"));
+   memset(&stream, 0, sizeof(stream));
+   stream.next_in = (Bytef *) buffer;
+   stream.avail_in = (uInt) len;
+   // negative window bits means no zlib header (iPhone PNGs)
+   if (inflateInit2(&stream, parse_header ? MAX_WBITS : -MAX_WBITS) != Z_OK) {
+      STBI_FREE(out);
+      return (char *) (stbi__errpuc("bad zlib header", "Corrupt PNG"));
+   }
+   for (;;) {
+      stream.next_out = (Bytef *) out + stream.total_out;
+      stream.avail_out = (uInt) (size - stream.total_out);
+      result = inflate(&stream, Z_NO_FLUSH);
+      if (result == Z_STREAM_END) break;
+      if (result != Z_OK && result != Z_BUF_ERROR) {
+         inflateEnd(&stream);
+         STBI_FREE(out);
+         return (char *) (stbi__errpuc("bad zlib data", "Corrupt PNG"));
+      }
+      if (stream.avail_out == 0) {
+         char *bigger;
+         if (size > INT_MAX / 2) {
+            inflateEnd(&stream);
+            STBI_FREE(out);
+            return (char *) (stbi__errpuc("outofmem", "Out of memory"));
+         }
+         size *= 2;
+         bigger = (char *) STBI_REALLOC_SIZED(out, size / 2, size);
+         if (bigger == NULL) {
+            inflateEnd(&stream);
+            STBI_FREE(out);
+            return (char *) (stbi__errpuc("outofmem", "Out of memory"));
+         }
+         out = bigger;
+      } else if (stream.avail_in == 0) {
+         // ran out of input before the end of the stream
+         inflateEnd(&stream);
+         STBI_FREE(out);
+         return (char *) (stbi__errpuc("unexpected end", "Corrupt PNG"));
+      }
+   }
+   *outlen = (int) stream.total_out;
+   inflateEnd(&stream);
+   return out;
+}
+#endif
+
 STBIDEF char *stbi_zlib_decode_malloc_guesssize(const char *buffer, int len, int initial_size, int *outlen)
 {
    stbi__zbuf a;
@@ -4392,6 +4454,83 @@ static int stbi__paeth(int a, int b, int c)
 
 static const stbi_uc stbi__depth_scale_table[9] = { 0, 0xff, 0x55, 0, 0x11, 0,0,0, 0x01 };
 
+#ifdef STBI_SSE2
+// SSE2 versions of the up and paeth filters for 8-bit RGB and RGBA rows. Up
+// has no dependency between pixels and does 16 bytes at a time. Paeth
+// depends on the pixel to its left, so goes a pixel at a time, but does all
+// of its channels at once without branches, as libpng's
+// filter_sse2_intrinsics.c does. Sub and avg are just an add (and a shift)
+// per byte, and the scalar loops are faster than that done a pixel at a time.
+static __m128i stbi__png_load_pixel(const stbi_uc *p, int bpp)
+{
+   int v = 0;
+   memcpy(&v, p, bpp);
+   return _mm_cvtsi32_si128(v);
+}
+
+static void stbi__png_store_pixel(stbi_uc *p, __m128i v, int bpp)
+{
+   int t = _mm_cvtsi128_si32(v);
+   memcpy(p, &t, bpp);
+}
+
+static __m128i stbi__sse2_select(__m128i mask, __m128i t, __m128i e)
+{
+   return _mm_or_si128(_mm_and_si128(mask, t), _mm_andnot_si128(mask, e));
+}
+
+// n bytes after the first pixel, which must already be done
+static stbi_inline void stbi__unfilter_sse2_bpp(int filter, stbi_uc *cur, const stbi_uc *raw, const stbi_uc *prior, int n, int bpp)
+{
+   int k = 0;
+   __m128i zero = _mm_setzero_si128();
+   __m128i a, b, c, x;
+   switch (filter) {
+      case STBI__F_up:
+         for (; k + 16 <= n; k += 16) {
+            x = _mm_loadu_si128((const __m128i *) (raw + k));
+            b = _mm_loadu_si128((const __m128i *) (prior + k));
+            _mm_storeu_si128((__m128i *) (cur + k), _mm_add_epi8(x, b));
+         }
+         for (; k < n; ++k)
+            cur[k] = STBI__BYTECAST(raw[k] + prior[k]);
+         break;
+      case STBI__F_paeth:
+         a = _mm_unpacklo_epi8(stbi__png_load_pixel(cur - bpp, bpp), zero);
+         c = _mm_unpacklo_epi8(stbi__png_load_pixel(prior - bpp, bpp), zero);
+         for (; k < n; k += bpp) {
+            __m128i pa, pb, pc, smallest, nearest;
+            b = _mm_unpacklo_epi8(stbi__png_load_pixel(prior + k, bpp), zero);
+            // p = a+b-c, so |p-a| = |b-c|, |p-b| = |a-c| and |p-c| = |(b-c)+(a-c)|
+            pa = _mm_sub_epi16(b, c);
+            pb = _mm_sub_epi16(a, c);
+            pc = _mm_add_epi16(pa, pb);
+            pa = _mm_max_epi16(pa, _mm_sub_epi16(zero, pa));
+            pb = _mm_max_epi16(pb, _mm_sub_epi16(zero, pb));
+            pc = _mm_max_epi16(pc, _mm_sub_epi16(zero, pc));
+            smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+            // ties go to a, then b, as in stbi__paeth
+            nearest = stbi__sse2_select(_mm_cmpeq_epi16(smallest, pa), a,
+                      stbi__sse2_select(_mm_cmpeq_epi16(smallest, pb), b, c));
+            x = _mm_add_epi8(_mm_packus_epi16(nearest, nearest), stbi__png_load_pixel(raw + k, bpp));
+            stbi__png_store_pixel(cur + k, x, bpp);
+            a = _mm_unpacklo_epi8(x, zero);
+            c = b;
+         }
+         break;
+   }
+}
+
+// separate copies for RGB and RGBA, so the pixel loads and stores are fixed size
+static void stbi__unfilter_sse2(int filter, stbi_uc *cur, const stbi_uc *raw, const stbi_uc *prior, int n, int bpp)
+{
+   if (bpp == 4)
+      stbi__unfilter_sse2_bpp(filter, cur, raw, prior, n, 4);
+   else
+      stbi__unfilter_sse2_bpp(filter, cur, raw, prior, n, 3);
+}
+#endif
+
 // create the png data from post-deflated data
 static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 raw_len, int out_n, stbi__uint32 x, stbi__uint32 y, int depth, int color)
 {
@@ -4405,6 +4544,9 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
    int output_bytes = out_n*bytes;
    int filter_bytes = img_n*bytes;
    int width = x;
+#ifdef STBI_SSE2
+   int use_sse2 = depth == 8 && (img_n == 3 || img_n == 4) && out_n == img_n && stbi__sse2_available();
+#endif
 
    STBI_ASSERT(out_n == s->img_n || out_n == s->img_n+1);
    a->out = (stbi_uc *) stbi__malloc_mad3(x, y, output_bytes, 0); // extra bytes to write off the end into
@@ -4474,6 +4616,12 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
       // this is a little gross, so that we don't switch per-pixel or per-component
       if (depth < 8 || img_n == out_n) {
          int nk = (width - 1)*filter_bytes;
+#ifdef STBI_SSE2
+         if (use_sse2 && (filter == STBI__F_up || filter == STBI__F_paeth))
+            stbi__unfilter_sse2(filter, cur, raw, prior, nk, filter_bytes);
+         else
+#endif
+         {
          #define STBI__CASE(f) \
              case f:     \
                 for (k=0; k < nk; ++k)
@@ -4488,6 +4636,7 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
             STBI__CASE(STBI__F_paeth_first)  { cur[k] = STBI__BYTECAST(raw[k] + stbi__paeth(cur[k-filter_bytes],0,0)); } break;
          }
          #undef STBI__CASE
+         }
          raw += nk;
       } else {
          STBI_ASSERT(img_n+1 == out_n);
@@ -4912,7 +5061,11 @@ static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
             // initial guess for decoded data size to avoid unnecessary reallocs
             bpl = (s->img_x * z->depth + 7) / 8; // bytes per line, per component
             raw_len = bpl * s->img_y * s->img_n /* pixels */ + s->img_y /* filter mode per row */;
+            #ifdef STBI_USE_ZLIB
+            z->expanded = (stbi_uc *) stbi__zlib_inflate_malloc((char *) z->idata, ioff, raw_len, (int *) &raw_len, !is_iphone);
+            #else
             z->expanded = (stbi_uc *) stbi_zlib_decode_malloc_guesssize_headerflag((char *) z->idata, ioff, raw_len, (int *) &raw_len, !is_iphone);
+            #endif
             if (z->expanded == NULL) return 0; // zlib should set error
             STBI_FREE(z->idata); z->idata = NULL;
             if ((req_comp == s->img_n+1 && req_comp != 3 && !pal_img_n) || has_trans)
@@ -0,0 +1,314 @@
+#include <iostream>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+#include "ktx.h"
+#include "mipmap.h"
+
+// Use stb_image.h
+#define STB_IMAGE_IMPLEMENTATION
+#define STBI_ONLY_PNG
+#include "stb_image.h"
+
+// Offline texture compressor: PNG in, KTX with a full mip chain of BC1
+// (RGB) or BC3 (RGBA) blocks out. Run at build time, so the programs can
+// upload the result with glCompressedTexImage2D instead of decoding PNGs
+// and generating mipmaps on every launch.
+//
+// Usage: texcompress input.png output.ktx [--no-mips] [--box] [--linear]
+//
+// Mip levels are made with a Kaiser filter in linear light (see
+// KMipChain), or a box filter with --box. --linear filters the sRGB values
+// as they are, which is right for normal maps and the like.
+
+// From glcorearb.h/glext.h. This doesn't use GL, so doesn't include them.
+static const std::uint32_t GL_RGB_ENUM = 0x1907;
+static const std::uint32_t GL_RGBA_ENUM = 0x1908;
+static const std::uint32_t GL_COMPRESSED_RGB_S3TC_DXT1 = 0x83F0;
+static const std::uint32_t GL_COMPRESSED_RGBA_S3TC_DXT5 = 0x83F3;
+
+struct Image
+{
+    int width;
+    int height;
+    // Always RGBA
+    std::vector<unsigned char> pixels;
+};
+
+// Copy a 4x4 block, clamping at the edges of images which aren't a multiple
+// of 4 in size
+static void fetchBlock(const Image& image, int blockX, int blockY, unsigned char block[16][4])
+{
+    for (int y = 0; y < 4; y++)
+    {
+        int sy = std::min(blockY * 4 + y, image.height - 1);
+        for (int x = 0; x < 4; x++)
+        {
+            int sx = std::min(blockX * 4 + x, image.width - 1);
+            std::memcpy(block[y * 4 + x], &image.pixels[(sy * image.width + sx) * 4], 4);
+        }
+    }
+}
+
+static unsigned short to565(const float color[3])
+{
+    int r = (int)(std::min(std::max(color[0], 0.f), 255.f) * 31.f / 255.f + 0.5f);
+    int g = (int)(std::min(std::max(color[1], 0.f), 255.f) * 63.f / 255.f + 0.5f);
+    int b = (int)(std::min(std::max(color[2], 0.f), 255.f) * 31.f / 255.f + 0.5f);
+    return (unsigned short)((r << 11) | (g << 5) | b);
+}
+
+static void from565(unsigned short packed, int color[3])
+{
+    int r = (packed >> 11) & 31;
+    int g = (packed >> 5) & 63;
+    int b = packed & 31;
+    color[0] = (r << 3) | (r >> 2);
+    color[1] = (g << 2) | (g >> 4);
+    color[2] = (b << 3) | (b >> 2);
+}
+
+// BC1 colour block: endpoints at the extremes of the block's colours along
+// their principal axis, then each texel gets the nearest of the 4 palette
+// entries.
+static void encodeColorBlock(const unsigned char block[16][4], unsigned char* out)
+{
+    float mean[3] = {0, 0, 0};
+    for (int i = 0; i < 16; i++)
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            mean[c] += block[i][c] / 16.f;
+        }
+    }
+    float cov[6] = {0, 0, 0, 0, 0, 0};
+    for (int i = 0; i < 16; i++)
+    {
+        float d[3] = {block[i][0] - mean[0], block[i][1] - mean[1], block[i][2] - mean[2]};
+        cov[0] += d[0] * d[0];
+        cov[1] += d[0] * d[1];
+        cov[2] += d[0] * d[2];
+        cov[3] += d[1] * d[1];
+        cov[4] += d[1] * d[2];
+        cov[5] += d[2] * d[2];
+    }
+    // Power iteration for the principal axis
+    float axis[3] = {1, 1, 1};
+    for (int iteration = 0; iteration < 8; iteration++)
+    {
+        float next[3] = {
+            cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2],
+            cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2],
+            cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2]
+        };
+        float largest = std::max(std::abs(next[0]), std::max(std::abs(next[1]), std::abs(next[2])));
+        if (largest < 1e-6f)
+        {
+            break;
+        }
+        for (int c = 0; c < 3; c++)
+        {
+            axis[c] = next[c] / largest;
+        }
+    }
+    float minDot = 1e30f, maxDot = -1e30f;
+    for (int i = 0; i < 16; i++)
+    {
+        float dot = (block[i][0] - mean[0]) * axis[0] + (block[i][1] - mean[1]) * axis[1] + (block[i][2] - mean[2]) * axis[2];
+        minDot = std::min(minDot, dot);
+        maxDot = std::max(maxDot, dot);
+    }
+    float length = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+    float low[3], high[3];
+    for (int c = 0; c < 3; c++)
+    {
+        low[c] = mean[c] + axis[c] * minDot / length;
+        high[c] = mean[c] + axis[c] * maxDot / length;
+    }
+    unsigned short color0 = to565(high);
+    unsigned short color1 = to565(low);
+    // color0 > color1 selects the 4 colour mode
+    if (color0 < color1)
+    {
+        std::swap(color0, color1);
+    }
+    unsigned int indices = 0;
+    if (color0 != color1)
+    {
+        int palette[4][3];
+        from565(color0, palette[0]);
+        from565(color1, palette[1]);
+        for (int c = 0; c < 3; c++)
+        {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        }
+        for (int i = 0; i < 16; i++)
+        {
+            int best = 0;
+            int bestError = 1 << 30;
+            for (int p = 0; p < 4; p++)
+            {
+                int error = 0;
+                for (int c = 0; c < 3; c++)
+                {
+                    int d = block[i][c] - palette[p][c];
+                    error += d * d;
+                }
+                if (error < bestError)
+                {
+                    bestError = error;
+                    best = p;
+                }
+            }
+            indices |= best << (i * 2);
+        }
+    }
+    out[0] = color0 & 0xFF;
+    out[1] = color0 >> 8;
+    out[2] = color1 & 0xFF;
+    out[3] = color1 >> 8;
+    for (int i = 0; i < 4; i++)
+    {
+        out[4 + i] = (indices >> (i * 8)) & 0xFF;
+    }
+}
+
+// BC3 alpha block: the block's min and max alpha, with 6 values between
+static void encodeAlphaBlock(const unsigned char block[16][4], unsigned char* out)
+{
+    int alpha0 = 0, alpha1 = 255;
+    for (int i = 0; i < 16; i++)
+    {
+        alpha0 = std::max(alpha0, (int)block[i][3]);
+        alpha1 = std::min(alpha1, (int)block[i][3]);
+    }
+    int palette[8];
+    palette[0] = alpha0;
+    palette[1] = alpha1;
+    for (int p = 1; p < 7; p++)
+    {
+        palette[p + 1] = ((7 - p) * alpha0 + p * alpha1) / 7;
+    }
+    unsigned long long indices = 0;
+    for (int i = 0; i < 16; i++)
+    {
+        int best = 0;
+        int bestError = 256;
+        for (int p = 0; p < 8; p++)
+        {
+            int error = std::abs(block[i][3] - palette[p]);
+            if (error < bestError)
+            {
+                bestError = error;
+                best = p;
+            }
+        }
+        indices |= (unsigned long long)best << (i * 3);
+    }
+    out[0] = alpha0;
+    out[1] = alpha1;
+    for (int i = 0; i < 6; i++)
+    {
+        out[2 + i] = (indices >> (i * 8)) & 0xFF;
+    }
+}
+
+static std::vector<unsigned char> compress(const Image& image, bool alpha)
+{
+    int blocksX = (image.width + 3) / 4;
+    int blocksY = (image.height + 3) / 4;
+    int blockSize = alpha ? 16 : 8;
+    std::vector<unsigned char> out(blocksX * blocksY * blockSize);
+    unsigned char block[16][4];
+    unsigned char* dest = out.data();
+    for (int y = 0; y < blocksY; y++)
+    {
+        for (int x = 0; x < blocksX; x++)
+        {
+            fetchBlock(image, x, y, block);
+            if (alpha)
+            {
+                encodeAlphaBlock(block, dest);
+                dest += 8;
+            }
+            encodeColorBlock(block, dest);
+            dest += 8;
+        }
+    }
+    return out;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 3)
+    {
+        std::cerr << "Usage: " << argv[0] << " input.png output.ktx [--no-mips] [--box] [--linear]" << std::endl;
+        return 1;
+    }
+    bool mips = true;
+    KMipFilter filter = MIP_KAISER;
+    bool gammaCorrect = true;
+    for (int arg = 3; arg < argc; arg++)
+    {
+        if (std::strcmp(argv[arg], "--no-mips") == 0)
+        {
+            mips = false;
+        }
+        else if (std::strcmp(argv[arg], "--box") == 0)
+        {
+            filter = MIP_BOX;
+        }
+        else if (std::strcmp(argv[arg], "--linear") == 0)
+        {
+            gammaCorrect = false;
+        }
+        else
+        {
+            std::cerr << "Unknown option " << argv[arg] << std::endl;
+            return 1;
+        }
+    }
+
+    Image image;
+    int channels;
+    unsigned char* data = stbi_load(argv[1], &image.width, &image.height, &channels, 4);
+    if (!data)
+    {
+        std::cerr << "Failed to load " << argv[1] << ": " << stbi_failure_reason() << std::endl;
+        return 1;
+    }
+    image.pixels.assign(data, data + image.width * image.height * 4);
+    stbi_image_free(data);
+
+    // Indexed images report the channels of their palette, so this covers
+    // those with transparency too
+    bool alpha = channels == 2 || channels == 4;
+    KKTXFile ktx;
+    ktx.internalFormat = alpha ? GL_COMPRESSED_RGBA_S3TC_DXT5 : GL_COMPRESSED_RGB_S3TC_DXT1;
+    ktx.baseInternalFormat = alpha ? GL_RGBA_ENUM : GL_RGB_ENUM;
+    ktx.width = image.width;
+    ktx.height = image.height;
+    ktx.levels.push_back(compress(image, alpha));
+    if (mips)
+    {
+        KMipChain chain;
+        chain.generate(image.pixels.data(), image.width, image.height, 4, filter, gammaCorrect, 0);
+        for (KMipLevel& level : chain.levels)
+        {
+            image.width = level.width;
+            image.height = level.height;
+            image.pixels.swap(level.pixels);
+            ktx.levels.push_back(compress(image, alpha));
+        }
+    }
+    if (!ktx.write(argv[2]))
+    {
+        return 1;
+    }
+    std::cout << argv[2] << ": " << ktx.width << "x" << ktx.height << " " << (alpha ? "BC3" : "BC1") <<
+        ", " << ktx.levels.size() << " levels" << (mips ? std::string(", ") + KMipChain::getFilterName(filter) + " filter" : "") << std::endl;
+    return 0;
+}
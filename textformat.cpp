@@ -0,0 +1,403 @@
+#include "textformat.h"
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+
+// Room for the integer digits of the biggest double, the point and the
+// most decimals fixedDigits writes
+static const int MAX_DIGITS = 352;
+static const int MAX_FIXED_PRECISION = 17;
+
+// Digits of value in base, most significant first. Returns how many.
+static int unsignedDigits(unsigned long long value, unsigned int base, bool upper, char* out)
+{
+    const char* digitChars = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    char reversed[64];
+    int count = 0;
+    do
+    {
+        reversed[count++] = digitChars[value % base];
+        value /= base;
+    } while (value != 0);
+    for (int i = 0; i < count; i++)
+    {
+        out[i] = reversed[count - 1 - i];
+    }
+    return count;
+}
+
+// Integers get at least precision digits
+static int padDigits(char* digits, int count, int precision)
+{
+    precision = std::min(precision, MAX_DIGITS);
+    if (precision <= count)
+    {
+        return count;
+    }
+    std::memmove(digits + precision - count, digits, count);
+    std::fill(digits, digits + precision - count, '0');
+    return precision;
+}
+
+// The magnitude of value to precision decimal places, at most
+// MAX_FIXED_PRECISION. Returns how many characters.
+static int fixedDigits(double value, int precision, bool upper, char* out)
+{
+    static const double powers[MAX_FIXED_PRECISION + 1] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8,
+        1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17
+    };
+    value = std::fabs(value);
+    if (std::isnan(value) || std::isinf(value))
+    {
+        const char* name = std::isnan(value) ? (upper ? "NAN" : "nan") : (upper ? "INF" : "inf");
+        std::memcpy(out, name, 3);
+        return 3;
+    }
+    precision = std::min(precision, MAX_FIXED_PRECISION);
+    int count;
+    double scaled = value * powers[precision];
+    if (scaled < 9e18)
+    {
+        // One integer, rounded once, so 9.99995 to 4 places is 10.0000
+        double whole = std::floor(scaled);
+        double fraction = scaled - whole;
+        unsigned long long rounded = (unsigned long long)whole;
+        if (fraction > .5)
+        {
+            rounded++;
+        }
+        else if (fraction == .5)
+        {
+            // printf goes by the exact value, so round up if scaling lost
+            // something, and to even if it's really halfway. Floats with
+            // few bits of fraction often are.
+            double error = std::fma(value, powers[precision], -scaled);
+            if (error > 0 || (error == 0 && (rounded & 1)))
+            {
+                rounded++;
+            }
+        }
+        unsigned long long scale = (unsigned long long)powers[precision];
+        count = unsignedDigits(rounded / scale, 10, false, out);
+        if (precision > 0)
+        {
+            out[count++] = '.';
+            count += padDigits(out + count, unsignedDigits(rounded % scale, 10, false, out + count), precision);
+        }
+    }
+    else
+    {
+        // Too big to scale, but too big to have any fraction either
+        double whole = std::floor(value);
+        char reversed[MAX_DIGITS];
+        int digitCount = 0;
+        do
+        {
+            reversed[digitCount++] = '0' + (int)std::fmod(whole, 10.);
+            whole = std::floor(whole / 10.);
+        } while (whole >= 1. && digitCount < MAX_DIGITS - MAX_FIXED_PRECISION - 1);
+        for (int i = 0; i < digitCount; i++)
+        {
+            out[i] = reversed[digitCount - 1 - i];
+        }
+        count = digitCount;
+        if (precision > 0)
+        {
+            out[count++] = '.';
+            std::fill(out + count, out + count + precision, '0');
+            count += precision;
+        }
+    }
+    return count;
+}
+
+KTextWriter::KTextWriter(char* buffer, std::size_t capacity) : buffer(buffer), capacity(capacity), length(0), truncated(false)
+{
+    terminate();
+}
+
+void KTextWriter::clear()
+{
+    length = 0;
+    truncated = false;
+    terminate();
+}
+
+KTextWriter& KTextWriter::write(char ch)
+{
+    put(ch);
+    terminate();
+    return *this;
+}
+
+KTextWriter& KTextWriter::write(const char* text)
+{
+    putText(text, std::strlen(text));
+    terminate();
+    return *this;
+}
+
+KTextWriter& KTextWriter::write(const char* text, std::size_t length)
+{
+    putText(text, length);
+    terminate();
+    return *this;
+}
+
+KTextWriter& KTextWriter::writeInteger(long long value)
+{
+    char digits[MAX_DIGITS];
+    unsigned long long magnitude = value < 0 ? 0ull - (unsigned long long)value : value;
+    field(value < 0 ? "-" : "", digits, unsignedDigits(magnitude, 10, false, digits), 0, false, false);
+    terminate();
+    return *this;
+}
+
+KTextWriter& KTextWriter::writeUnsigned(unsigned long long value)
+{
+    char digits[MAX_DIGITS];
+    field("", digits, unsignedDigits(value, 10, false, digits), 0, false, false);
+    terminate();
+    return *this;
+}
+
+KTextWriter& KTextWriter::writeFixed(double value, int precision)
+{
+    char digits[MAX_DIGITS];
+    field(std::signbit(value) ? "-" : "", digits, fixedDigits(value, precision, false, digits), 0, false, false);
+    terminate();
+    return *this;
+}
+
+bool KTextWriter::format(const char* fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    bool complete = formatList(fmt, args);
+    va_end(args);
+    return complete;
+}
+
+bool KTextWriter::formatList(const char* fmt, va_list args)
+{
+    bool wasTruncated = truncated;
+    truncated = false;
+    char digits[MAX_DIGITS];
+    while (*fmt != '\0')
+    {
+        if (*fmt != '%')
+        {
+            // Everything up to the next conversion at once
+            const char* next = std::strchr(fmt, '%');
+            std::size_t count = next ? next - fmt : std::strlen(fmt);
+            putText(fmt, count);
+            fmt += count;
+            continue;
+        }
+        fmt++;
+
+        bool left = false;
+        bool plus = false;
+        bool space = false;
+        bool zeroPad = false;
+        while (true)
+        {
+            if (*fmt == '-')
+            {
+                left = true;
+            }
+            else if (*fmt == '+')
+            {
+                plus = true;
+            }
+            else if (*fmt == ' ')
+            {
+                space = true;
+            }
+            else if (*fmt == '0')
+            {
+                zeroPad = true;
+            }
+            else
+            {
+                break;
+            }
+            fmt++;
+        }
+        int width = 0;
+        if (*fmt == '*')
+        {
+            width = va_arg(args, int);
+            if (width < 0)
+            {
+                left = true;
+                width = -width;
+            }
+            fmt++;
+        }
+        while (*fmt >= '0' && *fmt <= '9')
+        {
+            width = width * 10 + (*fmt++ - '0');
+        }
+        // -1 if not given
+        int precision = -1;
+        if (*fmt == '.')
+        {
+            fmt++;
+            precision = 0;
+            if (*fmt == '*')
+            {
+                precision = std::max(va_arg(args, int), -1);
+                fmt++;
+            }
+            while (*fmt >= '0' && *fmt <= '9')
+            {
+                precision = precision * 10 + (*fmt++ - '0');
+            }
+        }
+        // Negative for h and hh
+        int longs = 0;
+        bool sizeT = false;
+        while (*fmt == 'h')
+        {
+            longs--;
+            fmt++;
+        }
+        while (*fmt == 'l')
+        {
+            longs++;
+            fmt++;
+        }
+        if (*fmt == 'z')
+        {
+            sizeT = true;
+            fmt++;
+        }
+        char conversion = *fmt;
+        if (conversion == '\0')
+        {
+            break;
+        }
+        fmt++;
+
+        switch (conversion)
+        {
+            case 'd':
+            case 'i':
+            {
+                long long value = sizeT ? (long long)va_arg(args, std::ptrdiff_t) :
+                    longs >= 2 ? va_arg(args, long long) :
+                    longs == 1 ? va_arg(args, long) : va_arg(args, int);
+                if (longs == -1)
+                {
+                    value = (short)value;
+                }
+                else if (longs <= -2)
+                {
+                    value = (signed char)value;
+                }
+                unsigned long long magnitude = value < 0 ? 0ull - (unsigned long long)value : value;
+                int count = precision == 0 && magnitude == 0 ? 0 : unsignedDigits(magnitude, 10, false, digits);
+                field(value < 0 ? "-" : plus ? "+" : space ? " " : "", digits, padDigits(digits, count, precision),
+                    width, left, zeroPad && precision < 0);
+                break;
+            }
+            case 'u':
+            case 'x':
+            case 'X':
+            {
+                unsigned long long value = sizeT ? va_arg(args, std::size_t) :
+                    longs >= 2 ? va_arg(args, unsigned long long) :
+                    longs == 1 ? va_arg(args, unsigned long) : va_arg(args, unsigned int);
+                if (longs == -1)
+                {
+                    value = (unsigned short)value;
+                }
+                else if (longs <= -2)
+                {
+                    value = (unsigned char)value;
+                }
+                int count = precision == 0 && value == 0 ? 0 : unsignedDigits(value, conversion == 'u' ? 10 : 16, conversion == 'X', digits);
+                field("", digits, padDigits(digits, count, precision), width, left, zeroPad && precision < 0);
+                break;
+            }
+            case 'f':
+            case 'F':
+            {
+                double value = va_arg(args, double);
+                int count = fixedDigits(value, precision < 0 ? 6 : precision, conversion == 'F', digits);
+                field(std::signbit(value) ? "-" : plus ? "+" : space ? " " : "", digits, count,
+                    width, left, zeroPad && std::isfinite(value));
+                break;
+            }
+            case 'c':
+            {
+                digits[0] = (char)va_arg(args, int);
+                field("", digits, 1, width, left, false);
+                break;
+            }
+            case 's':
+            {
+                const char* text = va_arg(args, const char*);
+                if (text == nullptr)
+                {
+                    text = "(null)";
+                }
+                int count = 0;
+                while (text[count] != '\0' && (precision < 0 || count < precision))
+                {
+                    count++;
+                }
+                field("", text, count, width, left, false);
+                break;
+            }
+            case '%':
+            {
+                put('%');
+                break;
+            }
+            default:
+            {
+                // Not understood, so show it as it was
+                put('%');
+                put(conversion);
+                break;
+            }
+        }
+    }
+    terminate();
+    bool complete = !truncated;
+    truncated = truncated || wasTruncated;
+    return complete;
+}
+
+void KTextWriter::field(const char* sign, const char* digits, int digitCount, int width, bool left, bool zeroPad)
+{
+    int signLength = std::strlen(sign);
+    int padding = std::max(width - signLength - digitCount, 0);
+    if (!left && !zeroPad)
+    {
+        for (int i = 0; i < padding; i++)
+        {
+            put(' ');
+        }
+    }
+    putText(sign, signLength);
+    if (!left && zeroPad)
+    {
+        for (int i = 0; i < padding; i++)
+        {
+            put('0');
+        }
+    }
+    putText(digits, digitCount);
+    if (left)
+    {
+        for (int i = 0; i < padding; i++)
+        {
+            put(' ');
+        }
+    }
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdarg>
+#include <cstring>
+
+// printf for text made every frame, like the stats overlay. Writes into a
+// fixed size buffer, never allocates, never writes past the end (text that
+// doesn't fit is cut off, and the buffer is always null terminated), and
+// ignores the locale, so it's also quicker.
+//
+// format() understands %d %i %u %x %X %c %s %f %F and %%, with the - + 0
+// and space flags, widths, precisions (* too) and the hh h l ll z length
+// modifiers. %f has at most 17 decimals, and rounds like printf, halfway
+// to even, while the value times 10^precision is below 2^52. Past that the
+// last digit may differ, past about 9e18 / 10^precision the decimals are
+// dropped, and digits past the 17th may be off.
+//
+// Doesn't need GL, so the offline tools can use it too.
+class KTextWriter
+{
+public:
+    // capacity includes the null terminator
+    KTextWriter(char* buffer, std::size_t capacity);
+
+    // Start again at the beginning of the buffer
+    void clear();
+
+    KTextWriter& write(char ch);
+    KTextWriter& write(const char* text);
+    KTextWriter& write(const char* text, std::size_t length);
+    KTextWriter& writeInteger(long long value);
+    KTextWriter& writeUnsigned(unsigned long long value);
+    KTextWriter& writeFixed(double value, int precision);
+
+    // Appends; returns false if anything was cut off
+    bool format(const char* fmt, ...);
+    bool formatList(const char* fmt, va_list args);
+
+    const char* getText() const { return buffer; }
+    std::size_t getLength() const { return length; }
+    // Since the last clear()
+    bool isTruncated() const { return truncated; }
+
+private:
+    char* buffer;
+    std::size_t capacity;
+    std::size_t length;
+    bool truncated;
+
+    void put(char ch)
+    {
+        if (length + 1 < capacity)
+        {
+            buffer[length++] = ch;
+        }
+        else
+        {
+            truncated = true;
+        }
+    }
+    void putText(const char* text, std::size_t count)
+    {
+        std::size_t room = capacity > length ? capacity - length - 1 : 0;
+        if (count > room)
+        {
+            count = room;
+            truncated = true;
+        }
+        if (count > 0)
+        {
+            std::memcpy(buffer + length, text, count);
+            length += count;
+        }
+    }
+    void terminate()
+    {
+        if (capacity > 0)
+        {
+            buffer[length] = '\0';
+        }
+    }
+    // A converted value, padded out to width
+    void field(const char* sign, const char* digits, int digitCount, int width, bool left, bool zeroPad);
+};
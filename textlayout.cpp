@@ -0,0 +1,115 @@
+#include "textlayout.h"
+#include "textformat.h"
+#include <algorithm>
+#include <cstring>
+
+KTextLayout::KTextLayout(std::size_t maxBytes) : lineStarts(1, 0), maxBytes(maxBytes), droppedLines(0)
+{
+}
+
+void KTextLayout::append(const char* text, std::size_t length)
+{
+    std::size_t scanFrom = this->text.size();
+    this->text.append(text, length);
+    // Only the new text needs looking at
+    const char* start = this->text.data();
+    const char* end = start + this->text.size();
+    for (const char* found = start + scanFrom; (found = (const char*)std::memchr(found, '\n', end - found)) != nullptr; found++)
+    {
+        lineStarts.push_back(found - start + 1);
+    }
+    if (maxBytes > 0 && this->text.size() > maxBytes)
+    {
+        trim();
+    }
+}
+
+void KTextLayout::append(const char* text)
+{
+    append(text, std::strlen(text));
+}
+
+void KTextLayout::clear()
+{
+    text.clear();
+    lineStarts.assign(1, 0);
+    droppedLines = 0;
+}
+
+std::size_t KTextLayout::getLineCount() const
+{
+    return lineStarts.back() == text.size() ? lineStarts.size() - 1 : lineStarts.size();
+}
+
+const char* KTextLayout::getLine(std::size_t line, std::size_t& length) const
+{
+    std::size_t start = lineStarts[line];
+    std::size_t end = line + 1 < lineStarts.size() ? lineStarts[line + 1] - 1 : text.size();
+    if (end > start && text[end - 1] == '\r')
+    {
+        end--;
+    }
+    length = end - start;
+    return text.data() + start;
+}
+
+std::size_t KTextLayout::getTailLine(unsigned int rows) const
+{
+    std::size_t count = getLineCount();
+    return count > rows ? count - rows : 0;
+}
+
+unsigned int KTextLayout::writeLines(std::size_t firstLine, unsigned int rows, unsigned int columns, KTextWriter& out) const
+{
+    std::size_t count = getLineCount();
+    unsigned int written = 0;
+    for (std::size_t line = firstLine; line < count && written < rows; line++)
+    {
+        std::size_t length;
+        const char* chars = getLine(line, length);
+        // Past the last byte of the columns'th code point
+        std::size_t cut = 0;
+        unsigned int codePoints = 0;
+        while (cut < length && (codePoints < columns || (chars[cut] & 0xC0) == 0x80))
+        {
+            if ((chars[cut] & 0xC0) != 0x80)
+            {
+                codePoints++;
+            }
+            cut++;
+        }
+        out.write(chars, cut).write('\n');
+        // Whatever of the line fitted is still shown, but nothing after it
+        if (out.isTruncated())
+        {
+            break;
+        }
+        written++;
+    }
+    return written;
+}
+
+void KTextLayout::trim()
+{
+    // The first line starting in the part that's kept. A single line longer
+    // than that can't be split, so it's kept whole.
+    std::size_t keepFrom = text.size() - maxBytes / 2;
+    std::vector<std::size_t>::iterator first = std::lower_bound(lineStarts.begin(), lineStarts.end(), keepFrom);
+    if (first == lineStarts.end())
+    {
+        first--;
+    }
+    std::size_t drop = first - lineStarts.begin();
+    if (drop == 0)
+    {
+        return;
+    }
+    std::size_t offset = *first;
+    text.erase(0, offset);
+    lineStarts.erase(lineStarts.begin(), first);
+    for (std::size_t& start : lineStarts)
+    {
+        start -= offset;
+    }
+    droppedLines += drop;
+}
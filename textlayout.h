@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+class KTextWriter;
+
+// Text that keeps growing at the end, like a log being tailed, with an
+// index of where each line starts. The index is only extended over what's
+// appended, so finding any line is a lookup, and showing a window of the
+// text costs the lines in the window however long the text gets.
+//
+// Lines end at '\n', with any '\r' before it left out. The last line needn't
+// be finished; it grows with the next append(). If maxBytes isn't 0, the
+// oldest lines are thrown away to stay under it, half of it at a time so
+// it doesn't happen often.
+//
+// Doesn't need GL, so the offline tools can use it too.
+class KTextLayout
+{
+public:
+    explicit KTextLayout(std::size_t maxBytes = 0);
+
+    void append(const char* text, std::size_t length);
+    void append(const char* text);
+    void clear();
+
+    // Not counting an empty line after the last line break
+    std::size_t getLineCount() const;
+    // Not null terminated, and without the line break
+    const char* getLine(std::size_t line, std::size_t& length) const;
+    // The first line of a rows line window which ends with the last line
+    std::size_t getTailLine(unsigned int rows) const;
+    // Up to rows lines from firstLine, each cut off after columns UTF-8 code
+    // points and ended with a '\n', laid out like getTextGridSize() expects.
+    // Returns how many lines were written.
+    unsigned int writeLines(std::size_t firstLine, unsigned int rows, unsigned int columns, KTextWriter& out) const;
+
+    std::size_t getSize() const { return text.size(); }
+    // Lines thrown away to stay under maxBytes. Add it to a line's index to
+    // number lines from the start of everything appended.
+    std::size_t getDroppedLines() const { return droppedLines; }
+
+private:
+    std::string text;
+    // Offset of the start of each line in text. Never empty: the last one is
+    // the line being appended to.
+    std::vector<std::size_t> lineStarts;
+    std::size_t maxBytes;
+    std::size_t droppedLines;
+
+    // Drops whole lines from the front, leaving about maxBytes / 2
+    void trim();
+};
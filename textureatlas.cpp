@@ -0,0 +1,407 @@
+#include "glad.h"
+#include "textureatlas.h"
+#include "glstate.h"
+#include "uploadring.h"
+#include "mipmap.h"
+#include <iostream>
+#include <algorithm>
+#include <climits>
+#include <cstring>
+
+// Bottom-left skyline packing. The skyline is the top edge of everything
+// placed so far, as segments from left to right; each rectangle goes where
+// its top would be lowest.
+class KSkyline
+{
+protected:
+    struct Segment
+    {
+        int x;
+        int y;
+        int width;
+    };
+    std::vector<Segment> segments;
+    int width;
+    int height;
+
+    // Where a rectangle starting at the segment would sit, or -1 if it
+    // doesn't fit there
+    int fit(std::size_t index, int rectWidth, int rectHeight) const
+    {
+        if (segments[index].x + rectWidth > width)
+        {
+            return -1;
+        }
+        int y = 0;
+        int left = rectWidth;
+        // The segments cover the whole width, so this can't run off the end
+        for (std::size_t i = index; left > 0; i++)
+        {
+            y = std::max(y, segments[i].y);
+            left -= segments[i].width;
+        }
+        return y + rectHeight <= height ? y : -1;
+    }
+public:
+    KSkyline(int width, int height) : width(width), height(height)
+    {
+        segments.push_back({0, 0, width});
+    }
+
+    bool insert(int rectWidth, int rectHeight, int& x, int& y)
+    {
+        int bestIndex = -1;
+        int bestTop = INT_MAX;
+        int bestWidth = INT_MAX;
+        for (std::size_t i = 0; i < segments.size(); i++)
+        {
+            int fitY = fit(i, rectWidth, rectHeight);
+            // Lowest top, then the narrowest segment, to leave wide gaps open
+            if (fitY >= 0 && (fitY + rectHeight < bestTop || (fitY + rectHeight == bestTop && segments[i].width < bestWidth)))
+            {
+                bestIndex = i;
+                bestTop = fitY + rectHeight;
+                bestWidth = segments[i].width;
+            }
+        }
+        if (bestIndex < 0)
+        {
+            return false;
+        }
+        x = segments[bestIndex].x;
+        y = bestTop - rectHeight;
+
+        // The rectangle's top becomes a segment, covering up the ones below it
+        Segment top = {x, bestTop, rectWidth};
+        segments.insert(segments.begin() + bestIndex, top);
+        for (std::size_t i = bestIndex + 1; i < segments.size();)
+        {
+            int covered = top.x + top.width - segments[i].x;
+            if (covered <= 0)
+            {
+                break;
+            }
+            if (covered < segments[i].width)
+            {
+                segments[i].x += covered;
+                segments[i].width -= covered;
+                break;
+            }
+            segments.erase(segments.begin() + i);
+        }
+        for (std::size_t i = 0; i + 1 < segments.size();)
+        {
+            if (segments[i].y == segments[i + 1].y)
+            {
+                segments[i].width += segments[i + 1].width;
+                segments.erase(segments.begin() + i + 1);
+            }
+            else
+            {
+                i++;
+            }
+        }
+        return true;
+    }
+};
+
+// Copy an image into a bigger one at (x, y), repeating its edge texels
+// `padding` texels out on every side
+static void blitPadded(unsigned char* dest, int destWidth, int x, int y, const unsigned char* image, int width, int height, int padding)
+{
+    for (int row = -padding; row < height + padding; row++)
+    {
+        const unsigned char* source = image + std::min(std::max(row, 0), height - 1) * width * 4;
+        unsigned char* out = dest + ((y + row) * destWidth + x) * 4;
+        for (int col = -padding; col < 0; col++)
+        {
+            std::memcpy(out + col * 4, source, 4);
+        }
+        std::memcpy(out, source, width * 4);
+        for (int col = width; col < width + padding; col++)
+        {
+            std::memcpy(out + col * 4, source + (width - 1) * 4, 4);
+        }
+    }
+}
+
+KTextureAtlas::KTextureAtlas(Mode mode, int maxSize, int padding) :
+    mode(mode), maxSize(maxSize), padding(mode == ATLAS_PACKED ? padding : 0), textureId(0), width(0), height(0)
+{
+}
+
+KTextureAtlas::~KTextureAtlas()
+{
+    if (textureId != 0)
+    {
+        KGLState::forgetTexture(textureId);
+        glDeleteTextures(1, &textureId);
+    }
+}
+
+int KTextureAtlas::add(const std::string& name, const unsigned char* pixels, int width, int height, int channels, int pitch)
+{
+    if (pitch == 0)
+    {
+        pitch = width * channels;
+    }
+    KAtlasRegion region;
+    region.name = name;
+    region.x = 0;
+    region.y = 0;
+    region.width = width;
+    region.height = height;
+    region.layer = 0;
+    std::fill(region.uvRect, region.uvRect + 4, 0.f);
+    regions.push_back(region);
+
+    // Everything goes in as RGBA
+    images.emplace_back((std::size_t)width * height * 4);
+    unsigned char* out = images.back().data();
+    for (int y = 0; y < height; y++)
+    {
+        const unsigned char* in = pixels + y * pitch;
+        for (int x = 0; x < width; x++, in += channels, out += 4)
+        {
+            switch (channels)
+            {
+                case 1:
+                    out[0] = out[1] = out[2] = in[0];
+                    out[3] = 255;
+                    break;
+                case 2:
+                    out[0] = out[1] = out[2] = in[0];
+                    out[3] = in[1];
+                    break;
+                case 3:
+                    std::memcpy(out, in, 3);
+                    out[3] = 255;
+                    break;
+                default:
+                    std::memcpy(out, in, 4);
+            }
+        }
+    }
+    return regions.size() - 1;
+}
+
+const KAtlasRegion* KTextureAtlas::find(const std::string& name) const
+{
+    for (const KAtlasRegion& region : regions)
+    {
+        if (region.name == name)
+        {
+            return &region;
+        }
+    }
+    return nullptr;
+}
+
+unsigned int KTextureAtlas::getTarget() const
+{
+    return mode == ATLAS_ARRAY ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D;
+}
+
+bool KTextureAtlas::pack(int alignment)
+{
+    // Tallest first packs tightest
+    std::vector<int> order(regions.size());
+    std::size_t area = 0;
+    for (std::size_t i = 0; i < regions.size(); i++)
+    {
+        order[i] = i;
+        area += (std::size_t)(regions[i].width + padding * 2) * (regions[i].height + padding * 2);
+    }
+    std::sort(order.begin(), order.end(), [this](int a, int b)
+    {
+        return regions[a].height != regions[b].height ? regions[a].height > regions[b].height : regions[a].width > regions[b].width;
+    });
+
+    // Smallest power of two square it could fit in, then keep doubling a side
+    int side = 64;
+    while ((std::size_t)side * side < area)
+    {
+        side *= 2;
+    }
+    for (width = side, height = side; width <= maxSize && height <= maxSize; )
+    {
+        KSkyline skyline(width, height);
+        bool packed = true;
+        for (int index : order)
+        {
+            // Rounded up, so the rectangles line up with texels of the
+            // smallest mip level
+            int rectWidth = (regions[index].width + padding * 2 + alignment - 1) / alignment * alignment;
+            int rectHeight = (regions[index].height + padding * 2 + alignment - 1) / alignment * alignment;
+            int x, y;
+            if (!skyline.insert(rectWidth, rectHeight, x, y))
+            {
+                packed = false;
+                break;
+            }
+            regions[index].x = x + padding;
+            regions[index].y = y + padding;
+        }
+        if (packed)
+        {
+            return true;
+        }
+        if (width == height)
+        {
+            width *= 2;
+        }
+        else
+        {
+            height *= 2;
+        }
+    }
+    std::cerr << "Couldn't fit " << regions.size() << " images in a " << maxSize << "x" << maxSize << " atlas!" << std::endl;
+    width = height = 0;
+    return false;
+}
+
+bool KTextureAtlas::build(const KTextureOptions& options)
+{
+    if (regions.empty() || images.empty())
+    {
+        std::cerr << "Nothing to put in the atlas!" << std::endl;
+        return false;
+    }
+    bool built = mode == ATLAS_ARRAY ? buildArray(options) : buildPacked(options);
+    if (built)
+    {
+        images.clear();
+        images.shrink_to_fit();
+    }
+    return built;
+}
+
+bool KTextureAtlas::buildPacked(const KTextureOptions& options)
+{
+    // Past this level, the padding between images is gone
+    int maxLevel = 0;
+    while (options.mipmap && (padding >> (maxLevel + 1)) > 0)
+    {
+        maxLevel++;
+    }
+    if (!pack(1 << maxLevel))
+    {
+        return false;
+    }
+    std::vector<unsigned char> pixels((std::size_t)width * height * 4);
+    for (std::size_t i = 0; i < regions.size(); i++)
+    {
+        KAtlasRegion& region = regions[i];
+        blitPadded(pixels.data(), width, region.x, region.y, images[i].data(), region.width, region.height, padding);
+        region.uvRect[0] = (float)region.x / width;
+        region.uvRect[1] = (float)region.y / height;
+        region.uvRect[2] = (float)region.width / width;
+        region.uvRect[3] = (float)region.height / height;
+    }
+
+    glGenTextures(1, &textureId);
+    KGLState::bindTexture(GL_TEXTURE0, GL_TEXTURE_2D, textureId);
+    KTextureManager::getUploadRing()->upload(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+    if (maxLevel > 0 && options.mipFilter == MIP_DRIVER)
+    {
+        glGenerateMipmap(GL_TEXTURE_2D);
+    }
+    else if (maxLevel > 0)
+    {
+        KMipChain mips;
+        mips.generate(pixels.data(), width, height, 4, options.mipFilter, options.gammaCorrect, 0);
+        for (int level = 1; level <= maxLevel; level++)
+        {
+            const KMipLevel& mip = mips.levels[level - 1];
+            KTextureManager::getUploadRing()->upload(GL_TEXTURE_2D, level, GL_RGBA8, mip.width, mip.height, GL_RGBA, GL_UNSIGNED_BYTE, mip.pixels.data());
+        }
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, maxLevel);
+    // Repeating would wrap into other images
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, options.minFilter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, options.magFilter);
+    KGLState::bindTexture(GL_TEXTURE0, GL_TEXTURE_2D, 0);
+    return true;
+}
+
+bool KTextureAtlas::buildArray(const KTextureOptions& options)
+{
+    width = height = 0;
+    for (const KAtlasRegion& region : regions)
+    {
+        width = std::max(width, region.width);
+        height = std::max(height, region.height);
+    }
+    int maxLayers = 0;
+    glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+    if (width > maxSize || height > maxSize || (int)regions.size() > std::min(maxSize, maxLayers))
+    {
+        std::cerr << "Couldn't fit " << regions.size() << " images in a texture array!" << std::endl;
+        width = height = 0;
+        return false;
+    }
+    int levelCount = 1;
+    while (options.mipmap && (width >> levelCount > 0 || height >> levelCount > 0))
+    {
+        levelCount++;
+    }
+
+    glGenTextures(1, &textureId);
+    KGLState::bindTexture(GL_TEXTURE0, GL_TEXTURE_2D_ARRAY, textureId);
+    for (int level = 0; level < (options.mipFilter == MIP_DRIVER ? 1 : levelCount); level++)
+    {
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_RGBA8, std::max(1, width >> level), std::max(1, height >> level), regions.size(), 0,
+            GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    }
+    // Each image goes in the corner of its layer, with its edges repeated
+    // over the rest
+    std::vector<unsigned char> layer((std::size_t)width * height * 4);
+    for (std::size_t i = 0; i < regions.size(); i++)
+    {
+        KAtlasRegion& region = regions[i];
+        region.layer = i;
+        region.uvRect[0] = 0;
+        region.uvRect[1] = 0;
+        region.uvRect[2] = (float)region.width / width;
+        region.uvRect[3] = (float)region.height / height;
+        const unsigned char* pixels = images[i].data();
+        if (region.width != width || region.height != height)
+        {
+            for (int y = 0; y < height; y++)
+            {
+                const unsigned char* source = images[i].data() + std::min(y, region.height - 1) * region.width * 4;
+                unsigned char* out = layer.data() + y * width * 4;
+                std::memcpy(out, source, region.width * 4);
+                for (int x = region.width; x < width; x++)
+                {
+                    std::memcpy(out + x * 4, source + (region.width - 1) * 4, 4);
+                }
+            }
+            pixels = layer.data();
+        }
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, i, width, height, 1, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+        if (levelCount > 1 && options.mipFilter != MIP_DRIVER)
+        {
+            KMipChain mips;
+            mips.generate(pixels, width, height, 4, options.mipFilter, options.gammaCorrect, 0);
+            for (int level = 1; level < levelCount; level++)
+            {
+                const KMipLevel& mip = mips.levels[level - 1];
+                glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, i, mip.width, mip.height, 1, GL_RGBA, GL_UNSIGNED_BYTE, mip.pixels.data());
+            }
+        }
+    }
+    if (levelCount > 1 && options.mipFilter == MIP_DRIVER)
+    {
+        glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+    }
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, levelCount - 1);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, options.wrapMode);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, options.wrapMode);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, options.minFilter);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, options.magFilter);
+    KGLState::bindTexture(GL_TEXTURE0, GL_TEXTURE_2D_ARRAY, 0);
+    return true;
+}
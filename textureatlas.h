@@ -0,0 +1,86 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "texturemanager.h"
+
+// Where an image ended up in an atlas
+struct KAtlasRegion
+{
+    std::string name;
+    // In texels, not counting the padding
+    int x;
+    int y;
+    int width;
+    int height;
+    // Always 0 for packed atlases
+    int layer;
+    // u, v, width and height in texture coordinates, for 2d.vp's uvRect.
+    // Maps 0-1 texture coordinates for the image to the atlas.
+    float uvRect[4];
+};
+
+// Puts several RGBA images in one texture, so things using different
+// images can be drawn without binding another texture in between. Either:
+// - ATLAS_PACKED: one GL_TEXTURE_2D, with the images skyline packed into
+//   it. Each is surrounded by padding texels which repeat its edges, so
+//   linear filtering doesn't pick up the neighbours. Mip levels only go
+//   down as far as the padding keeps them apart, and wrapping can't be
+//   used, since the coordinates of an image don't cover the texture.
+// - ATLAS_ARRAY: one GL_TEXTURE_2D_ARRAY, with a layer per image, each the
+//   size of the largest. Sample it with a sampler2DArray and the region's
+//   layer. Full mip chains, but smaller images waste the rest of their
+//   layer, and only images the size of the layer can wrap.
+//
+// add() the images, then build() uploads them all at once.
+class KTextureAtlas
+{
+public:
+    enum Mode
+    {
+        ATLAS_PACKED,
+        ATLAS_ARRAY
+    };
+
+    KTextureAtlas(Mode mode = ATLAS_PACKED, int maxSize = 2048, int padding = 4);
+    ~KTextureAtlas();
+    KTextureAtlas(const KTextureAtlas&) = delete;
+    KTextureAtlas& operator= (const KTextureAtlas&) = delete;
+
+    // Copies the image, so the caller can free it straight away. pitch is
+    // the bytes per row, 0 meaning tightly packed. Returns the region's
+    // index, which stays valid after build().
+    int add(const std::string& name, const unsigned char* pixels, int width, int height, int channels, int pitch = 0);
+    // Packs and uploads everything added so far. wrapMode is ignored for
+    // packed atlases. Returns false, and makes no texture, if the images
+    // don't fit in maxSize texels square (or maxSize layers).
+    bool build(const KTextureOptions& options = KTextureOptions());
+
+    const KAtlasRegion& getRegion(int index) const { return regions[index]; }
+    // nullptr if there's no such image
+    const KAtlasRegion* find(const std::string& name) const;
+    unsigned int getRegionCount() const { return regions.size(); }
+
+    unsigned int getId() const { return textureId; }
+    // GL_TEXTURE_2D or GL_TEXTURE_2D_ARRAY
+    unsigned int getTarget() const;
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+
+private:
+    Mode mode;
+    int maxSize;
+    int padding;
+    std::vector<KAtlasRegion> regions;
+    // RGBA pixels of each image, until build()
+    std::vector<std::vector<unsigned char> > images;
+    unsigned int textureId;
+    int width;
+    int height;
+
+    // Sets each region's x and y, and the atlas size. Padded images take
+    // up a multiple of alignment texels each way.
+    bool pack(int alignment);
+    bool buildPacked(const KTextureOptions& options);
+    bool buildArray(const KTextureOptions& options);
+};
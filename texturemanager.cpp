@@ -0,0 +1,937 @@
+#include "glad.h"
+#include "texturemanager.h"
+#include "glstate.h"
+#include "uploadring.h"
+#include "ktx.h"
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <chrono>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_set>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+// Use stb_image.h
+#define STB_IMAGE_IMPLEMENTATION
+#define STBI_ONLY_PNG
+#include "stb_image.h"
+
+std::unordered_map<std::string, KTextureEntry*> KTextureManager::byPath;
+std::unordered_map<std::string, KTextureEntry*> KTextureManager::byContent;
+std::size_t KTextureManager::budget = 256 * 1024 * 1024;
+std::size_t KTextureManager::residentBytes = 0;
+unsigned int KTextureManager::placeholderId = 0;
+KUploadRing* KTextureManager::uploadRing = nullptr;
+unsigned int KTextureManager::pendingCount = 0;
+unsigned long long KTextureManager::useClock = 0;
+unsigned int KTextureManager::pathHits = 0;
+unsigned int KTextureManager::contentHits = 0;
+unsigned int KTextureManager::uploads = 0;
+
+struct KDecodeJob
+{
+    KTextureEntry* entry;
+    std::string path;
+    KTextureOptions options;
+    std::string optionKey;
+};
+
+// Where a worker puts a decoded image: a mapped upload ring slot if it fits,
+// otherwise plain memory
+struct KStagingBuffer
+{
+    unsigned char* data;
+    std::size_t capacity;
+    // Upload ring slot, or -1
+    int slot;
+    std::vector<unsigned char> heap;
+};
+
+struct KDecodeResult
+{
+    KTextureEntry* entry;
+    // nullptr if the load failed
+    KStagingBuffer* staging;
+    int width;
+    int height;
+    int channels;
+    KMipChain mips;
+    std::string contentKey;
+};
+
+// Worker threads, and the staging buffers they decode into. The GL thread
+// keeps the pool topped up with mapped upload ring slots, and images too big
+// for those go into plain memory. If every buffer is waiting for upload, the
+// workers wait too, so decoding can't run arbitrarily far ahead of the GL
+// thread.
+class KDecodePool
+{
+protected:
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable jobReady;
+    std::condition_variable stagingFree;
+    std::deque<KDecodeJob> jobs;
+    std::deque<KDecodeResult> results;
+    std::vector<KStagingBuffer*> freeMapped;
+    std::vector<KStagingBuffer*> freeHeap;
+    std::size_t mappedSize;
+    unsigned int heapCount;
+    unsigned int heapLimit;
+    bool stopping;
+
+    void work();
+    // Blocks until a buffer is free. nullptr if stopping.
+    KStagingBuffer* acquire(std::size_t size);
+    static void release(KStagingBuffer* staging, std::vector<int>& mappedSlots);
+public:
+    KDecodePool() : mappedSize(0), heapCount(0), heapLimit(0), stopping(false) {}
+    ~KDecodePool() { std::vector<int> mappedSlots; stop(mappedSlots); }
+
+    bool isRunning() const { return !threads.empty(); }
+    // Images up to mappedSize bytes wait for a mapped slot
+    void start(unsigned int count, std::size_t mappedSize);
+    // Unfinished jobs and results are dropped. The ring slots which were
+    // still mapped are returned, for the GL thread to unmap.
+    void stop(std::vector<int>& mappedSlots);
+    void push(const KDecodeJob& job);
+    // Doesn't block
+    bool pop(KDecodeResult& result);
+    // How many mapped slots the workers could use right now
+    unsigned int wantsMapped();
+    void offer(unsigned char* data, int slot);
+    // Called once the GL thread is done with the buffer, and any slot it
+    // was in has been unmapped
+    void recycle(KStagingBuffer* staging);
+};
+
+static KDecodePool decodePool;
+
+static std::string contentKeyFor(const std::string& optionKey, const std::vector<unsigned char>& data)
+{
+    // FNV-1a
+    std::uint64_t hash = 14695981039346656037ull;
+    for (unsigned char byte : data)
+    {
+        hash ^= byte;
+        hash *= 1099511628211ull;
+    }
+    return optionKey + "|" + std::to_string(hash) + ":" + std::to_string(data.size());
+}
+
+static bool readFile(const char* path, std::vector<unsigned char>& data)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        return false;
+    }
+    data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return true;
+}
+
+// foo.png -> foo<extension>
+static std::string siblingPath(const char* path, const std::string& extension)
+{
+    std::string siblingPath = path;
+    std::size_t dot = siblingPath.find_last_of('.');
+    std::size_t slash = siblingPath.find_last_of('/');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+    {
+        dot = siblingPath.size();
+    }
+    return siblingPath.substr(0, dot) + extension;
+}
+
+// A decoded image, and its mip chain if that's made on the CPU
+struct KDecodedImage
+{
+    int width;
+    int height;
+    int channels;
+    const unsigned char* pixels;
+    KMipChain mips;
+    // pixels points into one of these
+    unsigned char* decoded;
+    std::vector<unsigned char> cached;
+
+    KDecodedImage() : width(0), height(0), channels(0), pixels(nullptr), decoded(nullptr) {}
+    KDecodedImage(const KDecodedImage&) = delete;
+    KDecodedImage& operator= (const KDecodedImage&) = delete;
+    ~KDecodedImage() { stbi_image_free(decoded); }
+};
+
+// Decode the file's data, and make the mip chain if the options say so.
+// That's read from the cache file instead if there's an up to date one, and
+// written to it if not.
+static bool decodeImage(const char* path, const std::vector<unsigned char>& fileData, const std::string& contentKey,
+    const KTextureOptions& options, unsigned int threads, KDecodedImage& image)
+{
+    bool makeMips = options.mipmap && options.mipFilter != MIP_DRIVER;
+    std::string mipPath, sourceKey;
+    if (makeMips && options.cacheMips)
+    {
+        mipPath = siblingPath(path, std::string(".") + KMipChain::getFilterName(options.mipFilter) +
+            (options.gammaCorrect ? "" : "-linear") + ".ktx");
+        // The chain depends on the file and the filter, not on the rest of
+        // the options
+        sourceKey = mipPath + contentKey.substr(contentKey.find('|'));
+        if (image.mips.load(mipPath.c_str(), sourceKey, image.cached, image.width, image.height))
+        {
+            image.channels = image.mips.channels;
+            image.pixels = image.cached.data();
+            return true;
+        }
+    }
+    image.decoded = stbi_load_from_memory(fileData.data(), fileData.size(), &image.width, &image.height, &image.channels, 0);
+    if (!image.decoded)
+    {
+        std::cerr << "Failed to load " << path << ": " << stbi_failure_reason() << std::endl;
+        return false;
+    }
+    image.pixels = image.decoded;
+    if (makeMips)
+    {
+        image.mips.generate(image.pixels, image.width, image.height, image.channels, options.mipFilter, options.gammaCorrect, threads);
+        if (options.cacheMips)
+        {
+            image.mips.save(mipPath.c_str(), sourceKey, image.pixels, image.width, image.height);
+        }
+    }
+    return true;
+}
+
+void KDecodePool::start(unsigned int count, std::size_t mappedSize)
+{
+    stopping = false;
+    this->mappedSize = mappedSize;
+    // Two buffers per thread, so each can decode while one waits for upload
+    heapLimit = count * 2;
+    for (unsigned int i = 0; i < count; i++)
+    {
+        threads.emplace_back(&KDecodePool::work, this);
+    }
+}
+
+void KDecodePool::release(KStagingBuffer* staging, std::vector<int>& mappedSlots)
+{
+    if (staging)
+    {
+        if (staging->slot >= 0)
+        {
+            mappedSlots.push_back(staging->slot);
+        }
+        delete staging;
+    }
+}
+
+void KDecodePool::stop(std::vector<int>& mappedSlots)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    jobReady.notify_all();
+    stagingFree.notify_all();
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+    threads.clear();
+    jobs.clear();
+    for (KDecodeResult& result : results)
+    {
+        release(result.staging, mappedSlots);
+    }
+    results.clear();
+    for (KStagingBuffer* staging : freeMapped)
+    {
+        release(staging, mappedSlots);
+    }
+    freeMapped.clear();
+    for (KStagingBuffer* staging : freeHeap)
+    {
+        release(staging, mappedSlots);
+    }
+    freeHeap.clear();
+    heapCount = 0;
+}
+
+void KDecodePool::push(const KDecodeJob& job)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobs.push_back(job);
+    }
+    jobReady.notify_one();
+}
+
+bool KDecodePool::pop(KDecodeResult& result)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (results.empty())
+    {
+        return false;
+    }
+    result = std::move(results.front());
+    results.pop_front();
+    return true;
+}
+
+unsigned int KDecodePool::wantsMapped()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return freeMapped.size() < threads.size() ? threads.size() - freeMapped.size() : 0;
+}
+
+void KDecodePool::offer(unsigned char* data, int slot)
+{
+    KStagingBuffer* staging = new KStagingBuffer;
+    staging->data = data;
+    staging->capacity = mappedSize;
+    staging->slot = slot;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        freeMapped.push_back(staging);
+    }
+    stagingFree.notify_all();
+}
+
+KStagingBuffer* KDecodePool::acquire(std::size_t size)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    KStagingBuffer* staging = nullptr;
+    if (size <= mappedSize)
+    {
+        stagingFree.wait(lock, [this] { return stopping || !freeMapped.empty(); });
+        if (stopping)
+        {
+            return nullptr;
+        }
+        staging = freeMapped.back();
+        freeMapped.pop_back();
+        return staging;
+    }
+    stagingFree.wait(lock, [this] { return stopping || !freeHeap.empty() || heapCount < heapLimit; });
+    if (stopping)
+    {
+        return nullptr;
+    }
+    if (!freeHeap.empty())
+    {
+        staging = freeHeap.back();
+        freeHeap.pop_back();
+    }
+    else
+    {
+        heapCount++;
+        staging = new KStagingBuffer;
+        staging->slot = -1;
+    }
+    staging->heap.resize(size);
+    staging->data = staging->heap.data();
+    staging->capacity = size;
+    return staging;
+}
+
+void KDecodePool::recycle(KStagingBuffer* staging)
+{
+    if (staging->slot >= 0)
+    {
+        // The slot goes back to the ring, which offers it again once the
+        // GPU has read it
+        delete staging;
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        freeHeap.push_back(staging);
+    }
+    stagingFree.notify_one();
+}
+
+void KDecodePool::work()
+{
+    // Reused between jobs, so reading files doesn't allocate once it's big enough
+    std::vector<unsigned char> fileData;
+    for (;;)
+    {
+        KDecodeJob job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            jobReady.wait(lock, [this] { return stopping || !jobs.empty(); });
+            if (stopping)
+            {
+                return;
+            }
+            job = jobs.front();
+            jobs.pop_front();
+        }
+
+        KDecodeResult result;
+        result.entry = job.entry;
+        result.staging = nullptr;
+        if (!readFile(job.path.c_str(), fileData))
+        {
+            std::cerr << "Failed to load " << job.path << " for some reason!" << std::endl;
+        }
+        else
+        {
+            result.contentKey = contentKeyFor(job.optionKey, fileData);
+            // There's a worker per core already
+            KDecodedImage image;
+            if (decodeImage(job.path.c_str(), fileData, result.contentKey, job.options, 1, image))
+            {
+                result.width = image.width;
+                result.height = image.height;
+                result.channels = image.channels;
+                result.mips = std::move(image.mips);
+                std::size_t size = (std::size_t)result.width * result.height * result.channels;
+                result.staging = acquire(size);
+                if (result.staging)
+                {
+                    std::memcpy(result.staging->data, image.pixels, size);
+                }
+            }
+        }
+
+        // Goes in the results even when stopping, so a mapped slot isn't lost
+        std::lock_guard<std::mutex> lock(mutex);
+        results.push_back(std::move(result));
+        if (stopping)
+        {
+            return;
+        }
+    }
+}
+
+std::string KTextureOptions::getKey() const
+{
+    return std::to_string(mipmap) + ":" + std::to_string(wrapMode) + ":" +
+        std::to_string(magFilter) + ":" + std::to_string(minFilter) + ":" +
+        std::to_string(mipFilter) + ":" + std::to_string(gammaCorrect);
+}
+
+KTextureHandle::KTextureHandle(KTextureEntry* entry) : entry(entry)
+{
+    if (entry)
+    {
+        entry->refs++;
+    }
+}
+
+KTextureHandle::KTextureHandle(const KTextureHandle& other) : KTextureHandle(other.entry)
+{
+}
+
+KTextureHandle::KTextureHandle(KTextureHandle&& other) : entry(other.entry)
+{
+    other.entry = nullptr;
+}
+
+KTextureHandle& KTextureHandle::operator= (KTextureHandle other)
+{
+    std::swap(entry, other.entry);
+    return *this;
+}
+
+KTextureHandle::~KTextureHandle()
+{
+    release();
+}
+
+void KTextureHandle::release()
+{
+    if (entry)
+    {
+        KTextureManager::release(entry);
+        entry = nullptr;
+    }
+}
+
+void KTextureManager::touch(KTextureEntry* entry)
+{
+    entry->lastUsed = ++useClock;
+}
+
+void KTextureManager::release(KTextureEntry* entry)
+{
+    entry->refs--;
+    if (entry->refs == 0 && residentBytes > budget)
+    {
+        evict(0);
+    }
+}
+
+void KTextureManager::setBudget(std::size_t bytes)
+{
+    budget = bytes;
+    evict(0);
+}
+
+void KTextureManager::destroy(KTextureEntry* entry)
+{
+    for (const std::string& pathKey : entry->pathKeys)
+    {
+        byPath.erase(pathKey);
+    }
+    if (!entry->contentKey.empty())
+    {
+        byContent.erase(entry->contentKey);
+        residentBytes -= entry->bytes;
+        KGLState::forgetTexture(entry->id);
+        glDeleteTextures(1, &entry->id);
+    }
+    // Not release(), since that could evict while the caller is evicting
+    if (entry->aliasOf)
+    {
+        entry->aliasOf->refs--;
+    }
+    delete entry;
+}
+
+void KTextureManager::evict(std::size_t extraBytes)
+{
+    while (residentBytes + extraBytes > budget)
+    {
+        // Entries waiting on an async load aren't in byContent yet, so look
+        // at everything
+        KTextureEntry* oldest = nullptr;
+        for (auto& cached : byPath)
+        {
+            KTextureEntry* entry = cached.second;
+            if (entry->refs == 0 && !entry->pending && (oldest == nullptr || entry->lastUsed < oldest->lastUsed))
+            {
+                oldest = entry;
+            }
+        }
+        if (oldest == nullptr)
+        {
+            // Everything left is in use
+            return;
+        }
+        destroy(oldest);
+    }
+}
+
+void KTextureManager::clear()
+{
+    // Destroying an alias can leave the texture it pointed at unused, so go
+    // round until nothing else can be deleted
+    std::unordered_set<KTextureEntry*> unused;
+    do
+    {
+        unused.clear();
+        for (auto& cached : byPath)
+        {
+            if (cached.second->refs == 0 && !cached.second->pending)
+            {
+                unused.insert(cached.second);
+            }
+        }
+        for (KTextureEntry* entry : unused)
+        {
+            destroy(entry);
+        }
+    } while (!unused.empty());
+
+    if (byPath.empty() && placeholderId != 0)
+    {
+        KGLState::forgetTexture(placeholderId);
+        glDeleteTextures(1, &placeholderId);
+        placeholderId = 0;
+    }
+    // The workers have slots mapped
+    if (!decodePool.isRunning())
+    {
+        delete uploadRing;
+        uploadRing = nullptr;
+    }
+}
+
+KTextureEntry* KTextureManager::createEntry(const std::string& pathKey, const KTextureOptions& options)
+{
+    KTextureEntry* entry = new KTextureEntry;
+    entry->id = 0;
+    entry->width = 0;
+    entry->height = 0;
+    entry->bytes = 0;
+    entry->refs = 0;
+    entry->options = options;
+    entry->pending = false;
+    entry->aliasOf = nullptr;
+    entry->pathKeys.push_back(pathKey);
+    touch(entry);
+    byPath.emplace(pathKey, entry);
+    return entry;
+}
+
+std::size_t KTextureManager::estimateBytes(int width, int height, const KTextureOptions& options)
+{
+    // Drivers pad RGB to 4 bytes per texel, and a full mip chain adds a third
+    std::size_t bytes = (std::size_t)width * height * 4;
+    if (options.mipmap)
+    {
+        bytes += bytes / 3;
+    }
+    return bytes;
+}
+
+void KTextureManager::upload(KTextureEntry* entry, const unsigned char* pixels, int ringSlot, int channels, const KMipChain& mips, const std::string& contentKey)
+{
+    // Create GL texture
+    glGenTextures(1, &entry->id);
+    KGLState::bindTexture(GL_TEXTURE0, GL_TEXTURE_2D, entry->id);
+    // Upload to GPU, set parameters, and generate mipmaps (lower res versions of the texture)
+    int formats[] = {GL_RED, GL_RG, GL_RGB, GL_RGBA};
+    int texFormat = formats[channels - 1];
+    // Rows of RGB images aren't always 4 byte aligned
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    if (ringSlot >= 0)
+    {
+        getUploadRing()->texImage2D(ringSlot, GL_TEXTURE_2D, 0, texFormat, entry->width, entry->height, texFormat, GL_UNSIGNED_BYTE);
+    }
+    else
+    {
+        getUploadRing()->upload(GL_TEXTURE_2D, 0, texFormat, entry->width, entry->height, texFormat, GL_UNSIGNED_BYTE, pixels);
+    }
+    if (entry->options.mipmap && !mips.levels.empty())
+    {
+        for (std::size_t level = 0; level < mips.levels.size(); level++)
+        {
+            const KMipLevel& mip = mips.levels[level];
+            getUploadRing()->upload(GL_TEXTURE_2D, level + 1, texFormat, mip.width, mip.height, texFormat, GL_UNSIGNED_BYTE, mip.pixels.data());
+        }
+    }
+    else if (entry->options.mipmap)
+    {
+        glGenerateMipmap(GL_TEXTURE_2D);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, entry->options.wrapMode);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, entry->options.wrapMode);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, entry->options.minFilter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, entry->options.magFilter);
+    // Release bindings
+    KGLState::bindTexture(GL_TEXTURE0, GL_TEXTURE_2D, 0);
+
+    addResident(entry, estimateBytes(entry->width, entry->height, entry->options), contentKey);
+}
+
+void KTextureManager::addResident(KTextureEntry* entry, std::size_t bytes, const std::string& contentKey)
+{
+    uploads++;
+    entry->bytes = bytes;
+    entry->contentKey = contentKey;
+    byContent.emplace(contentKey, entry);
+    residentBytes += bytes;
+    if (residentBytes > budget)
+    {
+        std::cerr << "Textures in use take " << residentBytes << " bytes, over the budget of " << budget << std::endl;
+    }
+}
+
+bool KTextureManager::isCompressedFormatSupported(unsigned int format)
+{
+    switch (format)
+    {
+        case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+        case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+        case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT:
+        case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+            return GLAD_GL_EXT_texture_compression_s3tc;
+        case GL_COMPRESSED_RGBA_BPTC_UNORM_ARB:
+        case GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM_ARB:
+            return GLAD_GL_ARB_texture_compression_bptc;
+        case GL_COMPRESSED_RGB8_ETC2:
+        case GL_COMPRESSED_SRGB8_ETC2:
+        case GL_COMPRESSED_RGB8_PUNCHTHROUGH_ALPHA1_ETC2:
+        case GL_COMPRESSED_RGBA8_ETC2_EAC:
+        case GL_COMPRESSED_SRGB8_ALPHA8_ETC2_EAC:
+            return GLAD_GL_ARB_ES3_compatibility;
+    }
+    return false;
+}
+
+KTextureEntry* KTextureManager::loadCompressed(const std::string& pathKey, const char* path, const KTextureOptions& options)
+{
+    std::string compressedPath = siblingPath(path, ".ktx");
+    std::vector<unsigned char> fileData;
+    if (!readFile(compressedPath.c_str(), fileData))
+    {
+        // Not an error, there just isn't one
+        return nullptr;
+    }
+    std::string contentKey = contentKeyFor(options.getKey(), fileData);
+    auto cachedContent = byContent.find(contentKey);
+    if (cachedContent != byContent.end())
+    {
+        contentHits++;
+        KTextureEntry* entry = cachedContent->second;
+        entry->pathKeys.push_back(pathKey);
+        byPath.emplace(pathKey, entry);
+        return entry;
+    }
+    KKTXFile ktx;
+    if (!ktx.parse(fileData, compressedPath.c_str()) || ktx.levels.empty() ||
+        !isCompressedFormatSupported(ktx.internalFormat))
+    {
+        return nullptr;
+    }
+
+    // The mip chain comes from the file, so it's only there if the tool made it
+    unsigned int levelCount = options.mipmap ? ktx.levels.size() : 1;
+    std::size_t bytes = 0;
+    for (unsigned int level = 0; level < levelCount; level++)
+    {
+        bytes += ktx.levels[level].size();
+    }
+    evict(bytes);
+    KTextureEntry* entry = createEntry(pathKey, options);
+    entry->width = ktx.width;
+    entry->height = ktx.height;
+
+    glGenTextures(1, &entry->id);
+    KGLState::bindTexture(GL_TEXTURE0, GL_TEXTURE_2D, entry->id);
+    for (unsigned int level = 0; level < levelCount; level++)
+    {
+        int width = std::max(1, entry->width >> level);
+        int height = std::max(1, entry->height >> level);
+        glCompressedTexImage2D(GL_TEXTURE_2D, level, ktx.internalFormat, width, height, 0, ktx.levels[level].size(), ktx.levels[level].data());
+    }
+    // Without this, a missing mip level would make the texture incomplete
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levelCount - 1);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, options.wrapMode);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, options.wrapMode);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, options.minFilter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, options.magFilter);
+    // Release bindings
+    KGLState::bindTexture(GL_TEXTURE0, GL_TEXTURE_2D, 0);
+
+    addResident(entry, bytes, contentKey);
+    return entry;
+}
+
+KTextureHandle KTextureManager::load(const char* path, const KTextureOptions& options)
+{
+    std::string optionKey = options.getKey();
+    std::string pathKey = optionKey + "|" + path;
+    auto cachedPath = byPath.find(pathKey);
+    if (cachedPath != byPath.end())
+    {
+        pathHits++;
+        touch(cachedPath->second);
+        return KTextureHandle(cachedPath->second);
+    }
+
+    KTextureEntry* compressed = loadCompressed(pathKey, path, options);
+    if (compressed)
+    {
+        touch(compressed);
+        return KTextureHandle(compressed);
+    }
+
+    std::vector<unsigned char> fileData;
+    if (!readFile(path, fileData))
+    {
+        std::cerr << "Failed to load " << path << " for some reason!" << std::endl;
+        return KTextureHandle();
+    }
+
+    // Same image under another name?
+    std::string contentKey = contentKeyFor(optionKey, fileData);
+    auto cachedContent = byContent.find(contentKey);
+    if (cachedContent != byContent.end())
+    {
+        contentHits++;
+        KTextureEntry* entry = cachedContent->second;
+        entry->pathKeys.push_back(pathKey);
+        byPath.emplace(pathKey, entry);
+        touch(entry);
+        return KTextureHandle(entry);
+    }
+
+    // Nothing else to do while we wait, so use every core for the mip chain
+    KDecodedImage image;
+    if (!decodeImage(path, fileData, contentKey, options, 0, image))
+    {
+        return KTextureHandle();
+    }
+    // Make room first, so the new entry can't be the one evicted
+    evict(estimateBytes(image.width, image.height, options));
+    KTextureEntry* entry = createEntry(pathKey, options);
+    entry->width = image.width;
+    entry->height = image.height;
+    upload(entry, image.pixels, -1, image.channels, image.mips, contentKey);
+    return KTextureHandle(entry);
+}
+
+unsigned int KTextureManager::getPlaceholder()
+{
+    if (placeholderId == 0)
+    {
+        // Grey and magenta checkers, so missing textures stand out
+        unsigned char checker[] = {
+            128, 128, 128, 255,   255, 0, 255, 255,
+            255, 0, 255, 255,     128, 128, 128, 255
+        };
+        glGenTextures(1, &placeholderId);
+        KGLState::bindTexture(GL_TEXTURE0, GL_TEXTURE_2D, placeholderId);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 2, 2, 0, GL_RGBA, GL_UNSIGNED_BYTE, checker);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        KGLState::bindTexture(GL_TEXTURE0, GL_TEXTURE_2D, 0);
+    }
+    return placeholderId;
+}
+
+void KTextureManager::startWorkers(unsigned int threads)
+{
+    if (decodePool.isRunning())
+    {
+        return;
+    }
+    if (threads == 0)
+    {
+        unsigned int cores = std::thread::hardware_concurrency();
+        threads = cores > 1 ? cores - 1 : 1;
+    }
+    decodePool.start(threads, getUploadRing()->getSlotSize());
+}
+
+void KTextureManager::stopWorkers()
+{
+    std::vector<int> mappedSlots;
+    decodePool.stop(mappedSlots);
+    for (int slot : mappedSlots)
+    {
+        uploadRing->cancel(slot);
+    }
+    for (auto& cached : byPath)
+    {
+        if (cached.second->pending)
+        {
+            cached.second->pending = false;
+            pendingCount--;
+        }
+    }
+}
+
+KTextureHandle KTextureManager::loadAsync(const char* path, const KTextureOptions& options)
+{
+    std::string optionKey = options.getKey();
+    std::string pathKey = optionKey + "|" + path;
+    auto cachedPath = byPath.find(pathKey);
+    if (cachedPath != byPath.end())
+    {
+        pathHits++;
+        touch(cachedPath->second);
+        return KTextureHandle(cachedPath->second);
+    }
+
+    // Compressed textures need no decoding, so aren't worth a worker
+    KTextureEntry* compressed = loadCompressed(pathKey, path, options);
+    if (compressed)
+    {
+        touch(compressed);
+        return KTextureHandle(compressed);
+    }
+
+    startWorkers();
+    offerStaging();
+    KTextureEntry* entry = createEntry(pathKey, options);
+    entry->id = getPlaceholder();
+    entry->pending = true;
+    pendingCount++;
+    KDecodeJob job;
+    job.entry = entry;
+    job.path = path;
+    job.options = options;
+    job.optionKey = optionKey;
+    decodePool.push(job);
+    return KTextureHandle(entry);
+}
+
+void KTextureManager::finishAsync(KDecodeResult& result)
+{
+    KTextureEntry* entry = result.entry;
+    pendingCount--;
+    if (result.staging == nullptr)
+    {
+        // Keeps the placeholder. The worker said why.
+        entry->pending = false;
+        return;
+    }
+    auto cachedContent = byContent.find(result.contentKey);
+    if (cachedContent != byContent.end())
+    {
+        contentHits++;
+        entry->aliasOf = cachedContent->second;
+        entry->aliasOf->refs++;
+        touch(entry->aliasOf);
+        entry->id = entry->aliasOf->id;
+        entry->width = entry->aliasOf->width;
+        entry->height = entry->aliasOf->height;
+        if (result.staging->slot >= 0)
+        {
+            uploadRing->cancel(result.staging->slot);
+        }
+    }
+    else
+    {
+        entry->width = result.width;
+        entry->height = result.height;
+        // Still pending, so this can't evict the entry itself
+        evict(estimateBytes(entry->width, entry->height, entry->options));
+        upload(entry, result.staging->data, result.staging->slot, result.channels, result.mips, result.contentKey);
+    }
+    entry->pending = false;
+    decodePool.recycle(result.staging);
+}
+
+unsigned int KTextureManager::processUploads(double budgetMs)
+{
+    auto start = std::chrono::steady_clock::now();
+    unsigned int uploaded = 0;
+    KDecodeResult result;
+    while (decodePool.pop(result))
+    {
+        finishAsync(result);
+        uploaded++;
+        std::chrono::duration<double, std::milli> spent = std::chrono::steady_clock::now() - start;
+        if (spent.count() >= budgetMs)
+        {
+            break;
+        }
+    }
+    // Slots whose uploads the GPU has finished can be decoded into again
+    offerStaging();
+    return uploaded;
+}
+
+void KTextureManager::offerStaging()
+{
+    for (unsigned int wanted = decodePool.wantsMapped(); wanted > 0; wanted--)
+    {
+        int slot = uploadRing->acquire(uploadRing->getSlotSize());
+        if (slot < 0)
+        {
+            return;
+        }
+        decodePool.offer(uploadRing->getPointer(slot), slot);
+    }
+}
+
+KUploadRing* KTextureManager::getUploadRing()
+{
+    if (uploadRing == nullptr)
+    {
+        uploadRing = new KUploadRing(UPLOAD_RING_SLOTS, UPLOAD_RING_SLOT_SIZE);
+    }
+    return uploadRing;
+}
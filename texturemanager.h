@@ -0,0 +1,173 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstddef>
+#include "glad.h"
+#include "mipmap.h"
+
+// How a texture is sampled. Part of the cache key, since the same image
+// loaded with different settings has to be a different GL texture.
+struct KTextureOptions
+{
+    bool mipmap;
+    int wrapMode;
+    int magFilter;
+    int minFilter;
+    // Anything but MIP_DRIVER makes the mip chain on the CPU, on the worker
+    // thread for async loads, and uploads every level
+    KMipFilter mipFilter;
+    // Filter colours in linear light rather than on their sRGB values
+    bool gammaCorrect;
+    // Keep the chain in foo.<filter>.ktx next to foo.png, so it's only made
+    // once. Not part of the key.
+    bool cacheMips;
+
+    KTextureOptions(bool mipmap = true, int wrapMode = GL_REPEAT, int magFilter = GL_NEAREST, int minFilter = GL_LINEAR_MIPMAP_LINEAR) :
+        mipmap(mipmap), wrapMode(wrapMode), magFilter(magFilter), minFilter(minFilter),
+        mipFilter(MIP_BOX), gammaCorrect(true), cacheMips(false) {}
+    std::string getKey() const;
+};
+
+// A texture the manager knows about. Only KTextureManager and
+// KTextureHandle touch these.
+struct KTextureEntry
+{
+    // The placeholder texture until an async load has been uploaded
+    unsigned int id;
+    int width;
+    int height;
+    std::size_t bytes;
+    unsigned int refs;
+    unsigned long long lastUsed;
+    KTextureOptions options;
+    // Still being decoded, or waiting for upload
+    bool pending;
+    // Empty unless this entry owns its GL texture
+    std::string contentKey;
+    // An async load which turned out to have the same contents as a texture
+    // that was already loaded uses that one, and holds a reference to it
+    KTextureEntry* aliasOf;
+    // Every path key which leads here, so they can be dropped on eviction
+    std::vector<std::string> pathKeys;
+};
+
+// A decoded image coming back from a worker thread
+struct KDecodeResult;
+class KUploadRing;
+
+// Refcounted reference to a managed texture. The texture stays resident
+// while any handle to it exists; after that it may be evicted once the
+// manager is over budget.
+class KTextureHandle
+{
+protected:
+    KTextureEntry* entry;
+public:
+    KTextureHandle() : entry(nullptr) {}
+    explicit KTextureHandle(KTextureEntry* entry);
+    KTextureHandle(const KTextureHandle& other);
+    KTextureHandle(KTextureHandle&& other);
+    KTextureHandle& operator= (KTextureHandle other);
+    ~KTextureHandle();
+
+    // Drop the reference early
+    void release();
+
+    explicit operator bool() const { return entry != nullptr; }
+    // False while the placeholder is shown instead
+    bool isReady() const { return entry && !entry->pending; }
+    // 0 if the load failed
+    unsigned int getId() const { return entry ? entry->id : 0; }
+    int getWidth() const { return entry ? entry->width : 0; }
+    int getHeight() const { return entry ? entry->height : 0; }
+};
+
+// Loads PNG files into GL textures, once. If there is a KTX file with the
+// same name (made by texcompress) in a supported format, that's used instead,
+// mip chain and all. A second load of the same path
+// costs a map lookup; a different path with the same bytes costs reading
+// the file and hashing it, but not decoding or uploading it again.
+class KTextureManager
+{
+public:
+    // Returns an empty handle if the file can't be read or decoded
+    static KTextureHandle load(const char* path, const KTextureOptions& options = KTextureOptions());
+    // Returns straight away. The handle gives a placeholder texture until the
+    // image has been decoded on a worker thread and uploaded by
+    // processUploads(). Starts the workers if they aren't running.
+    static KTextureHandle loadAsync(const char* path, const KTextureOptions& options = KTextureOptions());
+    // Upload decoded images for up to budgetMs, but at least one if any are
+    // ready. Call once per frame on the GL thread. Returns how many were
+    // uploaded.
+    static unsigned int processUploads(double budgetMs);
+    static unsigned int getPendingCount() { return pendingCount; }
+
+    // 0 threads means one less than the number of cores
+    static void startWorkers(unsigned int threads = 0);
+    // Loads which haven't finished keep the placeholder
+    static void stopWorkers();
+
+    // Estimated VRAM the manager may keep. Textures without handles are
+    // evicted, least recently loaded first, to stay under it. Textures in
+    // use are never evicted, so the budget can still be exceeded.
+    static void setBudget(std::size_t bytes);
+    static std::size_t getBudget() { return budget; }
+    static std::size_t getResidentBytes() { return residentBytes; }
+    static std::size_t getTextureCount() { return byContent.size(); }
+
+    static unsigned int getPathHits() { return pathHits; }
+    static unsigned int getContentHits() { return contentHits; }
+    static unsigned int getUploads() { return uploads; }
+
+    // Whether textures in this compressed format can be uploaded
+    static bool isCompressedFormatSupported(unsigned int format);
+
+    // Shared by everything which uploads textures. Created on first use.
+    static KUploadRing* getUploadRing();
+
+    // Delete every texture without handles, and the upload ring if the
+    // workers aren't running
+    static void clear();
+
+private:
+    friend class KTextureHandle;
+
+    static KTextureEntry* createEntry(const std::string& pathKey, const KTextureOptions& options);
+    static std::size_t estimateBytes(int width, int height, const KTextureOptions& options);
+    // Uploads from the ring slot if there is one (>= 0), otherwise copies
+    // the pixels into the ring first. The mip levels are uploaded if there
+    // are any, otherwise they're generated if the options want them.
+    // Doesn't evict, so make room first.
+    static void upload(KTextureEntry* entry, const unsigned char* pixels, int ringSlot, int channels, const KMipChain& mips, const std::string& contentKey);
+    // Count the texture's memory, and make it findable by content
+    static void addResident(KTextureEntry* entry, std::size_t bytes, const std::string& contentKey);
+    // Load the KTX file next to the PNG, if there is one and the format is
+    // supported. Returns nullptr otherwise.
+    static KTextureEntry* loadCompressed(const std::string& pathKey, const char* path, const KTextureOptions& options);
+    // Give the workers mapped ring slots to decode into
+    static void offerStaging();
+    static void finishAsync(KDecodeResult& result);
+    static unsigned int getPlaceholder();
+    static void touch(KTextureEntry* entry);
+    static void release(KTextureEntry* entry);
+    // Evict unreferenced textures until extraBytes more would fit
+    static void evict(std::size_t extraBytes);
+    static void destroy(KTextureEntry* entry);
+
+    static std::unordered_map<std::string, KTextureEntry*> byPath;
+    static std::unordered_map<std::string, KTextureEntry*> byContent;
+    static std::size_t budget;
+    static std::size_t residentBytes;
+    static unsigned int placeholderId;
+    // Room for a 1024x1024 RGBA image per slot
+    static const unsigned int UPLOAD_RING_SLOTS = 8;
+    static const std::size_t UPLOAD_RING_SLOT_SIZE = 4 * 1024 * 1024;
+    static KUploadRing* uploadRing;
+    static unsigned int pendingCount;
+    static unsigned long long useClock;
+    static unsigned int pathHits;
+    static unsigned int contentHits;
+    static unsigned int uploads;
+};
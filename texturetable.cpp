@@ -0,0 +1,211 @@
+#include "glad.h"
+#include "texturetable.h"
+#include "textureatlas.h"
+#include "glstate.h"
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+
+// The implementation is in texturemanager.cpp
+#include "stb_image.h"
+
+// Comfortably under what drivers manage, and over what the table can use
+unsigned int KTextureTable::residentLimit = 1024;
+unsigned int KTextureTable::residentCount = 0;
+std::unordered_map<std::uint64_t, unsigned int> KTextureTable::residentRefs;
+
+KTextureTable::KTextureTable(unsigned int binding, bool allowBindless) :
+    bindless(allowBindless && isBindlessSupported()), binding(binding), buffer(0), dirty(true), frame(1), atlas(nullptr)
+{
+    std::memset(&block, 0, sizeof(block));
+    glGenBuffers(1, &buffer);
+    KGLState::bindBuffer(GL_UNIFORM_BUFFER, buffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(block), nullptr, GL_DYNAMIC_DRAW);
+}
+
+KTextureTable::~KTextureTable()
+{
+    // Handles have to stop being resident before their textures can go
+    for (Entry& entry : entries)
+    {
+        makeResident(entry, false);
+    }
+    KGLState::bindBufferBase(GL_UNIFORM_BUFFER, binding, 0);
+    KGLState::forgetBuffer(buffer);
+    glDeleteBuffers(1, &buffer);
+    delete atlas;
+}
+
+bool KTextureTable::isBindlessSupported()
+{
+    // The handle comes from a per-instance index, which isn't dynamically
+    // uniform. GL_ARB_bindless_texture alone leaves that undefined;
+    // GL_NV_gpu_shader5 allows it.
+    return GLAD_GL_ARB_bindless_texture && GLAD_GL_NV_gpu_shader5;
+}
+
+int KTextureTable::add(const char* path, const KTextureOptions& options)
+{
+    if (entries.size() >= MAX_ENTRIES)
+    {
+        std::cerr << "Texture table is full, can't add " << path << std::endl;
+        return -1;
+    }
+    Entry entry = {KTextureHandle(), 0, 0, false, 0};
+    unsigned int index = entries.size();
+    if (bindless)
+    {
+        entry.texture = KTextureManager::load(path, options);
+        if (!entry.texture)
+        {
+            return -1;
+        }
+        // The handle is made by update(), once the texture is really there
+        float whole[] = {0., 0., 1., 1.};
+        std::memcpy(block.rects[index], whole, sizeof(whole));
+    }
+    else
+    {
+        if (atlas && atlas->getId() != 0)
+        {
+            std::cerr << "Can't add " << path << " to a texture table after build()" << std::endl;
+            return -1;
+        }
+        int width, height, channels;
+        unsigned char* pixels = stbi_load(path, &width, &height, &channels, 0);
+        if (!pixels)
+        {
+            std::cerr << "Failed to load " << path << ": " << stbi_failure_reason() << std::endl;
+            return -1;
+        }
+        if (!atlas)
+        {
+            atlas = new KTextureAtlas(KTextureAtlas::ATLAS_ARRAY);
+            arrayOptions = options;
+        }
+        atlas->add(path, pixels, width, height, channels);
+        stbi_image_free(pixels);
+    }
+    entries.push_back(std::move(entry));
+    dirty = true;
+    return index;
+}
+
+bool KTextureTable::build()
+{
+    if (bindless || !atlas)
+    {
+        return true;
+    }
+    if (!atlas->build(arrayOptions))
+    {
+        return false;
+    }
+    for (unsigned int i = 0; i < atlas->getRegionCount(); i++)
+    {
+        const KAtlasRegion& region = atlas->getRegion(i);
+        block.entries[i][2] = region.layer;
+        std::memcpy(block.rects[i], region.uvRect, sizeof(region.uvRect));
+    }
+    dirty = true;
+    return true;
+}
+
+unsigned int KTextureTable::getArrayTexture() const
+{
+    return atlas ? atlas->getId() : 0;
+}
+
+void KTextureTable::use(int index)
+{
+    if (index >= 0 && (unsigned int)index < entries.size())
+    {
+        entries[index].lastUsed = frame;
+    }
+}
+
+void KTextureTable::useAll()
+{
+    for (Entry& entry : entries)
+    {
+        entry.lastUsed = frame;
+    }
+}
+
+void KTextureTable::makeResident(Entry& entry, bool resident)
+{
+    if (entry.resident == resident || entry.handle == 0)
+    {
+        return;
+    }
+    // Entries with the same texture, e.g. the placeholder, get the same
+    // handle, and it's an error to make it resident twice
+    unsigned int& refs = residentRefs[entry.handle];
+    if (resident && refs++ == 0)
+    {
+        glMakeTextureHandleResidentARB(entry.handle);
+        residentCount++;
+    }
+    else if (!resident && --refs == 0)
+    {
+        glMakeTextureHandleNonResidentARB(entry.handle);
+        residentCount--;
+        residentRefs.erase(entry.handle);
+    }
+    entry.resident = resident;
+}
+
+void KTextureTable::update()
+{
+    if (bindless)
+    {
+        for (std::size_t i = 0; i < entries.size(); i++)
+        {
+            Entry& entry = entries[i];
+            // Async loads show the placeholder until they're uploaded. The
+            // placeholder's handle stays valid, since handles make their
+            // texture immutable rather than the other way round.
+            unsigned int id = entry.texture.getId();
+            if (id != entry.textureId)
+            {
+                makeResident(entry, false);
+                entry.handle = id ? glGetTextureHandleARB(id) : 0;
+                entry.textureId = id;
+                block.entries[i][0] = (std::uint32_t)entry.handle;
+                block.entries[i][1] = (std::uint32_t)(entry.handle >> 32);
+                dirty = true;
+            }
+            if (entry.lastUsed == frame)
+            {
+                makeResident(entry, true);
+            }
+        }
+
+        if (residentCount > residentLimit)
+        {
+            // Least recently used first, leaving this frame's alone
+            std::vector<Entry*> unused;
+            for (Entry& entry : entries)
+            {
+                if (entry.resident && entry.lastUsed != frame)
+                {
+                    unused.push_back(&entry);
+                }
+            }
+            std::sort(unused.begin(), unused.end(), [](const Entry* a, const Entry* b) { return a->lastUsed < b->lastUsed; });
+            for (std::size_t i = 0; i < unused.size() && residentCount > residentLimit; i++)
+            {
+                makeResident(*unused[i], false);
+            }
+        }
+    }
+
+    if (dirty)
+    {
+        KGLState::bindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(block), &block);
+        dirty = false;
+    }
+    KGLState::bindBufferBase(GL_UNIFORM_BUFFER, binding, buffer);
+    frame++;
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+#include "texturemanager.h"
+
+class KTextureAtlas;
+
+// Textures which shaders pick by index, e.g. one per instance, so draws
+// using different textures need no binds in between.
+//
+// With GL_ARB_bindless_texture, and GL_NV_gpu_shader5 so the handle can
+// differ between instances of a draw, the table is a uniform block of
+// texture handles, and the textures stay separate. Without them, the
+// images are copied into the layers of a GL_TEXTURE_2D_ARRAY, and the block
+// has the layer and where in it the image is. Either way the block is:
+//
+//     layout (std140, binding = N) uniform TextureTable
+//     {
+//         // xy: bindless handle, z: array layer
+//         uvec4 textureEntries[256];
+//         // Where the image is in its layer: u, v, width, height
+//         vec4 textureRects[256];
+//     };
+//
+// tut6bindless.fp and tut6array.fp sample it each way.
+class KTextureTable
+{
+public:
+    // 32 bytes each, so the block is 8KB, half the smallest maximum size
+    // GL allows
+    static const unsigned int MAX_ENTRIES = 256;
+
+    // binding is the uniform buffer binding point. allowBindless false
+    // makes a texture array even if bindless textures are supported.
+    explicit KTextureTable(unsigned int binding, bool allowBindless = true);
+    ~KTextureTable();
+    KTextureTable(const KTextureTable&) = delete;
+    KTextureTable& operator= (const KTextureTable&) = delete;
+
+    static bool isBindlessSupported();
+    bool isBindless() const { return bindless; }
+
+    // Returns the texture's index in the table, or -1 if the table is full
+    // or the image can't be loaded. Bindless tables load through
+    // KTextureManager, so share textures with everything else; texture
+    // arrays use the options of the first image for all of them.
+    int add(const char* path, const KTextureOptions& options = KTextureOptions());
+    // Makes the texture array, so call it after the last add(). Nothing to
+    // do for bindless tables.
+    bool build();
+
+    // Mark a texture as needed for this frame's draws
+    void use(int index);
+    void useAll();
+    // Call once per frame, after use() and before drawing. Makes the handles
+    // of the used textures resident, and if that's more than the limit, the
+    // ones unused the longest not resident. Picks up async loads which have
+    // been uploaded since. Uploads the block if it changed, and binds it.
+    void update();
+
+    // The texture array, for a sampler2DArray. 0 for bindless tables.
+    unsigned int getArrayTexture() const;
+    unsigned int getCount() const { return entries.size(); }
+
+    // Resident handles count against driver limits which can't be queried,
+    // so keep the total across all tables under this. Textures used in the
+    // current frame stay resident regardless.
+    static void setResidentLimit(unsigned int limit) { residentLimit = limit; }
+    static unsigned int getResidentLimit() { return residentLimit; }
+    static unsigned int getResidentCount() { return residentCount; }
+
+private:
+    struct Entry
+    {
+        KTextureHandle texture;
+        // What the handle was made for, so a finished async load is noticed
+        unsigned int textureId;
+        std::uint64_t handle;
+        bool resident;
+        unsigned long long lastUsed;
+    };
+    // std140 layout of the uniform block
+    struct Block
+    {
+        std::uint32_t entries[MAX_ENTRIES][4];
+        float rects[MAX_ENTRIES][4];
+    };
+
+    bool bindless;
+    unsigned int binding;
+    unsigned int buffer;
+    std::vector<Entry> entries;
+    Block block;
+    bool dirty;
+    unsigned long long frame;
+    KTextureAtlas* atlas;
+    KTextureOptions arrayOptions;
+
+    void makeResident(Entry& entry, bool resident);
+
+    static unsigned int residentLimit;
+    // Resident handles, not entries
+    static unsigned int residentCount;
+    static std::unordered_map<std::uint64_t, unsigned int> residentRefs;
+};
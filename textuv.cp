@@ -0,0 +1,44 @@
+#version 430 core
+// Fills in the UVs of a QuadGrid from a grid of characters, one invocation
+// per cell. Does the same thing as drawTextOnQuadGrid in tut6.3.cpp.
+layout (local_size_x = 64) in;
+
+// One byte per cell, packed 4 to a uint. 0 means the cell is empty.
+layout (std430, binding = 0) readonly buffer TextCells
+{
+    uint cells[];
+};
+
+// 4 vertices per cell, in the same order as QuadGrid
+layout (std430, binding = 1) writeonly buffer GridUvs
+{
+    vec2 uvs[];
+};
+
+uniform uint cellCount;
+// Number of cells per row in the font texture
+uniform uint fontColumns;
+// Size of each font cell in UV units
+uniform vec2 cellUv;
+
+const vec2 corners[4] = vec2[](
+    vec2(0.0, 1.0),
+    vec2(1.0, 1.0),
+    vec2(0.0, 0.0),
+    vec2(1.0, 0.0)
+);
+
+void main()
+{
+    uint cell = gl_GlobalInvocationID.x;
+    if (cell >= cellCount)
+    {
+        return;
+    }
+    uint ch = (cells[cell / 4] >> ((cell % 4) * 8)) & 0xFFu;
+    vec2 origin = vec2(ch % fontColumns, ch / fontColumns) * cellUv;
+    for (uint vertex = 0; vertex < 4; vertex++)
+    {
+        uvs[cell * 4 + vertex] = ch == 0u ? vec2(0.0) : origin + cellUv * corners[vertex];
+    }
+}
@@ -9,10 +9,7 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
-// Use stb_image.h
-#define STB_IMAGE_IMPLEMENTATION
-#define STBI_ONLY_PNG
-#include "stb_image.h"
+#include "texturemanager.h"
 
 // Tutorial 5: Transformations
 // https://learnopengl.com/Getting-started/Transformations
@@ -102,57 +99,9 @@ int main(int argc, char** argv) {
     // Release binding
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
-    unsigned int texture;
-    glGenTextures(1, &texture);
-    glBindTexture(GL_TEXTURE_2D, texture);
-    // Load texture image
-    int width, height, channels;
-    unsigned char* data = stbi_load("dirbri18.png", &width, &height, &channels, 0);
-    if (data)
-    {
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-        glGenerateMipmap(GL_TEXTURE_2D);
-
-        // Release bindings
-        glBindTexture(GL_TEXTURE_2D, 0);
-    }
-    else
-    {
-        std::cerr << "Failed to load dirbri18.png for some reason!" << std::endl;
-    }
-    // Free texture from memory
-    stbi_image_free(data);
-
-    // Load another texture
-    data = stbi_load("awesomeface.png", &width, &height, &channels, 0);
-    unsigned int otherTex;
-    if (data)
-    {
-        // Create GL texture
-        glGenTextures(1, &otherTex);
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, otherTex);
-        // Upload to GPU, set parameters, and generate mipmaps (lower res versions of the texture)
-        int texFormat = channels == 3 ? GL_RGB : GL_RGBA;
-        glTexImage2D(GL_TEXTURE_2D, 0, texFormat, width, height, 0, texFormat, GL_UNSIGNED_BYTE, data);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-        glGenerateMipmap(GL_TEXTURE_2D);
-
-        // Release bindings
-        glBindTexture(GL_TEXTURE_2D, 0);
-    }
-    else
-    {
-        std::cerr << "Failed to load awesomeface.png for some reason!" << std::endl;
-    }
-    stbi_image_free(data);
+    // Load textures through the shared cache, so they are decoded and uploaded once
+    KTextureHandle texture = KTextureManager::load("dirbri18.png");
+    KTextureHandle otherTex = KTextureManager::load("awesomeface.png");
 
     /*
     // GLM-based transformation
@@ -207,9 +156,9 @@ int main(int argc, char** argv) {
             theShader.setUniform("gratexture", 1);
             theShader.setUniform("transform", trans);
             glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, texture);
+            glBindTexture(GL_TEXTURE_2D, texture.getId());
             glActiveTexture(GL_TEXTURE1);
-            glBindTexture(GL_TEXTURE_2D, otherTex);
+            glBindTexture(GL_TEXTURE_2D, otherTex.getId());
             glBindVertexArray(VAO);
             glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
             // FINALLY DRAW THAT SHITE
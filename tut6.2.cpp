@@ -8,10 +8,7 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
-// Use stb_image.h
-#define STB_IMAGE_IMPLEMENTATION
-#define STBI_ONLY_PNG
-#include "stb_image.h"
+#include "texturemanager.h"
 
 // Tutorial 6: Coordinate systems - Part 3: Exercises
 // https://learnopengl.com/Getting-started/Coordinate-Systems
@@ -19,7 +16,6 @@
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void error_callback(int error, const char* description);
 void processInput(GLFWwindow *window);
-unsigned int loadImage(const char* fname, bool makeMipmap = true, GLint textureUnit = GL_TEXTURE0, GLint wrapMode = GL_REPEAT, GLint magFilter = GL_NEAREST, GLint minFilter = GL_LINEAR_MIPMAP_LINEAR);
 /*
 const double PI = 3.14159265358979323846264338327950288419716939937510;
 float degToRad(float degrees) { return degrees / (180 / PI); }
@@ -130,8 +126,8 @@ int main(int argc, char** argv) {
     // Release binding
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
-    unsigned int texture = loadImage("dirbri18.png");
-    unsigned int otherTex = loadImage("awesomeface.png", true, GL_TEXTURE1);
+    KTextureHandle texture = KTextureManager::load("dirbri18.png");
+    KTextureHandle otherTex = KTextureManager::load("awesomeface.png");
 
     glEnable(GL_DEPTH_TEST);
 
@@ -253,9 +249,9 @@ int main(int argc, char** argv) {
             theShader.setUniform("projection", projection);
 
             glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, texture);
+            glBindTexture(GL_TEXTURE_2D, texture.getId());
             glActiveTexture(GL_TEXTURE1);
-            glBindTexture(GL_TEXTURE_2D, otherTex);
+            glBindTexture(GL_TEXTURE_2D, otherTex.getId());
             glBindVertexArray(VAO);
             glBindBuffer(GL_ARRAY_BUFFER, VBO);
             // FINALLY DRAW THAT SHITE
@@ -313,41 +309,4 @@ void processInput(GLFWwindow *window)
 {
     if(glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
         glfwSetWindowShouldClose(window, true);
-}
-
-unsigned int loadImage(const char* fname, bool makeMipmap, GLint textureUnit, GLint wrapMode, GLint magFilter, GLint minFilter)
-{
-    // Load another texture
-    int width, height, channels;
-    unsigned char* data = stbi_load(fname, &width, &height, &channels, 0);
-    unsigned int imageId;
-    if (data)
-    {
-        // Create GL texture
-        glGenTextures(1, &imageId);
-        glActiveTexture(textureUnit);
-        glBindTexture(GL_TEXTURE_2D, imageId);
-        // Upload to GPU, set parameters, and generate mipmaps (lower res versions of the texture)
-        int texFormat = channels == 3 ? GL_RGB : GL_RGBA;
-        glTexImage2D(GL_TEXTURE_2D, 0, texFormat, width, height, 0, texFormat, GL_UNSIGNED_BYTE, data);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrapMode);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrapMode);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minFilter);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, magFilter);
-        if (makeMipmap)
-        {
-            glGenerateMipmap(GL_TEXTURE_2D);
-        }
-
-        // Release bindings
-        glBindTexture(GL_TEXTURE_2D, 0);
-    }
-    else
-    {
-        std::cerr << "Failed to load " << fname << " for some reason!" << std::endl;
-        stbi_image_free(data);
-        return 0;
-    }
-    stbi_image_free(data);
-    return imageId;
 }
\ No newline at end of file
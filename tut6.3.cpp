@@ -2,7 +2,29 @@
 
 #include <iostream>
 #include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <algorithm>
+#include <vector>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "shader.h"
+#include "glstate.h"
+#include "gltrace.h"
+#include "vertexlayout.h"
+#include "pipeline.h"
+#include "texturemanager.h"
+#include "uploadring.h"
+#include "textureatlas.h"
+#include "texturetable.h"
+#include "virtualtexture.h"
+#include "sdf.h"
+#include "textformat.h"
+#include "glyphcache.h"
+#include "spritebatch.h"
+#include "textlayout.h"
+#include "bufferpool.h"
 #include <cmath>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -21,10 +43,15 @@
 
 bool sdlImage = false;
 
-unsigned int loadGLImage(const char* fname, bool makeMipmap = true, GLint textureUnit = GL_TEXTURE0, GLint wrapMode = GL_REPEAT, GLint magFilter = GL_NEAREST, GLint minFilter = GL_LINEAR_MIPMAP_LINEAR);
-unsigned int SDLSurfaceToGLImage(SDL_Surface*& surface, bool makeMipmap = true, GLint textureUnit = GL_TEXTURE0, GLint wrapMode = GL_REPEAT, GLint magFilter = GL_NEAREST, GLint minFilter = GL_LINEAR_MIPMAP_LINEAR);
+// Most SDL formats are uploaded as they are. Indexed surfaces are too if
+// paletteId is given: the texture has the indices, to be looked up in the
+// palette texture by 2dpal.fp. Otherwise, and for formats GL has no match
+// for, the surface is replaced with an RGB(A) copy first.
+unsigned int SDLSurfaceToGLImage(SDL_Surface*& surface, bool makeMipmap = true, GLint textureUnit = GL_TEXTURE0, GLint wrapMode = GL_REPEAT, GLint magFilter = GL_NEAREST, GLint minFilter = GL_LINEAR_MIPMAP_LINEAR, unsigned int* paletteId = nullptr);
 unsigned int tickCallback(unsigned int interval, void* param);
 SDL_Surface* drawTextToSurface(const char* text, SDL_Surface* font, int cellSizeX = 8, int cellSizeY = 8);
+// Returns the region index, or -1 if the surface couldn't be converted
+int addSurfaceToAtlas(KTextureAtlas& atlas, const char* name, SDL_Surface* surface);
 
 struct tickParam
 {
@@ -38,15 +65,28 @@ template<typename T> struct vector2
 };
 
 vector2<unsigned int> getTextGridSize(const char* text);
+// As much of a grid of cells, cellWidth by cellHeight pixels, as fits on the
+// screen, and at least a cell
+vector2<unsigned int> fitTextGrid(vector2<unsigned int> cells, int screenWidth, int screenHeight, float cellWidth, float cellHeight);
+// A GL_R8 texture of the font's distance field, scale times the size, with
+// the red channel as the glyphs. Returns 0 if the surface couldn't be
+// converted.
+unsigned int makeDistanceFieldFont(SDL_Surface* font, vector2<unsigned int> cellSize, int scale, float spread, GLint textureUnit);
 
+// Positions, UVs and element indices for a grid of quads, a cell each
 struct QuadGrid {
-    float* pos;
-    float* uv;
-    unsigned int* el;
-    // unsigned int elementCount;
+    std::vector<float> pos;
+    std::vector<float> uv;
+    std::vector<unsigned int> el;
     unsigned int rows;
     unsigned int cols;
-    QuadGrid(unsigned int rows, unsigned int cols) : rows(rows), cols(cols)
+    QuadGrid(unsigned int rows, unsigned int cols) : rows(0), cols(0)
+    {
+        resize(rows, cols);
+    }
+    // Lays the grid out again, reusing the memory it has if it's enough.
+    // Every cell's UVs go back to covering the whole texture.
+    void resize(unsigned int rows, unsigned int cols)
     {
         // 0   1
         // +---+
@@ -59,39 +99,37 @@ struct QuadGrid {
         float xFactor[] = { 0.0, 1.0, 0.0, 1.0 };
         float yFactor[] = { 0.0, 0.0, 1.0, 1.0 };
         unsigned int elements[] = { 0, 1, 2, 1, 2, 3 };
-        if (rows > 0 && cols > 0)
-        {
-            unsigned int quadCount = rows * cols;
-            // 4 vertices per quad, 2 values per vertex
-            pos = new float[quadCount * 8];
-            uv = new float[quadCount * 8];
-            // 3 vertices per triangle, 2 triangles per quad
-            el = new unsigned int[quadCount * 6];
-            unsigned int curVertex = 0;
-            unsigned int curElement = 0;
-            float xSize = 1. / cols * 2;
-            float ySize = 1. / rows * 2;
-            for (unsigned int row = 0; row < rows; row++)
+        this->rows = rows;
+        this->cols = cols;
+        unsigned int quadCount = rows * cols;
+        // 4 vertices per quad, 2 values per vertex
+        pos.resize(quadCount * 8);
+        uv.resize(quadCount * 8);
+        // 3 vertices per triangle, 2 triangles per quad
+        el.resize(quadCount * 6);
+        unsigned int curVertex = 0;
+        unsigned int curElement = 0;
+        float xSize = 1. / cols * 2;
+        float ySize = 1. / rows * 2;
+        for (unsigned int row = 0; row < rows; row++)
+        {
+            for (unsigned int col = 0; col < cols; col++)
             {
-                for (unsigned int col = 0; col < cols; col++)
+                float xPos = (float)col / cols * 2 - 1;
+                float yPos = 1 - (float)(row + 1) / rows * 2;
+                for (unsigned int element = 0; element < 6; element++)
                 {
-                    float xPos = (float)col / cols * 2 - 1;
-                    float yPos = 1 - (float)row / rows * 2;
-                    for (unsigned int element = 0; element < 6; element++)
-                    {
-                        el[curElement++] = elements[element] + curVertex;
-                    }
-                    for (unsigned int vertex = 0; vertex < 4; vertex++)
-                    {
-                        pos[curVertex * 2] = xPos + xSize * xFactor[vertex];
-                        pos[curVertex * 2 + 1] = yPos + ySize * yFactor[vertex];
-                        uv[curVertex * 2] = xFactor[vertex];
-                        uv[curVertex * 2 + 1] = yFactor[vertex];
-                        curVertex++;
-                    }
+                    el[curElement++] = elements[element] + curVertex;
+                }
+                for (unsigned int vertex = 0; vertex < 4; vertex++)
+                {
+                    pos[curVertex * 2] = xPos + xSize * xFactor[vertex];
+                    pos[curVertex * 2 + 1] = yPos + ySize * yFactor[vertex];
+                    uv[curVertex * 2] = xFactor[vertex];
+                    uv[curVertex * 2 + 1] = yFactor[vertex];
+                    curVertex++;
                 }
             }
-            // elementCount = curElement;
         }
     }
 };
@@ -103,6 +141,13 @@ private:
     // Size of each cell as a percentage of the width/height
     vector2<float> cellUv;
     unsigned int textureId;
+    // False if the texture belongs to an atlas
+    bool ownsTexture;
+    // The UVs of all 4 corners of each byte's cell, in QuadGrid order, so
+    // laying out text is just copying. Byte 0 is all zeros, for empty cells.
+    std::vector<float> quadUvs;
+
+    void buildUvTable();
 public:
     FontTexture(SDL_Surface*& texture, vector2<unsigned int> cellSize, int texUnit = 0)
     {
@@ -112,14 +157,33 @@ public:
         cellUv.x = (float)cellSize.x / imageSize.x;
         cellUv.y = (float)cellSize.y / imageSize.y;
         textureId = SDLSurfaceToGLImage(texture, true, texUnit);
+        ownsTexture = true;
+        buildUvTable();
         if (textureId == 0)
         {
             std::cerr << "Failed to convert the texture for some reason!" << std::endl;
         }
     }
+    // The font is one of the atlas' images. UVs are still for the font
+    // image alone, so map them with the region's uvRect when drawing.
+    FontTexture(const KTextureAtlas& atlas, int region, vector2<unsigned int> cellSize)
+    {
+        imageSize.x = atlas.getRegion(region).width;
+        imageSize.y = atlas.getRegion(region).height;
+        this->cellSize = cellSize;
+        cellUv.x = (float)cellSize.x / imageSize.x;
+        cellUv.y = (float)cellSize.y / imageSize.y;
+        textureId = atlas.getId();
+        ownsTexture = false;
+        buildUvTable();
+    }
     ~FontTexture()
     {
-        glDeleteTextures(1, &textureId);
+        if (ownsTexture)
+        {
+            KGLState::forgetTexture(textureId);
+            glDeleteTextures(1, &textureId);
+        }
     }
     // Delete copy constructor and copy assignment constructor
     FontTexture(const FontTexture&) = delete;
@@ -131,10 +195,27 @@ public:
         this->cellSize = previous.cellSize;
         this->cellUv = previous.cellUv;
         this->textureId = previous.textureId;
+        this->ownsTexture = previous.ownsTexture;
+        this->quadUvs = std::move(previous.quadUvs);
+        // The texture is this one's to delete now
+        previous.textureId = 0;
+        previous.ownsTexture = false;
     }
     FontTexture& operator= (FontTexture&& previous);
     // UV coordinates for upper left corner of the given byte
-    vector2<float> uvForChar(char ch) const;
+    vector2<float> uvForChar(char ch) const
+    {
+        // Corner 2 is the top left of the glyph
+        const float* quad = getQuadUvs(ch);
+        return {quad[4], quad[5]};
+    }
+    // 8 floats: the UVs of the byte's 4 corners, as QuadGrid has them
+    const float* getQuadUvs(char ch) const
+    {
+        return &quadUvs[(unsigned char)ch * 8];
+    }
+    // getQuadUvs() for count bytes of text, into 8 * count floats
+    void uvQuadsForText(const char* text, std::size_t count, float* uvs) const;
     vector2<float> getCellUv() const
     {
         return cellUv;
@@ -143,6 +224,11 @@ public:
     {
         return cellSize;
     }
+    // Number of cells in each row/column of the font texture
+    vector2<unsigned int> getGridSize() const
+    {
+        return {imageSize.x / cellSize.x, imageSize.y / cellSize.y};
+    }
     unsigned int getTextureId() const
     {
         return textureId;
@@ -151,29 +237,200 @@ public:
 
 FontTexture& FontTexture::operator= (FontTexture&& previous)
 {
+    if (this == &previous)
+    {
+        return *this;
+    }
+    if (ownsTexture)
+    {
+        KGLState::forgetTexture(textureId);
+        glDeleteTextures(1, &textureId);
+    }
     this->imageSize = previous.imageSize;
     this->cellSize = previous.cellSize;
     this->cellUv = previous.cellUv;
     this->textureId = previous.textureId;
+    this->ownsTexture = previous.ownsTexture;
+    this->quadUvs = std::move(previous.quadUvs);
+    previous.textureId = 0;
+    previous.ownsTexture = false;
     return *this;
 }
 
-vector2<float> FontTexture::uvForChar(char ch) const
-{
-    // Get the UV for the upper left corner of a particular character
-    vector2<unsigned int> cells;
-    vector2<unsigned int> pos;
-    cells.x = imageSize.x / cellSize.x;
-    cells.y = imageSize.y / cellSize.y;
-    pos.x = ch % cells.y;
-    pos.y = ch / cells.x;
-    vector2<float> uv;
-    uv.x = cellUv.x * pos.x;
-    uv.y = cellUv.y * pos.y;
-    return uv;
+void FontTexture::buildUvTable()
+{
+    // 0   1
+    // +---+
+    // |  /|
+    // |/  |
+    // +---+
+    // 2   3
+    float xFactor[] = { 0.0, 1.0, 0.0, 1.0 };
+    float yFactor[] = { 0.0, 0.0, 1.0, 1.0 };
+    unsigned int columns = getGridSize().x;
+    quadUvs.assign(256 * 8, 0.f);
+    for (unsigned int ch = 1; ch < 256; ch++)
+    {
+        float u = cellUv.x * (ch % columns);
+        float v = cellUv.y * (ch / columns);
+        for (unsigned int vertex = 0; vertex < 4; vertex++)
+        {
+            quadUvs[ch * 8 + vertex * 2] = u + cellUv.x * xFactor[vertex];
+            quadUvs[ch * 8 + vertex * 2 + 1] = v + cellUv.y * (1 - yFactor[vertex]);
+        }
+    }
+}
+
+void FontTexture::uvQuadsForText(const char* text, std::size_t count, float* uvs) const
+{
+    const float* table = quadUvs.data();
+    for (std::size_t i = 0; i < count; i++)
+    {
+        const float* quad = table + (unsigned char)text[i] * 8;
+#ifdef __SSE2__
+        // A whole quad is two registers
+        _mm_storeu_ps(uvs + i * 8, _mm_loadu_ps(quad));
+        _mm_storeu_ps(uvs + i * 8 + 4, _mm_loadu_ps(quad + 4));
+#else
+        std::memcpy(uvs + i * 8, quad, sizeof(float) * 8);
+#endif
+    }
 }
 
 void drawTextOnQuadGrid(const char* text, const FontTexture& fontexture, QuadGrid& grid);
+// Gives back the buffers the grid had, takes ones for its positions, UVs
+// and indices from pool, and uploads it. Giving back first means a grid
+// which shrank gets the same buffers again.
+void uploadQuadGrid(const QuadGrid& grid, KBufferPool& pool, KPooledBuffer& pos, KPooledBuffer& uv, KPooledBuffer& el);
+// A quad per visible character, from (left, top) down, cells cellWidth by
+// cellHeight in clip space. uvRect is where the font is in texture.
+void batchText(KSpriteBatch& batch, const char* text, const FontTexture& font, const float* uvRect, unsigned int texture,
+    float left, float top, float cellWidth, float cellHeight);
+// Lay out text one byte per grid cell, for textuv.cp to turn into UVs
+void packTextGrid(const char* text, const QuadGrid& grid, unsigned char* cells);
+
+// Text on a QuadGrid which changes a little at a time, like the stats.
+// setText() compares the new text with the old cell by cell, and only the
+// cells which changed get new UVs and are uploaded. Changed cells close
+// together are uploaded as one range, since a glBufferSubData call costs
+// more than a few extra bytes.
+class TextGrid
+{
+private:
+    QuadGrid& grid;
+    const FontTexture& font;
+    // Character in each cell, 0 if empty. Padded to whole uints for textuv.cp.
+    std::vector<unsigned char> cells;
+    std::vector<unsigned char> newCells;
+    // Changed since the last upload
+    std::vector<bool> dirty;
+    // Nothing set yet, so every cell counts as changed
+    bool first;
+    unsigned int changedCells;
+    unsigned int uploadedBytes;
+    unsigned int uploadCalls;
+
+    void setCellUv(unsigned int cell, unsigned char ch);
+    // Upload the runs of dirty cells, bytesPerCell each and rounded out to
+    // multiples of align bytes, from data to buffer
+    void uploadDirty(unsigned int target, unsigned int buffer, const void* data, unsigned int bytesPerCell, unsigned int align);
+public:
+    // Changed cells this far apart or closer are uploaded together
+    static const unsigned int MERGE_GAP = 8;
+
+    TextGrid(QuadGrid& grid, const FontTexture& font) : grid(grid), font(font),
+        cells((grid.rows * grid.cols + 3) & ~3u), newCells(cells.size()), dirty(grid.rows * grid.cols),
+        first(true), changedCells(0), uploadedBytes(0), uploadCalls(0) {}
+    // Call after grid.resize(). Every cell counts as changed again.
+    void resize()
+    {
+        cells.assign((grid.rows * grid.cols + 3) & ~3u, 0);
+        newCells.resize(cells.size());
+        dirty.assign(grid.rows * grid.cols, false);
+        first = true;
+    }
+    // Returns how many cells changed
+    unsigned int setText(const char* text);
+    // Upload the changed UVs to the buffer holding grid.uv
+    void uploadUvs(unsigned int uvBuffer)
+    {
+        uploadDirty(GL_ARRAY_BUFFER, uvBuffer, grid.uv.data(), sizeof(float) * 8, 1);
+    }
+    // Or upload the changed cells to a buffer of getCellBytes(), for
+    // textuv.cp. Returns false if nothing changed, so the pass can be skipped.
+    bool uploadCells(unsigned int cellBuffer)
+    {
+        bool changed = std::find(dirty.begin(), dirty.end(), true) != dirty.end();
+        // The shader reads whole uints
+        uploadDirty(GL_SHADER_STORAGE_BUFFER, cellBuffer, cells.data(), 1, 4);
+        return changed;
+    }
+    unsigned int getCellBytes() const { return cells.size(); }
+    // For the last setText()
+    unsigned int getChangedCells() const { return changedCells; }
+    // For the last upload
+    unsigned int getUploadedBytes() const { return uploadedBytes; }
+    unsigned int getUploadCalls() const { return uploadCalls; }
+};
+
+// One character of instanced text. text.vp makes a quad of each, so this is
+// all that's stored and uploaded per glyph, instead of the 88 bytes of
+// positions, UVs and indices a QuadGrid cell takes.
+struct GlyphInstance
+{
+    unsigned short col;
+    unsigned short row;
+    unsigned int glyph;
+};
+
+// Text drawn as one GlyphInstance per visible character, for text.vp. Spaces
+// and cells past the end of a line aren't drawn at all. Like TextGrid, only
+// the instances which changed since the last upload are uploaded again.
+class GlyphText
+{
+private:
+    vector2<unsigned int> gridSize;
+    std::vector<GlyphInstance> glyphs;
+    std::vector<GlyphInstance> newGlyphs;
+    KPooledBuffer buffer;
+    // Instances to upload, as first and one past the last
+    unsigned int dirtyFirst;
+    unsigned int dirtyEnd;
+    unsigned int changedGlyphs;
+    unsigned int uploadedBytes;
+    unsigned int uploadCalls;
+public:
+    // Text is cut off at gridSize, like a QuadGrid of that many cells. Takes
+    // a buffer with room for every cell from the pool, so it never has to
+    // grow, and gives it back when it goes.
+    GlyphText(vector2<unsigned int> gridSize, KBufferPool& pool);
+    GlyphText(const GlyphText&) = delete;
+    GlyphText& operator= (const GlyphText&) = delete;
+
+    // The instance buffer's layout, for text.vp
+    static KVertexLayout getLayout();
+    // Returns how many instances changed
+    unsigned int setText(const char* text);
+    // Text in UTF-8, as glyph cache slots for glyphcache.vp. Call it every
+    // frame the text is drawn, so the cache keeps its glyphs.
+    unsigned int setText(const char* text, KGlyphCache& cache);
+    void upload();
+    // Makes room for a different grid. The buffer is kept if it's big
+    // enough, otherwise swapped for one from pool that is, so getBuffer()
+    // (and the VAO for it) may change. Everything is uploaded again.
+    void resize(vector2<unsigned int> gridSize, KBufferPool& pool);
+    unsigned int getBuffer() const { return buffer.getId(); }
+    unsigned int getCount() const { return glyphs.size(); }
+    vector2<unsigned int> getGridSize() const { return gridSize; }
+    // For the last setText()
+    unsigned int getChangedGlyphs() const { return changedGlyphs; }
+    // For the last upload
+    unsigned int getUploadedBytes() const { return uploadedBytes; }
+    unsigned int getUploadCalls() const { return uploadCalls; }
+private:
+    // Works out what to upload from glyphs and newGlyphs, then swaps them
+    unsigned int diffGlyphs();
+};
 
 #define GL // Use OpenGL for rendering
 #define CUBES
@@ -183,6 +440,68 @@ int main(int argc, char** argv) {
     int screenWidth = 800;
     int screenHeight = 600;
 
+    // --trace N: print a GL call histogram for each of the first N frames,
+    // then quit. Meant for running under a software GL driver on CI.
+    unsigned int traceFrames = 0;
+    // --upload-bench: compare texture upload throughput with and without
+    // pixel buffers, then quit
+    bool uploadBench = false;
+    // --virtual-texture FILE: stream a virtual texture made by vtiler with
+    // synthetic feedback, print the tile cache stats, then quit
+    const char* virtualTexturePath = nullptr;
+    // --quad-text: draw the stats with a QuadGrid, 4 vertices per cell,
+    // instead of a glyph instance per character
+    bool quadText = false;
+    // --sdf-text SCALE: draw the stats from a distance field of the font,
+    // SCALE times the size
+    float sdfTextScale = 0;
+    // --font FILE SIZE: draw the overlays with a TrueType font instead, SIZE
+    // pixels high, through a glyph cache
+    const char* fontPath = nullptr;
+    int fontPixels = 0;
+    // --sprite-batch: draw the controls and stats as quads through a sprite
+    // batch, in one draw call
+    bool useSpriteBatch = false;
+    // --log FILE: show the end of FILE in the bottom left corner, following
+    // it as it grows
+    const char* logPath = nullptr;
+    for (int arg = 1; arg < argc; arg++)
+    {
+        if (std::strcmp(argv[arg], "--trace") == 0 && arg < argc - 1)
+        {
+            traceFrames = std::atoi(argv[arg + 1]);
+        }
+        else if (std::strcmp(argv[arg], "--upload-bench") == 0)
+        {
+            uploadBench = true;
+        }
+        else if (std::strcmp(argv[arg], "--virtual-texture") == 0 && arg < argc - 1)
+        {
+            virtualTexturePath = argv[arg + 1];
+        }
+        else if (std::strcmp(argv[arg], "--quad-text") == 0)
+        {
+            quadText = true;
+        }
+        else if (std::strcmp(argv[arg], "--sdf-text") == 0 && arg < argc - 1)
+        {
+            sdfTextScale = std::atof(argv[arg + 1]);
+        }
+        else if (std::strcmp(argv[arg], "--font") == 0 && arg < argc - 2)
+        {
+            fontPath = argv[arg + 1];
+            fontPixels = std::atoi(argv[arg + 2]);
+        }
+        else if (std::strcmp(argv[arg], "--sprite-batch") == 0)
+        {
+            useSpriteBatch = true;
+        }
+        else if (std::strcmp(argv[arg], "--log") == 0 && arg < argc - 1)
+        {
+            logPath = argv[arg + 1];
+        }
+    }
+
     // Set GLFW hints so that OpenGL version 3.3 is used
     if (SDL_Init(SDL_INIT_VIDEO) != 0)
     {
@@ -231,6 +550,28 @@ int main(int argc, char** argv) {
 
     SDL_GLContext glcontext = SDL_GL_CreateContext(window);
 
+    if (traceFrames > 0)
+    {
+        KGLTrace::enable();
+    }
+
+    if (uploadBench || virtualTexturePath)
+    {
+        if (uploadBench)
+        {
+            KUploadRing::benchmark(std::cout, 1024, 1024, 256);
+        }
+        if (virtualTexturePath)
+        {
+            KVirtualTexture::exercise(std::cout, virtualTexturePath, 600);
+        }
+        SDL_GL_DeleteContext(glcontext);
+        SDL_DestroyRenderer(renderer);
+        SDL_DestroyWindow(window);
+        SDL_Quit();
+        return 0;
+    }
+
     // Set up viewport, and resize callback
     glViewport(0, 0, screenWidth, screenHeight);
 
@@ -280,32 +621,28 @@ int main(int argc, char** argv) {
         -0.5f,  0.5f, -0.5f,  0.0f, 1.0f
     };
 
-    unsigned int VAO;
-    glGenVertexArrays(1, &VAO);
-    glBindVertexArray(VAO);
-
     // Generate vertex buffer and upload it to the GPU
     unsigned int VBO;
     glGenBuffers(1, &VBO);
     glBindBuffer(GL_ARRAY_BUFFER, VBO);
     glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-
-    // Give OpenGL information about how the vertex buffer data is presented
-    // Vertex positions
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), 0);
-    glEnableVertexAttribArray(0);
-    // Texture coordinates
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*) (3 * sizeof(float)) );
-    glEnableVertexAttribArray(1);
-
-    // Release bindings
     glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
 
-    unsigned int texture = loadGLImage("dirbri18.png");
-    unsigned int otherTex = loadGLImage("awesomeface.png", true, GL_TEXTURE1);
+    // How the vertex buffer data is presented. The VAO is made once the
+    // shader is loaded, using the attribute locations it reports.
+    KVertexLayout cubeLayout;
+    cubeLayout.add("aPos", 3).add("aUv", 2);
 
-    glEnable(GL_DEPTH_TEST);
+    // Decoded in the background; they show a placeholder until uploaded.
+    // Without a usable KTX file, their mip chains are made on the worker
+    // too, and kept for next time.
+    KTextureOptions textureOptions;
+    textureOptions.mipFilter = MIP_KAISER;
+    textureOptions.cacheMips = true;
+    KTextureHandle texture = KTextureManager::loadAsync("dirbri18.png", textureOptions);
+    KTextureHandle otherTex = KTextureManager::loadAsync("awesomeface.png", textureOptions);
+
+    KGLState::setEnabled(GL_DEPTH_TEST, true);
 
     // To be used later
     glm::vec3 cubePositions[] = {
@@ -334,7 +671,7 @@ int main(int argc, char** argv) {
     }
 
     SDL_Surface* font = IMG_Load("bitmapfont.png");
-    SDL_Surface* controls = drawTextToSurface(
+    const char* controlsText =
     "========== CONTROLS ==========\n"
     "Move around: HJKLWS (vim keys LOL)\n"
     "Zoom in/out: Y/T\n"
@@ -343,49 +680,46 @@ int main(int argc, char** argv) {
     "Expand horizontally: Numpad 6\n"
     "Shrink horizontally: Numpad 4\n"
     "Turn: Arrow keys\n"
-    "More coming soon...\n", font, 8, 8);
+    "Toggle GL call tracing: F1\n"
+    "Print GL call histogram: F2\n"
+    "Scroll the log: Page Up/Down, End\n"
+    "More coming soon...\n";
 #ifdef GL
-    unsigned int controlTexture = SDLSurfaceToGLImage(controls);
-    float ctlVBuf[] = {
-        -1., 1., 0.0, 0.0,
-        1., 1., 1.0, 0.0,
-        -1., -1., 0.0, 1.0,
-        1., -1., 1.0, 1.0,
-    };
-    unsigned int ctlEBuf[] = {
-        0, 1, 2,
-        1, 2, 3,
-    };
-
-    unsigned int ctlVAO;
-    glGenVertexArrays(1, &ctlVAO);
-    glBindVertexArray(ctlVAO);
-
-    unsigned int ctlVBO;
-    glGenBuffers(1, &ctlVBO);
-    glBindBuffer(GL_ARRAY_BUFFER, ctlVBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(ctlVBuf), ctlVBuf, GL_STATIC_DRAW);
-
-    unsigned int ctlEBO;
-    glGenBuffers(1, &ctlEBO);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ctlEBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(ctlEBuf), ctlEBuf, GL_STATIC_DRAW);
-
-    // Give OpenGL information about how the vertex buffer data is presented
-    // Vertex positions
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), 0);
-    glEnableVertexAttribArray(0);
-    // Texture coordinates
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*) (2 * sizeof(float)) );
-    glEnableVertexAttribArray(1);
-
-    // Release bindings
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
+    // The 2D overlay's images share a texture, on a unit nothing else uses,
+    // so it needs no binds after the first frame. They're drawn a texel per
+    // pixel, so don't need mipmaps. The text is drawn from the font a glyph
+    // at a time, so changing it never means drawing and uploading an image.
+    const int overlayUnit = 2;
+    KTextureAtlas* overlayAtlas = new KTextureAtlas();
+    int fontRegion = addSurfaceToAtlas(*overlayAtlas, "font", font);
+    if (fontRegion < 0 || !overlayAtlas->build(KTextureOptions(false, GL_CLAMP_TO_EDGE, GL_NEAREST, GL_NEAREST)))
+    {
+        std::cerr << "Failed to build the overlay atlas!" << std::endl;
+        return 1;
+    }
+    // The distance field is filtered, unlike the atlas, so it gets its own
+    // texture and unit
+    const int sdfUnit = 4;
+    unsigned int sdfFontTexture = 0;
+    if (sdfTextScale > 0)
+    {
+        sdfFontTexture = makeDistanceFieldFont(font, {8, 8}, 4, 8, GL_TEXTURE0 + sdfUnit);
+    }
+    // The glyph cache's pages are a texture array, so need a unit too
+    const int glyphCacheUnit = 5;
+    KGlyphCache* glyphCache = nullptr;
+    if (fontPath != nullptr)
+    {
+        glyphCache = new KGlyphCache(fontPath, fontPixels, GL_TEXTURE0 + glyphCacheUnit);
+        if (!glyphCache->isLoaded())
+        {
+            delete glyphCache;
+            glyphCache = nullptr;
+        }
+    }
+    const float* fontUvRect = overlayAtlas->getRegion(fontRegion).uvRect;
 
-    FontTexture fontTexture(font, {8, 8}, GL_TEXTURE1);
-    unsigned int fontTextureId = fontTexture.getTextureId();
+    FontTexture fontTexture(*overlayAtlas, fontRegion, {8, 8});
     const char* stTextFmt = "========== STATS ==========\n"
         "X Offset: %0.4f\n"
         "Y Offset: %0.4f\n"
@@ -394,48 +728,160 @@ int main(int argc, char** argv) {
         "Aspect Ratio X: %0.4f\n"
         "Aspect Ratio Y: %0.4f\n"
         "Yaw: %0.4f\n"
-        "Pitch: %0.4f\n";
+        "Pitch: %0.4f\n"
+        "GL state calls: %u sent, %u elided\n"
+        "Text: %u cells changed, %u bytes in %u uploads\n";
     vector2<unsigned int> stCells = getTextGridSize(stTextFmt);
     char* stText = new char[stCells.x * stCells.y];
+    KTextWriter stWriter(stText, stCells.x * stCells.y);
     std::cout << "stCells " << stCells.x << " " << stCells.y << std::endl;
     QuadGrid stQuad(stCells.y, stCells.x);
     drawTextOnQuadGrid(stTextFmt, fontTexture, stQuad);
 
-    unsigned int stVAO;
-    glGenVertexArrays(1, &stVAO);
-    glBindVertexArray(stVAO);
-
-    unsigned int stData[] = {0, 0, 0};
-    unsigned int &stPosVBO = stData[0];
-    unsigned int &stUvVBO = stData[1];
-    unsigned int &stEBO = stData[2];
-    glGenBuffers(3, stData);
-    glBindBuffer(GL_ARRAY_BUFFER, stPosVBO);
-    glBufferData(GL_ARRAY_BUFFER, stQuad.rows * stQuad.cols * sizeof(float) * 8, stQuad.pos, GL_STATIC_DRAW);
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(float) * 2, 0);
-    glEnableVertexAttribArray(0);
-
-    glBindBuffer(GL_ARRAY_BUFFER, stUvVBO);
-    glBufferData(GL_ARRAY_BUFFER, stQuad.rows * stQuad.cols * sizeof(float) * 8, stQuad.uv, GL_STREAM_DRAW);
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(float) * 2, 0);
-    glEnableVertexAttribArray(1);
-
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, stEBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, stQuad.rows * stQuad.cols * sizeof(unsigned int) * 6, stQuad.el, GL_STATIC_DRAW);
+    // The log is read as it grows, and indexed by line as it's read, so each
+    // frame only lays out the lines on screen. Only the last 16 MB is kept.
+    // Windows too small for all of it show the bottom left part.
+    const vector2<unsigned int> logMaxCells = {80, 12};
+    vector2<unsigned int> logCells = logMaxCells;
+    std::FILE* logFile = nullptr;
+    if (logPath != nullptr)
+    {
+        logFile = std::fopen(logPath, "rb");
+        if (logFile == nullptr)
+        {
+            std::cerr << "Failed to open the log " << logPath << std::endl;
+        }
+    }
+    KTextLayout logLayout(16 << 20);
+    // Lines scrolled up from the end
+    std::size_t logScroll = 0;
+    // Room for 4 byte code points in every cell, and the line breaks
+    std::size_t logTextSize = (logMaxCells.x * 4 + 1) * logMaxCells.y + 1;
+    char* logText = new char[logTextSize];
+    KTextWriter logWriter(logText, logTextSize);
+    TextGrid stTextGrid(stQuad, fontTexture);
 
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
+    // Positions and UVs are in separate buffers, since only the UVs change
+    KVertexLayout stLayout;
+    stLayout.add("aPos", 2, GL_FLOAT, false, 0).add("aUv", 2, GL_FLOAT, false, 1);
 
 #else
+    SDL_Surface* controls = drawTextToSurface(controlsText, font, 8, 8);
     SDL_Texture* controlTexture = SDL_CreateTextureFromSurface(renderer, controls);
 #endif
     {
 #ifdef GL
 #ifdef CUBES
-        KShaderProgram theShader("tut6.vp", "tut6.fp");
+        KProgramPipeline theShader("tut6.vp", "tut6.fp");
 #endif
-        KShaderProgram shader2D("2d.vp", "2d.fp");
+        KProgramPipeline shader2D("2d.vp", "2d.fp");
+
+        // The text regions' buffers come from here, and go back when the
+        // regions change size, to be used again by whichever needs them
+        KBufferPool bufferPool;
+        KPooledBuffer stPosVBO;
+        KPooledBuffer stUvVBO;
+        KPooledBuffer stEBO;
+        uploadQuadGrid(stQuad, bufferPool, stPosVBO, stUvVBO, stEBO);
+
+#ifdef CUBES
+        unsigned int VAO = KVAOCache::get(cubeLayout, theShader.getVertexProgram(), VBO);
+#endif
+        unsigned int stStreams[] = {stPosVBO.getId(), stUvVBO.getId()};
+        unsigned int stVAO = KVAOCache::get(stLayout, shader2D.getVertexProgram(), stStreams, stEBO.getId());
+
+        // The stats again, as a glyph instance per character
+        KProgramPipeline textShader(glyphCache ? "glyphcache.vp" : "text.vp",
+            glyphCache ? "glyphcache.fp" : sdfFontTexture ? "sdf.fp" : "2d.fp");
+        GlyphText stGlyphText(stCells, bufferPool);
+        unsigned int stGlyphVAO = KVAOCache::get(GlyphText::getLayout(), textShader.getVertexProgram(), stGlyphText.getBuffer());
+        bool instancedText = !quadText && textShader.isUsable();
+        // The controls never change, so are uploaded once. They're always
+        // instanced; --quad-text is for comparing ways of drawing the stats.
+        vector2<unsigned int> ctlCells = getTextGridSize(controlsText);
+        GlyphText ctlGlyphText(ctlCells, bufferPool);
+        ctlGlyphText.setText(controlsText);
+        ctlGlyphText.upload();
+        unsigned int ctlGlyphVAO = KVAOCache::get(GlyphText::getLayout(), textShader.getVertexProgram(), ctlGlyphText.getBuffer());
+        KSpriteBatch* spriteBatch = nullptr;
+        unsigned int spriteVAO = 0;
+        if (useSpriteBatch)
+        {
+            spriteBatch = new KSpriteBatch();
+            spriteVAO = KVAOCache::get(KSpriteBatch::getLayout(), shader2D.getVertexProgram(), spriteBatch->getBuffer(), spriteBatch->getElementBuffer());
+            std::cout << "Sprite batch: " << (spriteBatch->isPersistent() ? "persistently mapped" : "mapped each frame") << std::endl;
+        }
+        GlyphText logGlyphText(logCells, bufferPool);
+        unsigned int logGlyphVAO = KVAOCache::get(GlyphText::getLayout(), textShader.getVertexProgram(), logGlyphText.getBuffer());
+        std::cout << "Stats text: " << stCells.x * stCells.y * (sizeof(float) * 16 + sizeof(unsigned int) * 6) <<
+            " bytes as a QuadGrid, at most " << stCells.x * stCells.y * sizeof(GlyphInstance) << " as glyph instances" << std::endl;
+
+        // With compute shaders, the cube matrices and the stats text UVs are
+        // generated on the GPU instead
+        bool gpuPasses = KShaderProgram::isComputeSupported();
+        KShaderProgram* cubePass = nullptr;
+        KShaderProgram* textUvPass = nullptr;
+        KProgramPipeline* instancedShader = nullptr;
+        // The instanced cubes take turns with the textures in this, through
+        // uniform buffer binding 2. A texture array needs a unit of its own.
+        KTextureTable* cubeTable = nullptr;
+        const int cubeTableUnit = 3;
+        unsigned int cubeCount = sizeof(cubePositions) / sizeof(cubePositions[0]);
+        unsigned int gpuData[] = {0, 0, 0};
+        unsigned int &cubePosSSBO = gpuData[0];
+        unsigned int &cubeModelSSBO = gpuData[1];
+        unsigned int &stCellSSBO = gpuData[2];
+        if (gpuPasses)
+        {
+            cubePass = new KShaderProgram({{"cubes.cp", GL_COMPUTE_SHADER}});
+            textUvPass = new KShaderProgram({{"textuv.cp", GL_COMPUTE_SHADER}});
+            cubeTable = new KTextureTable(2);
+            instancedShader = new KProgramPipeline("tut6inst.vp", cubeTable->isBindless() ? "tut6bindless.fp" : "tut6array.fp");
+            // Same textures as the other cubes, so with bindless handles these
+            // are the async loads above
+            bool tableFilled = cubeTable->add("dirbri18.png", textureOptions) >= 0 &&
+                cubeTable->add("awesomeface.png", textureOptions) >= 0 && cubeTable->build();
+            gpuPasses = cubePass->isUsable() && textUvPass->isUsable() && instancedShader->isUsable() && tableFilled;
+        }
+        if (gpuPasses)
+        {
+            glGenBuffers(3, gpuData);
+            // std430 pads vec3 array elements to vec4
+            float cubePosData[sizeof(cubePositions) / sizeof(cubePositions[0])][4];
+            for (unsigned int i = 0; i < cubeCount; i++)
+            {
+                cubePosData[i][0] = cubePositions[i].x;
+                cubePosData[i][1] = cubePositions[i].y;
+                cubePosData[i][2] = cubePositions[i].z;
+                cubePosData[i][3] = 1.;
+            }
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, cubePosSSBO);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(cubePosData), cubePosData, GL_STATIC_DRAW);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, cubeModelSSBO);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, cubeCount * sizeof(float) * 16, nullptr, GL_DYNAMIC_COPY);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, stCellSSBO);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, stTextGrid.getCellBytes(), nullptr, GL_DYNAMIC_DRAW);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+            // These don't change
+            cubePass->use();
+            cubePass->setUniform("cubeCount", cubeCount);
+            textUvPass->use();
+            textUvPass->setUniform("cellCount", stQuad.rows * stQuad.cols);
+            textUvPass->setUniform("fontColumns", fontTexture.getGridSize().x);
+            textUvPass->setUniform("cellUv", fontTexture.getCellUv().x, fontTexture.getCellUv().y);
+        }
+#ifdef CUBES
+        // Same attribute interface as tut6.vp, so this is the same VAO
+        unsigned int instancedVAO = gpuPasses ? KVAOCache::get(cubeLayout, instancedShader->getVertexProgram(), VBO) : 0;
+#endif
+        float textScale = sdfFontTexture ? sdfTextScale : 1;
+        // Size of a text cell on screen, in pixels
+        float textCellWidth = glyphCache ? glyphCache->getCellWidth() : fontTexture.getCellSize().x * textScale;
+        float textCellHeight = glyphCache ? glyphCache->getCellHeight() : fontTexture.getCellSize().y * textScale;
+        // The part of the stats which fits in the window. stText is always
+        // laid out whole, and cut off by the grids it's drawn on.
+        vector2<unsigned int> stShownCells = stCells;
 #endif
         float xOffset = 0.;
         float yOffset = 0.;
@@ -448,12 +894,17 @@ int main(int argc, char** argv) {
         bool active = true;
         tickParam ticker = { 0 };
         SDL_TimerID tickerId = SDL_AddTimer(30, tickCallback, &ticker);
+        // The setup code above binds things without going through KGLState
+        KGLState::invalidate();
         // Render loop - do not quit until I quit
         while (active)
         {
 #ifdef GL
+            KGLState::beginFrame();
+            // Finished decodes get a couple of ms per frame for uploading
+            KTextureManager::processUploads(2.0);
             // Handle input
-            glViewport(0, 0, screenWidth, screenHeight);
+            KGLState::viewport(0, 0, screenWidth, screenHeight);
 
             // Clear screen
             glClearColor(0.0, 0.75, 1.0, 1.0);
@@ -469,90 +920,272 @@ int main(int argc, char** argv) {
             glm::mat4 projection(1.);
             projection = glm::perspective(glm::radians(fov), ((float)screenWidth * aspXfactor) / ((float)screenHeight * aspYfactor), 0.1f, 100.f);
 
-            // Use shader program
-            theShader.use();
-            theShader.setUniform("ourTexture", 0);
-            theShader.setUniform("gratexture", 1);
-            theShader.setUniform("view", view);
-            theShader.setUniform("projection", projection);
-
-            glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, texture);
-            glActiveTexture(GL_TEXTURE1);
-            glBindTexture(GL_TEXTURE_2D, otherTex);
-            glBindVertexArray(VAO);
-            glBindBuffer(GL_ARRAY_BUFFER, VBO);
-            // FINALLY DRAW THAT SHITE
-            for (int i = 0; i < 10; i++)
+            KGLState::polygonMode(GL_FILL);
+            KGLState::bindTexture(GL_TEXTURE0, GL_TEXTURE_2D, texture.getId());
+            KGLState::bindTexture(GL_TEXTURE1, GL_TEXTURE_2D, otherTex.getId());
+            unsigned int cubeVertexCount = sizeof(vertices) / (sizeof(float) * 5);
+            if (gpuPasses)
             {
-                // Object-local to global space
-                glm::mat4 model(1.);
-                model = glm::translate(model, cubePositions[i]);
-                float angle = glm::radians(20.0f * i);
-                if (i % 3 == 0)
+                // Build the model matrices, then draw every cube at once
+                cubePass->use();
+                cubePass->setUniform("spin", ticker.tick * .05f);
+                KGLState::bindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, cubePosSSBO);
+                KGLState::bindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, cubeModelSSBO);
+                cubePass->dispatch(cubeCount);
+                glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+                // Every cube is drawn, so every texture is needed
+                cubeTable->useAll();
+                cubeTable->update();
+                instancedShader->use();
+                if (!cubeTable->isBindless())
                 {
-                    angle += ticker.tick * .05;
+                    KGLState::bindTexture(GL_TEXTURE0 + cubeTableUnit, GL_TEXTURE_2D_ARRAY, cubeTable->getArrayTexture());
+                    instancedShader->setUniform("textureArray", cubeTableUnit);
+                }
+                instancedShader->setUniform("textureCount", (int)cubeTable->getCount());
+                instancedShader->setUniform("view", view);
+                instancedShader->setUniform("projection", projection);
+                KGLState::bindVertexArray(instancedVAO);
+                glDrawArraysInstanced(GL_TRIANGLES, 0, cubeVertexCount, cubeCount);
+            }
+            else
+            {
+                // Use shader program
+                theShader.use();
+                theShader.setUniform("ourTexture", 0);
+                theShader.setUniform("gratexture", 1);
+                theShader.setUniform("view", view);
+                theShader.setUniform("projection", projection);
+
+                KGLState::bindVertexArray(VAO);
+                // FINALLY DRAW THAT SHITE
+                for (unsigned int i = 0; i < cubeCount; i++)
+                {
+                    // Object-local to global space
+                    glm::mat4 model(1.);
+                    model = glm::translate(model, cubePositions[i]);
+                    float angle = glm::radians(20.0f * i);
+                    if (i % 3 == 0)
+                    {
+                        angle += ticker.tick * .05;
+                    }
+                    model = glm::rotate(model, angle, glm::vec3(0.5f, 1.0f, 0.0f));
+                    theShader.setUniform("model", model);
+                    glDrawArrays(GL_TRIANGLES, 0, cubeVertexCount);
                 }
-                model = glm::rotate(model, angle, glm::vec3(0.5f, 1.0f, 0.0f));
-                theShader.setUniform("model", model);
-                glDrawArrays(GL_TRIANGLES, 0, sizeof(vertices) / sizeof(float));
             }
 #endif
-            shader2D.use();
-            int uv2ScaleLocation = shader2D.getUniformLocation("scale");
-            float uv2Scale[] = {
-                (float)controls->w / screenWidth,
-                (float)controls->h / screenHeight,
+            // The overlays are text.vp, a glyph instance per character.
+            // --sdf-text makes them bigger, from the distance field instead,
+            // --font draws them from the glyph cache, and --sprite-batch
+            // draws them as quads with everything else 2D.
+            const KGLState::FrameStats& glStats = KGLState::getLastFrameStats();
+            unsigned int textStats[] = {
+                instancedText ? stGlyphText.getChangedGlyphs() : stTextGrid.getChangedCells(),
+                instancedText ? stGlyphText.getUploadedBytes() : stTextGrid.getUploadedBytes(),
+                instancedText ? stGlyphText.getUploadCalls() : stTextGrid.getUploadCalls(),
             };
-            //uv2Scale[0] = 1;
-            //uv2Scale[1] = 1;
-            glUniform2fv(uv2ScaleLocation, 1, uv2Scale);
-            int uv2TranslateLocation = shader2D.getUniformLocation("translate");
-            float uv2Translate[] = {
-                -1 + uv2Scale[0],
-                1 - uv2Scale[1],
-            };
-            //uv2Translate[0] = 0;
-            //uv2Translate[1] = 0;
-            glUniform2fv(uv2TranslateLocation, 1, uv2Translate);
-            shader2D.setUniform("theTexture", 0);
-
-            glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, controlTexture);
-            glBindVertexArray(ctlVAO);
-            glBindBuffer(GL_ARRAY_BUFFER, ctlVBO);
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ctlEBO);
-            glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
-
-            shader2D.use();
-            std::sprintf(stText, stTextFmt, xOffset, yOffset, zOffset, fov, aspXfactor, aspYfactor, yaw, pitch);
-            drawTextOnQuadGrid(stText, fontTexture, stQuad);
-            glBindBuffer(GL_ARRAY_BUFFER, stUvVBO);
-            glBufferSubData(GL_ARRAY_BUFFER, 0, stQuad.rows * stQuad.cols * sizeof(unsigned int) * 6, stQuad.uv);
-
-            uv2Scale[0] = (float)(stCells.x * fontTexture.getCellSize().x) / screenWidth;
-            uv2Scale[1] = (float)(stCells.y * fontTexture.getCellSize().y) / screenHeight;
-            glUniform2fv(uv2ScaleLocation, 1, uv2Scale);
-            uv2Translate[0] = 1 - uv2Scale[0] * 2;
-            uv2Translate[1] = 1 - uv2Scale[1] * 2;
-            glUniform2fv(uv2TranslateLocation, 1, uv2Translate);
-
-            glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-            glActiveTexture(GL_TEXTURE1);
-            glBindTexture(GL_TEXTURE_2D, fontTextureId);
-            shader2D.setUniform("theTexture", 1);
-            glBindVertexArray(stVAO);
-            glBindBuffer(GL_ARRAY_BUFFER, stPosVBO);
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, stEBO);
-            glDrawElements(GL_TRIANGLES, stQuad.rows * stQuad.cols * 6, GL_UNSIGNED_INT, 0);
+            if (spriteBatch)
+            {
+                // Every quad is written again each frame, in one go
+                textStats[0] = spriteBatch->getQuadCount();
+                textStats[1] = spriteBatch->getQuadCount() * 4 * sizeof(KSpriteVertex);
+                textStats[2] = spriteBatch->getQuadCount() > 0 ? 1 : 0;
+            }
+            // Numbers longer than the format's are cut off rather than
+            // overflowing stText
+            stWriter.clear();
+            stWriter.format(stTextFmt, xOffset, yOffset, zOffset, fov, aspXfactor, aspYfactor, yaw, pitch,
+                glStats.totalIssued(), glStats.totalElided(), textStats[0], textStats[1], textStats[2]);
+            if (logFile)
+            {
+                // Nothing but what was added since the last frame is read
+                char chunk[4096];
+                std::size_t read;
+                while ((read = std::fread(chunk, 1, sizeof(chunk), logFile)) > 0)
+                {
+                    logLayout.append(chunk, read);
+                }
+                std::clearerr(logFile);
+                std::size_t tail = logLayout.getTailLine(logCells.y);
+                logWriter.clear();
+                logLayout.writeLines(tail - std::min(logScroll, tail), logCells.y, logCells.x, logWriter);
+            }
+            KGLState::polygonMode(GL_FILL);
+            KGLState::bindTexture(GL_TEXTURE0 + overlayUnit, GL_TEXTURE_2D, overlayAtlas->getId());
+            if (spriteBatch)
+            {
+                // The controls in the top left corner and the stats in the
+                // top right, both from the overlay atlas, so one draw
+                spriteBatch->begin();
+                batchText(*spriteBatch, controlsText, fontTexture, fontUvRect, overlayAtlas->getId(), -1, 1,
+                    2.f * fontTexture.getCellSize().x / screenWidth, 2.f * fontTexture.getCellSize().y / screenHeight);
+                batchText(*spriteBatch, stText, fontTexture, fontUvRect, overlayAtlas->getId(),
+                    1 - 2.f * stCells.x * fontTexture.getCellSize().x / screenWidth, 1,
+                    2.f * fontTexture.getCellSize().x / screenWidth, 2.f * fontTexture.getCellSize().y / screenHeight);
+                if (logFile)
+                {
+                    batchText(*spriteBatch, logText, fontTexture, fontUvRect, overlayAtlas->getId(),
+                        -1, -1 + 2.f * logCells.y * fontTexture.getCellSize().y / screenHeight,
+                        2.f * fontTexture.getCellSize().x / screenWidth, 2.f * fontTexture.getCellSize().y / screenHeight);
+                }
+                shader2D.use();
+                shader2D.setUniform("theTexture", overlayUnit);
+                shader2D.setUniform("scale", 1.f, 1.f);
+                shader2D.setUniform("translate", 0.f, 0.f);
+                shader2D.setUniform("uvRect", 0.f, 0.f, 1.f, 1.f);
+                KGLState::bindVertexArray(spriteVAO);
+                spriteBatch->flush(GL_TEXTURE0 + overlayUnit);
+            }
+            else
+            {
+                textShader.use();
+                if (glyphCache)
+                {
+                    glyphCache->beginFrame();
+                    textShader.setUniform("theTexture", glyphCacheUnit);
+                    textShader.setUniform("textColor", 1.f, 1.f, 1.f, 1.f);
+                    textShader.setUniform("pageColumns", glyphCache->getPageColumns());
+                    textShader.setUniform("pageSlots", glyphCache->getPageSlots());
+                    textShader.setUniform("cellUv", glyphCache->getCellU(), glyphCache->getCellV());
+                    // Looked up every frame, so the cache doesn't give their
+                    // slots away, but only uploaded if that moved them
+                    ctlGlyphText.setText(controlsText, *glyphCache);
+                    ctlGlyphText.upload();
+                }
+                else if (sdfFontTexture)
+                {
+                    textShader.setUniform("uvRect", 0.f, 0.f, 1.f, 1.f);
+                    textShader.setUniform("theTexture", sdfUnit);
+                    textShader.setUniform("textColor", 1.f, 1.f, 1.f, 1.f);
+                    // The bitmap font's shadow is a texel down and right
+                    textShader.setUniform("shadowColor", 0.f, 0.f, 0.f, 1.f);
+                    textShader.setUniform("shadowOffset", 1.f / font->w, 1.f / font->h);
+                }
+                else
+                {
+                    textShader.setUniform("uvRect", fontUvRect[0], fontUvRect[1], fontUvRect[2], fontUvRect[3]);
+                    textShader.setUniform("theTexture", overlayUnit);
+                }
+                if (!glyphCache)
+                {
+                    textShader.setUniform("fontColumns", fontTexture.getGridSize().x);
+                    textShader.setUniform("cellUv", fontTexture.getCellUv().x, fontTexture.getCellUv().y);
+                }
+
+                // The controls, in the top left corner
+                float uv2Scale[] = {
+                    ctlCells.x * textCellWidth / screenWidth,
+                    ctlCells.y * textCellHeight / screenHeight,
+                };
+                float uv2Translate[] = {
+                    -1 + uv2Scale[0],
+                    1 - uv2Scale[1],
+                };
+                textShader.setUniform("scale", uv2Scale[0], uv2Scale[1]);
+                textShader.setUniform("translate", uv2Translate[0], uv2Translate[1]);
+                textShader.setUniform("gridSize", (float)ctlCells.x, (float)ctlCells.y);
+                KGLState::bindVertexArray(ctlGlyphVAO);
+                glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, ctlGlyphText.getCount());
+
+                // The log, in the bottom left corner
+                if (logFile)
+                {
+                    if (glyphCache)
+                    {
+                        logGlyphText.setText(logText, *glyphCache);
+                    }
+                    else
+                    {
+                        logGlyphText.setText(logText);
+                    }
+                    logGlyphText.upload();
+                    uv2Scale[0] = logCells.x * textCellWidth / screenWidth;
+                    uv2Scale[1] = logCells.y * textCellHeight / screenHeight;
+                    textShader.setUniform("scale", uv2Scale[0], uv2Scale[1]);
+                    textShader.setUniform("translate", -1 + uv2Scale[0], -1 + uv2Scale[1]);
+                    textShader.setUniform("gridSize", (float)logCells.x, (float)logCells.y);
+                    KGLState::bindVertexArray(logGlyphVAO);
+                    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, logGlyphText.getCount());
+                }
+
+                uv2Scale[0] = (float)(stShownCells.x * fontTexture.getCellSize().x) / screenWidth;
+                uv2Scale[1] = (float)(stShownCells.y * fontTexture.getCellSize().y) / screenHeight;
+                if (instancedText)
+                {
+                    // Usually only a few digits change, and then only their
+                    // instances are uploaded
+                    if (glyphCache)
+                    {
+                        stGlyphText.setText(stText, *glyphCache);
+                    }
+                    else
+                    {
+                        stGlyphText.setText(stText);
+                    }
+                    stGlyphText.upload();
+                    uv2Scale[0] = stShownCells.x * textCellWidth / screenWidth;
+                    uv2Scale[1] = stShownCells.y * textCellHeight / screenHeight;
+                    uv2Translate[0] = 1 - uv2Scale[0] * 2;
+                    uv2Translate[1] = 1 - uv2Scale[1] * 2;
+                    textShader.setUniform("scale", uv2Scale[0], uv2Scale[1]);
+                    textShader.setUniform("translate", uv2Translate[0], uv2Translate[1]);
+                    textShader.setUniform("gridSize", (float)stShownCells.x, (float)stShownCells.y);
+                    KGLState::bindVertexArray(stGlyphVAO);
+                    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, stGlyphText.getCount());
+                }
+                else
+                {
+                    uv2Translate[0] = 1 - uv2Scale[0] * 2;
+                    uv2Translate[1] = 1 - uv2Scale[1] * 2;
+                    shader2D.use();
+                    shader2D.setUniform("theTexture", overlayUnit);
+                    // Usually only a few digits change
+                    stTextGrid.setText(stText);
+                    if (gpuPasses)
+                    {
+                        // Upload one byte per cell instead of 8 floats, and only
+                        // redo the UVs if any changed
+                        if (stTextGrid.uploadCells(stCellSSBO))
+                        {
+                            KGLState::bindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, stCellSSBO);
+                            KGLState::bindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, stUvVBO.getId());
+                            textUvPass->dispatch(stQuad.rows * stQuad.cols);
+                            glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+                            shader2D.use();
+                        }
+                    }
+                    else
+                    {
+                        stTextGrid.uploadUvs(stUvVBO.getId());
+                    }
+                    shader2D.setUniform("scale", uv2Scale[0], uv2Scale[1]);
+                    shader2D.setUniform("translate", uv2Translate[0], uv2Translate[1]);
+                    shader2D.setUniform("uvRect", fontUvRect[0], fontUvRect[1], fontUvRect[2], fontUvRect[3]);
+                    KGLState::bindVertexArray(stVAO);
+                    glDrawElements(GL_TRIANGLES, stQuad.rows * stQuad.cols * 6, GL_UNSIGNED_INT, 0);
+                }
+            }
 #else
             SDL_Rect destRect { 0, 0, controls->w, controls->h };
             SDL_RenderCopy(renderer, controlTexture, nullptr, &destRect);
 #endif
             // Display rendered frame while waiting for the other frame to render
             SDL_GL_SwapWindow(window);
+            if (KGLTrace::isEnabled())
+            {
+                KGLTrace::endFrame();
+                if (traceFrames > 0)
+                {
+                    KGLTrace::dumpLastFrame(std::cout);
+                    if (--traceFrames == 0)
+                    {
+                        active = false;
+                        SDL_RemoveTimer(tickerId);
+                    }
+                }
+            }
             SDL_Event event;
             SDL_PollEvent(&event);
             if (event.type == SDL_WINDOWEVENT)
@@ -560,6 +1193,46 @@ int main(int argc, char** argv) {
                 if (event.window.event == SDL_WINDOWEVENT_RESIZED)
                 {
                     SDL_GetWindowSize(window, &screenWidth, &screenHeight);
+#ifdef GL
+                    // The text regions are cut down to what fits, or grow
+                    // back, with their buffers swapped through the pool
+                    vector2<unsigned int> stFit = instancedText ?
+                        fitTextGrid(stCells, screenWidth, screenHeight, textCellWidth, textCellHeight) :
+                        fitTextGrid(stCells, screenWidth, screenHeight, fontTexture.getCellSize().x, fontTexture.getCellSize().y);
+                    if (stFit.x != stShownCells.x || stFit.y != stShownCells.y)
+                    {
+                        stShownCells = stFit;
+                        if (instancedText)
+                        {
+                            stGlyphText.resize(stShownCells, bufferPool);
+                            stGlyphVAO = KVAOCache::get(GlyphText::getLayout(), textShader.getVertexProgram(), stGlyphText.getBuffer());
+                        }
+                        else
+                        {
+                            stQuad.resize(stShownCells.y, stShownCells.x);
+                            stTextGrid.resize();
+                            uploadQuadGrid(stQuad, bufferPool, stPosVBO, stUvVBO, stEBO);
+                            stStreams[0] = stPosVBO.getId();
+                            stStreams[1] = stUvVBO.getId();
+                            stVAO = KVAOCache::get(stLayout, shader2D.getVertexProgram(), stStreams, stEBO.getId());
+                            if (gpuPasses)
+                            {
+                                KGLState::bindBuffer(GL_SHADER_STORAGE_BUFFER, stCellSSBO);
+                                glBufferData(GL_SHADER_STORAGE_BUFFER, stTextGrid.getCellBytes(), nullptr, GL_DYNAMIC_DRAW);
+                                textUvPass->use();
+                                textUvPass->setUniform("cellCount", stQuad.rows * stQuad.cols);
+                            }
+                        }
+                    }
+                    vector2<unsigned int> logFit = fitTextGrid(logMaxCells, screenWidth, screenHeight, textCellWidth, textCellHeight);
+                    if (logFit.x != logCells.x || logFit.y != logCells.y)
+                    {
+                        logCells = logFit;
+                        logGlyphText.resize(logCells, bufferPool);
+                        logGlyphVAO = KVAOCache::get(GlyphText::getLayout(), textShader.getVertexProgram(), logGlyphText.getBuffer());
+                        logScroll = std::min(logScroll, logLayout.getTailLine(logCells.y));
+                    }
+#endif
                 }
                 if (event.window.event == SDL_WINDOWEVENT_CLOSE)
                 {
@@ -634,6 +1307,35 @@ int main(int argc, char** argv) {
                 {
                     yaw -= .03125;
                 }
+                if (event.key.keysym.sym == SDLK_F1)
+                {
+                    if (KGLTrace::isEnabled())
+                    {
+                        KGLTrace::disable();
+                    }
+                    else
+                    {
+                        KGLTrace::enable();
+                    }
+                }
+                if (event.key.keysym.sym == SDLK_F2 && KGLTrace::isEnabled())
+                {
+                    KGLTrace::dumpLastFrame(std::cout);
+                }
+#ifdef GL
+                if (event.key.keysym.sym == SDLK_PAGEUP)
+                {
+                    logScroll = std::min(logScroll + logCells.y, logLayout.getTailLine(logCells.y));
+                }
+                if (event.key.keysym.sym == SDLK_PAGEDOWN)
+                {
+                    logScroll -= std::min<std::size_t>(logScroll, logCells.y);
+                }
+                if (event.key.keysym.sym == SDLK_END)
+                {
+                    logScroll = 0;
+                }
+#endif
                 if (event.key.keysym.sym == SDLK_ESCAPE)
                 {
                     active = false;
@@ -642,19 +1344,54 @@ int main(int argc, char** argv) {
             }
         }
 #ifdef GL
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+        KGLState::bindVertexArray(0);
+        KGLState::bindBuffer(GL_ARRAY_BUFFER, 0);
+        KVAOCache::clear();
+        if (gpuPasses)
+        {
+            glDeleteBuffers(3, gpuData);
+        }
+        delete cubePass;
+        delete textUvPass;
+        delete instancedShader;
+        delete spriteBatch;
+        // Before the textures its handles are for
+        delete cubeTable;
+        std::cout << "Buffer pool: " << bufferPool.getHits() << " hits, " << bufferPool.getMisses() <<
+            " misses (" << bufferPool.getHitRate() * 100 << "% reused), " << bufferPool.getFreeCount() <<
+            " buffers free" << std::endl;
 #endif
     }
+#ifdef GL
+    delete overlayAtlas;
+    KGLState::forgetTexture(sdfFontTexture);
+    glDeleteTextures(1, &sdfFontTexture);
+    if (glyphCache)
+    {
+        std::cout << "Glyph cache: " << glyphCache->getPageCount() << " pages, " <<
+            glyphCache->getEvictions() << " glyphs evicted" << std::endl;
+    }
+    delete glyphCache;
+    if (logFile)
+    {
+        std::fclose(logFile);
+    }
+    delete[] logText;
+#endif
+#ifdef GL
+    // The pipelines are gone now, so the stages they shared can go too
+    KProgramPipeline::clearCache();
+    KTextureManager::stopWorkers();
+    texture.release();
+    otherTex.release();
+    KTextureManager::clear();
+#endif
 
     delete[] stText;
 #ifndef GL
     SDL_DestroyTexture(controlTexture);
 #else
     SDL_GL_DeleteContext(glcontext);
-    delete[] stQuad.pos;
-    delete[] stQuad.uv;
-    delete[] stQuad.el;
 #endif
     // Release all GLFW resources and exit
     if(sdlImage)
@@ -662,46 +1399,96 @@ int main(int argc, char** argv) {
         IMG_Quit();
     }
     SDL_FreeSurface(font);
+#ifndef GL
     SDL_FreeSurface(controls);
+#endif
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
     SDL_Quit();
     return 0;
 }
 
-unsigned int loadGLImage(const char* fname, bool makeMipmap, GLint textureUnit, GLint wrapMode, GLint magFilter, GLint minFilter)
+// How to upload an SDL pixel format as it is. SDL describes packed formats
+// by the value of a whole pixel, like GL's packed types, so these hold on
+// either endianness.
+struct SDLGLFormat
 {
-    // Load another texture
-    unsigned int imageId;
-    if (!sdlImage)
+    Uint32 sdlFormat;
+    GLint internalFormat;
+    GLenum format;
+    GLenum type;
+};
+
+static const SDLGLFormat sdlGLFormats[] =
+{
+    {SDL_PIXELFORMAT_RGB24, GL_RGB8, GL_RGB, GL_UNSIGNED_BYTE},
+    {SDL_PIXELFORMAT_BGR24, GL_RGB8, GL_BGR, GL_UNSIGNED_BYTE},
+    // ABGR8888 is RGBA32 on little endian machines, ARGB8888 is BGRA32
+    {SDL_PIXELFORMAT_ABGR8888, GL_RGBA8, GL_RGBA, GL_UNSIGNED_INT_8_8_8_8_REV},
+    {SDL_PIXELFORMAT_RGBA8888, GL_RGBA8, GL_RGBA, GL_UNSIGNED_INT_8_8_8_8},
+    {SDL_PIXELFORMAT_ARGB8888, GL_RGBA8, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV},
+    {SDL_PIXELFORMAT_BGRA8888, GL_RGBA8, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8},
+    // The unused byte goes in alpha, which an RGB texture throws away
+    {SDL_PIXELFORMAT_BGR888, GL_RGB8, GL_RGBA, GL_UNSIGNED_INT_8_8_8_8_REV},
+    {SDL_PIXELFORMAT_RGBX8888, GL_RGB8, GL_RGBA, GL_UNSIGNED_INT_8_8_8_8},
+    {SDL_PIXELFORMAT_RGB888, GL_RGB8, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV},
+    {SDL_PIXELFORMAT_BGRX8888, GL_RGB8, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8},
+    {SDL_PIXELFORMAT_RGB565, GL_RGB8, GL_RGB, GL_UNSIGNED_SHORT_5_6_5},
+    {SDL_PIXELFORMAT_BGR565, GL_RGB8, GL_RGB, GL_UNSIGNED_SHORT_5_6_5_REV},
+    {SDL_PIXELFORMAT_ARGB4444, GL_RGBA4, GL_BGRA, GL_UNSIGNED_SHORT_4_4_4_4_REV},
+    {SDL_PIXELFORMAT_ABGR4444, GL_RGBA4, GL_RGBA, GL_UNSIGNED_SHORT_4_4_4_4_REV},
+    {SDL_PIXELFORMAT_RGBA4444, GL_RGBA4, GL_RGBA, GL_UNSIGNED_SHORT_4_4_4_4},
+    {SDL_PIXELFORMAT_BGRA4444, GL_RGBA4, GL_BGRA, GL_UNSIGNED_SHORT_4_4_4_4},
+    {SDL_PIXELFORMAT_ARGB1555, GL_RGB5_A1, GL_BGRA, GL_UNSIGNED_SHORT_1_5_5_5_REV},
+    {SDL_PIXELFORMAT_ABGR1555, GL_RGB5_A1, GL_RGBA, GL_UNSIGNED_SHORT_1_5_5_5_REV},
+    // Indices, looked up in the palette by 2dpal.fp
+    {SDL_PIXELFORMAT_INDEX8, GL_R8, GL_RED, GL_UNSIGNED_BYTE}
+};
+
+static const SDLGLFormat* findSDLGLFormat(Uint32 sdlFormat)
+{
+    for (const SDLGLFormat& format : sdlGLFormats)
     {
-        sdlImage = IMG_Init(IMG_INIT_PNG) != 0;
-        if (!sdlImage)
+        if (format.sdlFormat == sdlFormat)
         {
-            IMG_Quit();
-            return 0;
+            return &format;
         }
     }
-    SDL_Surface* imgSurface = IMG_Load(fname);
-    if (imgSurface)
+    return nullptr;
+}
+
+// Upload with rows pitch bytes apart, straight from the surface
+static void uploadSurfacePixels(const SDL_Surface* surface, const SDLGLFormat& format)
+{
+    int bytesPerPixel = surface->format->BytesPerPixel;
+    // SDL pads rows to 4 bytes, but only the pitch says so
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    if (surface->pitch == surface->w * bytesPerPixel)
     {
-        imageId = SDLSurfaceToGLImage(imgSurface, makeMipmap, textureUnit, wrapMode, magFilter, minFilter);
-        SDL_FreeSurface(imgSurface);
-        return imageId;
+        // Goes through a pixel buffer, so the copy to the GPU doesn't stall
+        KTextureManager::getUploadRing()->upload(GL_TEXTURE_2D, 0, format.internalFormat, surface->w, surface->h, format.format, format.type, surface->pixels);
     }
-    std::cerr << "Failed to load " << fname << " for some reason!" << std::endl;
-    return 0;
+    else
+    {
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, surface->pitch / bytesPerPixel);
+        glTexImage2D(GL_TEXTURE_2D, 0, format.internalFormat, surface->w, surface->h, 0, format.format, format.type, surface->pixels);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 }
 
-unsigned int SDLSurfaceToGLImage(SDL_Surface*& surface, bool makeMipmap, GLint textureUnit, GLint wrapMode, GLint magFilter, GLint minFilter)
+unsigned int SDLSurfaceToGLImage(SDL_Surface*& surface, bool makeMipmap, GLint textureUnit, GLint wrapMode, GLint magFilter, GLint minFilter, unsigned int* paletteId)
 {
     unsigned int imageId;
     if (surface)
     {
-        // Convert surface pixel format to a format usable by OpenGL
-        if (surface->format->format != SDL_PIXELFORMAT_RGB24 &&
-            surface->format->format != SDL_PIXELFORMAT_RGBA32)
+        const SDLGLFormat* format = findSDLGLFormat(surface->format->format);
+        bool indexed = format && format->sdlFormat == SDL_PIXELFORMAT_INDEX8;
+        // Only the caller knows whether it can draw with a palette. Pitches
+        // which aren't whole pixels can't be described with a row length.
+        if (!format || (indexed && !paletteId) || surface->pitch % surface->format->BytesPerPixel != 0)
         {
+            // Convert surface pixel format to a format usable by OpenGL
             unsigned int newPixelFormat = 0;
             if (SDL_ISPIXELFORMAT_ALPHA(surface->format->format))
             {
@@ -711,41 +1498,50 @@ unsigned int SDLSurfaceToGLImage(SDL_Surface*& surface, bool makeMipmap, GLint t
             {
                 newPixelFormat = SDL_PIXELFORMAT_RGB24;
             }
-            if (surface->format->format != newPixelFormat)
+            SDL_Surface* newSurface = SDL_ConvertSurfaceFormat(surface, newPixelFormat, 0);
+            if (newSurface == NULL)
             {
-                SDL_Surface* newSurface = SDL_ConvertSurfaceFormat(surface, newPixelFormat, 0);
-                if (newSurface == NULL)
-                {
-                    std::cerr << "Failed to convert the surface for some reason:" << std::endl <<
-                        SDL_GetError() << std::endl;
-                    return 0;
-                }
-                else
-                {
-                    SDL_FreeSurface(surface);
-                    surface = newSurface;
-                }
+                std::cerr << "Failed to convert the surface for some reason:" << std::endl <<
+                    SDL_GetError() << std::endl;
+                return 0;
+            }
+            else
+            {
+                SDL_FreeSurface(surface);
+                surface = newSurface;
             }
+            format = findSDLGLFormat(newPixelFormat);
+            indexed = false;
         }
-        // Create GL texture
-        glGenTextures(1, &imageId);
-        glActiveTexture(textureUnit);
-        glBindTexture(GL_TEXTURE_2D, imageId);
-        // Upload to GPU, set parameters, and generate mipmaps (lower res versions of the texture)
-        int texFormat = surface->format->format == SDL_PIXELFORMAT_RGB24 ? GL_RGB : GL_RGBA;
-        /*
-        std::cout << "texFormat is ";
-        if (texFormat == GL_RGB)
+        if (indexed)
         {
-            std::cout << "GL_RGB";
+            // Blending indices makes no sense, so no filtering and no mipmaps
+            makeMipmap = false;
+            magFilter = GL_NEAREST;
+            minFilter = GL_NEAREST;
+
+            SDL_Palette* palette = surface->format->palette;
+            SDL_Color colours[256] = {};
+            std::memcpy(colours, palette->colors, std::min(palette->ncolors, 256) * sizeof(SDL_Color));
+            glGenTextures(1, paletteId);
+            KGLState::bindTexture(textureUnit, GL_TEXTURE_2D, *paletteId);
+            // SDL_Color is 4 bytes, in RGBA order
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 256, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, colours);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
         }
-        else
+        else if (paletteId)
         {
-            std::cout << "GL_RGBA";
+            *paletteId = 0;
         }
-        */
-        std::cout << std::endl;
-        glTexImage2D(GL_TEXTURE_2D, 0, texFormat, surface->w, surface->h, 0, texFormat, GL_UNSIGNED_BYTE, surface->pixels);
+        // Create GL texture
+        glGenTextures(1, &imageId);
+        KGLState::bindTexture(textureUnit, GL_TEXTURE_2D, imageId);
+        // Upload to GPU, set parameters, and generate mipmaps (lower res versions of the texture)
+        SDL_LockSurface(surface);
+        uploadSurfacePixels(surface, *format);
+        SDL_UnlockSurface(surface);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrapMode);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrapMode);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minFilter);
@@ -754,8 +1550,12 @@ unsigned int SDLSurfaceToGLImage(SDL_Surface*& surface, bool makeMipmap, GLint t
         {
             glGenerateMipmap(GL_TEXTURE_2D);
         }
+        else
+        {
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+        }
         // Release bindings
-        glBindTexture(GL_TEXTURE_2D, 0);
+        KGLState::bindTexture(textureUnit, GL_TEXTURE_2D, 0);
     }
     else
     {
@@ -764,6 +1564,65 @@ unsigned int SDLSurfaceToGLImage(SDL_Surface*& surface, bool makeMipmap, GLint t
     return imageId;
 }
 
+int addSurfaceToAtlas(KTextureAtlas& atlas, const char* name, SDL_Surface* surface)
+{
+    SDL_Surface* rgba = surface;
+    if (surface->format->format != SDL_PIXELFORMAT_RGBA32)
+    {
+        rgba = SDL_ConvertSurfaceFormat(surface, SDL_PIXELFORMAT_RGBA32, 0);
+        if (rgba == nullptr)
+        {
+            std::cerr << "Failed to convert the surface for some reason:" << std::endl <<
+                SDL_GetError() << std::endl;
+            return -1;
+        }
+    }
+    SDL_LockSurface(rgba);
+    int region = atlas.add(name, (const unsigned char*)rgba->pixels, rgba->w, rgba->h, 4, rgba->pitch);
+    SDL_UnlockSurface(rgba);
+    if (rgba != surface)
+    {
+        SDL_FreeSurface(rgba);
+    }
+    return region;
+}
+
+unsigned int makeDistanceFieldFont(SDL_Surface* font, vector2<unsigned int> cellSize, int scale, float spread, GLint textureUnit)
+{
+    SDL_Surface* rgba = font;
+    if (font->format->format != SDL_PIXELFORMAT_RGBA32)
+    {
+        rgba = SDL_ConvertSurfaceFormat(font, SDL_PIXELFORMAT_RGBA32, 0);
+        if (rgba == nullptr)
+        {
+            std::cerr << "Failed to convert the font for some reason:" << std::endl <<
+                SDL_GetError() << std::endl;
+            return 0;
+        }
+    }
+    KDistanceField field;
+    SDL_LockSurface(rgba);
+    field.generate((const unsigned char*)rgba->pixels, rgba->w, rgba->h, 4, rgba->pitch, 0, scale, spread, cellSize.x, cellSize.y);
+    SDL_UnlockSurface(rgba);
+    if (rgba != font)
+    {
+        SDL_FreeSurface(rgba);
+    }
+
+    unsigned int textureId;
+    glGenTextures(1, &textureId);
+    KGLState::bindTexture(textureUnit, GL_TEXTURE_2D, textureId);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, field.width, field.height, 0, GL_RED, GL_UNSIGNED_BYTE, field.pixels.data());
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glGenerateMipmap(GL_TEXTURE_2D);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    return textureId;
+}
+
 unsigned int tickCallback(unsigned int interval, void* param)
 {
     tickParam* ticker = (tickParam*)param;
@@ -776,10 +1635,14 @@ vector2<unsigned int> getTextGridSize(const char* text)
     vector2<unsigned int> gridSize {0, 0};
     unsigned int textIndex = 0;
     unsigned int linePos = 0;
-    // Assume null-terminated string
+    // Assume null-terminated string. A cell per UTF-8 code point, which is
+    // a cell per byte for ASCII.
     while (text[textIndex] != 0)
     {
-        linePos++;
+        if ((text[textIndex] & 0xC0) != 0x80)
+        {
+            linePos++;
+        }
         if (text[textIndex] == '\n')
         {
             gridSize.y++;
@@ -795,6 +1658,14 @@ vector2<unsigned int> getTextGridSize(const char* text)
     return gridSize;
 }
 
+vector2<unsigned int> fitTextGrid(vector2<unsigned int> cells, int screenWidth, int screenHeight, float cellWidth, float cellHeight)
+{
+    vector2<unsigned int> fit;
+    fit.x = std::max(1u, std::min(cells.x, (unsigned int)(screenWidth / cellWidth)));
+    fit.y = std::max(1u, std::min(cells.y, (unsigned int)(screenHeight / cellHeight)));
+    return fit;
+}
+
 SDL_Surface* drawTextToSurface(const char* text, SDL_Surface* font, int cellSizeX, int cellSizeY)
 {
     vector2<unsigned int> gridSize = getTextGridSize(text);
@@ -844,62 +1715,295 @@ SDL_Surface* drawTextToSurface(const char* text, SDL_Surface* font, int cellSize
 
 void drawTextOnQuadGrid(const char* text, const FontTexture& fontexture, QuadGrid& grid)
 {
-    // 0   1
-    // +---+
-    // |  /|
-    // | / |
-    // |/  |
-    // +---+
-    // 2   3
-    // 0 1 2 1 2 3
-    float xFactor[] = { 0.0, 1.0, 0.0, 1.0 };
-    float yFactor[] = { 0.0, 0.0, 1.0, 1.0 };
-    unsigned int row = 0, col = 0, textIndex = 0;
-    bool onText = true;
-    char curChar = text[textIndex];
-    vector2<float> cellUv = fontexture.getCellUv();
-    while (curChar != 0)
+    const char* line = text;
+    for (unsigned int row = 0; row < grid.rows && *line != 0; row++)
     {
-        /*
-        if (onText)
+        // Laid out like packTextGrid: the newline takes no cell, lines
+        // longer than the grid are cut off, and the cells after shorter ones
+        // are left empty.
+        const char* newline = std::strchr(line, '\n');
+        unsigned int length = newline ? newline - line : std::strlen(line);
+        unsigned int drawn = std::min(length, grid.cols);
+        float* uv = grid.uv.data() + row * grid.cols * 8;
+        fontexture.uvQuadsForText(line, drawn, uv);
+        std::fill(uv + drawn * 8, uv + grid.cols * 8, 0.f);
+        line += newline ? length + 1 : length;
+    }
+}
+
+void uploadQuadGrid(const QuadGrid& grid, KBufferPool& pool, KPooledBuffer& pos, KPooledBuffer& uv, KPooledBuffer& el)
+{
+    pos.release();
+    uv.release();
+    el.release();
+    std::size_t vertexBytes = grid.pos.size() * sizeof(float);
+    std::size_t elementBytes = grid.el.size() * sizeof(unsigned int);
+    pos = pool.acquire(vertexBytes, GL_STATIC_DRAW);
+    // The UVs change with the text
+    uv = pool.acquire(vertexBytes, GL_STREAM_DRAW);
+    el = pool.acquire(elementBytes, GL_STATIC_DRAW);
+    KGLState::bindBuffer(GL_COPY_WRITE_BUFFER, pos.getId());
+    glBufferSubData(GL_COPY_WRITE_BUFFER, 0, vertexBytes, grid.pos.data());
+    KGLState::bindBuffer(GL_COPY_WRITE_BUFFER, uv.getId());
+    glBufferSubData(GL_COPY_WRITE_BUFFER, 0, vertexBytes, grid.uv.data());
+    KGLState::bindBuffer(GL_COPY_WRITE_BUFFER, el.getId());
+    glBufferSubData(GL_COPY_WRITE_BUFFER, 0, elementBytes, grid.el.data());
+    KGLState::bindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void batchText(KSpriteBatch& batch, const char* text, const FontTexture& font, const float* uvRect, unsigned int texture,
+    float left, float top, float cellWidth, float cellHeight)
+{
+    unsigned int row = 0;
+    unsigned int col = 0;
+    for (const char* ch = text; *ch != '\0'; ch++)
+    {
+        if (*ch == '\n')
         {
-            std::printf("%hhu\n", curChar);
+            row++;
+            col = 0;
+            continue;
         }
-        */
-        vector2<float> uv = fontexture.uvForChar(curChar);
-        unsigned int previous = row * grid.cols * 4 + col * 4;
-        for (unsigned int current = 0; current < 4; current++)
+        if (*ch != ' ')
         {
-            unsigned int vertex = previous + current;
-            if (onText)
-            {
-                grid.uv[vertex * 2] = uv.x + cellUv.x * xFactor[current];
-                grid.uv[vertex * 2 + 1] = uv.y + cellUv.y * (1 - yFactor[current]);
-            }
-            else
+            // The font's UVs are in QuadGrid order already
+            const float* quad = font.getQuadUvs(*ch);
+            float x = left + col * cellWidth;
+            float y = top - (row + 1) * cellHeight;
+            KSpriteVertex corners[4];
+            for (unsigned int vertex = 0; vertex < 4; vertex++)
             {
-                grid.uv[vertex * 2] = 0.;
-                grid.uv[vertex * 2 + 1] = 0.;
+                corners[vertex].x = x + (vertex & 1) * cellWidth;
+                corners[vertex].y = y + (vertex >> 1) * cellHeight;
+                corners[vertex].u = uvRect[0] + quad[vertex * 2] * uvRect[2];
+                corners[vertex].v = uvRect[1] + quad[vertex * 2 + 1] * uvRect[3];
             }
+            batch.add(texture, corners);
         }
         col++;
-        if (curChar == '\n')
+    }
+}
+
+unsigned int TextGrid::setText(const char* text)
+{
+    packTextGrid(text, grid, newCells.data());
+    changedCells = 0;
+    for (unsigned int cell = 0; cell < dirty.size(); cell++)
+    {
+        if (first || newCells[cell] != cells[cell])
         {
-            onText = false;
+            cells[cell] = newCells[cell];
+            setCellUv(cell, cells[cell]);
+            dirty[cell] = true;
+            changedCells++;
         }
-        if (col == grid.cols)
+    }
+    first = false;
+    return changedCells;
+}
+
+GlyphText::GlyphText(vector2<unsigned int> gridSize, KBufferPool& pool) : gridSize(gridSize),
+    buffer(pool.acquire(gridSize.x * gridSize.y * sizeof(GlyphInstance), GL_DYNAMIC_DRAW)),
+    dirtyFirst(0), dirtyEnd(0), changedGlyphs(0), uploadedBytes(0), uploadCalls(0)
+{
+    glyphs.reserve(gridSize.x * gridSize.y);
+    newGlyphs.reserve(gridSize.x * gridSize.y);
+}
+
+void GlyphText::resize(vector2<unsigned int> gridSize, KBufferPool& pool)
+{
+    this->gridSize = gridSize;
+    std::size_t bytes = gridSize.x * gridSize.y * sizeof(GlyphInstance);
+    if (buffer.getCapacity() < bytes)
+    {
+        // Given back first, so the pool can hand it to someone else
+        buffer.release();
+        buffer = pool.acquire(bytes, GL_DYNAMIC_DRAW);
+    }
+    glyphs.clear();
+    glyphs.reserve(gridSize.x * gridSize.y);
+    newGlyphs.reserve(gridSize.x * gridSize.y);
+    dirtyFirst = 0;
+    dirtyEnd = 0;
+}
+
+KVertexLayout GlyphText::getLayout()
+{
+    KVertexLayout layout;
+    // Both per instance; the corners come from gl_VertexID
+    layout.add("aCell", 2, GL_UNSIGNED_SHORT, false, 0, 1).add("aGlyph", 1, GL_UNSIGNED_INT, false, 0, 1);
+    return layout;
+}
+
+unsigned int GlyphText::setText(const char* text)
+{
+    newGlyphs.clear();
+    unsigned int row = 0;
+    unsigned int col = 0;
+    for (const char* ch = text; *ch != '\0' && row < gridSize.y; ch++)
+    {
+        if (*ch == '\n')
         {
+            row++;
             col = 0;
+            continue;
+        }
+        if (col < gridSize.x && *ch != ' ')
+        {
+            GlyphInstance glyph = {(unsigned short)col, (unsigned short)row, (unsigned char)*ch};
+            newGlyphs.push_back(glyph);
+        }
+        col++;
+    }
+    return diffGlyphs();
+}
+
+unsigned int GlyphText::setText(const char* text, KGlyphCache& cache)
+{
+    newGlyphs.clear();
+    unsigned int row = 0;
+    unsigned int col = 0;
+    const char* ch = text;
+    while (*ch != '\0' && row < gridSize.y)
+    {
+        unsigned int codePoint = decodeUtf8(ch);
+        if (codePoint == '\n')
+        {
             row++;
-            while (curChar != '\n')
+            col = 0;
+            continue;
+        }
+        if (col < gridSize.x && codePoint != ' ')
+        {
+            GlyphInstance glyph = {(unsigned short)col, (unsigned short)row, cache.getSlot(codePoint)};
+            newGlyphs.push_back(glyph);
+        }
+        col++;
+    }
+    return diffGlyphs();
+}
+
+unsigned int GlyphText::diffGlyphs()
+{
+    // Compare with what's there. One range is enough, since the text mostly
+    // changes in a few places close together.
+    changedGlyphs = 0;
+    unsigned int first = newGlyphs.size();
+    unsigned int end = 0;
+    unsigned int common = std::min(glyphs.size(), newGlyphs.size());
+    for (unsigned int i = 0; i < common; i++)
+    {
+        if (std::memcmp(&glyphs[i], &newGlyphs[i], sizeof(GlyphInstance)) != 0)
+        {
+            first = std::min(first, i);
+            end = i + 1;
+            changedGlyphs++;
+        }
+    }
+    if (newGlyphs.size() > common)
+    {
+        first = std::min(first, common);
+        end = newGlyphs.size();
+        changedGlyphs += newGlyphs.size() - common;
+    }
+    if (first < end)
+    {
+        dirtyFirst = dirtyFirst < dirtyEnd ? std::min(dirtyFirst, first) : first;
+        dirtyEnd = std::max(dirtyEnd, end);
+    }
+    glyphs.swap(newGlyphs);
+    // Whatever was past the new end isn't drawn anyway
+    dirtyEnd = std::min(dirtyEnd, (unsigned int)glyphs.size());
+    return changedGlyphs;
+}
+
+void GlyphText::upload()
+{
+    uploadedBytes = 0;
+    uploadCalls = 0;
+    if (dirtyFirst < dirtyEnd)
+    {
+        uploadedBytes = (dirtyEnd - dirtyFirst) * sizeof(GlyphInstance);
+        uploadCalls = 1;
+        KGLState::bindBuffer(GL_ARRAY_BUFFER, buffer.getId());
+        glBufferSubData(GL_ARRAY_BUFFER, dirtyFirst * sizeof(GlyphInstance), uploadedBytes, &glyphs[dirtyFirst]);
+    }
+    dirtyFirst = 0;
+    dirtyEnd = 0;
+}
+
+void TextGrid::setCellUv(unsigned int cell, unsigned char ch)
+{
+    const float* quad = font.getQuadUvs(ch);
+    std::copy(quad, quad + 8, &grid.uv[cell * 8]);
+}
+
+void TextGrid::uploadDirty(unsigned int target, unsigned int buffer, const void* data, unsigned int bytesPerCell, unsigned int align)
+{
+    uploadedBytes = 0;
+    uploadCalls = 0;
+    unsigned int cellCount = dirty.size();
+    unsigned int bufferSize = ((cellCount * bytesPerCell + align - 1) / align) * align;
+    unsigned int cell = 0;
+    while (cell < cellCount)
+    {
+        if (!dirty[cell])
+        {
+            cell++;
+            continue;
+        }
+        // Extend the run over any gaps of up to MERGE_GAP clean cells
+        unsigned int end = cell + 1;
+        unsigned int gap = 0;
+        for (unsigned int next = end; next < cellCount && gap <= MERGE_GAP; next++)
+        {
+            if (dirty[next])
+            {
+                end = next + 1;
+                gap = 0;
+            }
+            else
             {
-                curChar = text[++textIndex];
+                gap++;
             }
-            onText = true;
         }
-        if (onText)
+        unsigned int offset = cell * bytesPerCell / align * align;
+        unsigned int size = std::min((end * bytesPerCell + align - 1) / align * align, bufferSize) - offset;
+        if (uploadCalls == 0)
         {
-            curChar = text[++textIndex];
+            KGLState::bindBuffer(target, buffer);
         }
+        glBufferSubData(target, offset, size, (const unsigned char*)data + offset);
+        uploadedBytes += size;
+        uploadCalls++;
+        std::fill(dirty.begin() + cell, dirty.begin() + end, false);
+        cell = end;
     }
-}
\ No newline at end of file
+}
+
+void packTextGrid(const char* text, const QuadGrid& grid, unsigned char* cells)
+{
+    unsigned int textIndex = 0;
+    for (unsigned int row = 0; row < grid.rows; row++)
+    {
+        unsigned int col = 0;
+        // Copy up to the end of the line, or as much of it as fits
+        while (text[textIndex] != 0 && text[textIndex] != '\n' && col < grid.cols)
+        {
+            cells[row * grid.cols + col++] = text[textIndex++];
+        }
+        for (; col < grid.cols; col++)
+        {
+            cells[row * grid.cols + col] = 0;
+        }
+        // Skip whatever didn't fit, and the line break itself
+        while (text[textIndex] != 0 && text[textIndex] != '\n')
+        {
+            textIndex++;
+        }
+        if (text[textIndex] == '\n')
+        {
+            textIndex++;
+        }
+    }
+}
@@ -0,0 +1,22 @@
+#version 430 core
+// tut6bindless.fp without bindless textures: the table's images are the
+// layers of one texture array
+in vec2 uv;
+flat in int material;
+out vec4 FragColor;
+
+layout (std140, binding = 2) uniform TextureTable
+{
+    // xy: bindless handle, z: array layer
+    uvec4 textureEntries[256];
+    // Where the image is in its layer
+    vec4 textureRects[256];
+};
+
+uniform sampler2DArray textureArray;
+
+void main()
+{
+    vec4 rect = textureRects[material];
+    FragColor = texture(textureArray, vec3(rect.xy + uv * rect.zw, textureEntries[material].z));
+}
@@ -0,0 +1,21 @@
+#version 430 core
+#extension GL_ARB_bindless_texture : require
+// Lets the handle differ between invocations of a draw
+#extension GL_NV_gpu_shader5 : require
+// Each cube's texture comes from the texture table, as a bindless handle
+in vec2 uv;
+flat in int material;
+out vec4 FragColor;
+
+layout (std140, binding = 2) uniform TextureTable
+{
+    // xy: bindless handle, z: array layer
+    uvec4 textureEntries[256];
+    // Where the image is in its layer
+    vec4 textureRects[256];
+};
+
+void main()
+{
+    FragColor = texture(sampler2D(textureEntries[material].xy), uv);
+}
@@ -0,0 +1,207 @@
+#include "glad.h"
+#include "uploadring.h"
+#include "glstate.h"
+#include <chrono>
+#include <cstring>
+
+KUploadRing::KUploadRing(unsigned int slotCount, std::size_t slotSize) :
+    slots(slotCount), slotSize(slotSize), next(0), bytesUploaded(0), fallbacks(0)
+{
+    for (Slot& slot : slots)
+    {
+        glGenBuffers(1, &slot.buffer);
+        KGLState::bindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, slotSize, nullptr, GL_STREAM_DRAW);
+        slot.fence = nullptr;
+        slot.mapped = nullptr;
+    }
+    // Anything bound here would turn other uploads' pointers into offsets
+    KGLState::bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+KUploadRing::~KUploadRing()
+{
+    for (Slot& slot : slots)
+    {
+        if (slot.fence)
+        {
+            glDeleteSync(slot.fence);
+        }
+        if (slot.mapped)
+        {
+            KGLState::bindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        }
+        KGLState::forgetBuffer(slot.buffer);
+        glDeleteBuffers(1, &slot.buffer);
+    }
+    KGLState::bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+std::size_t KUploadRing::formatSize(unsigned int format, unsigned int type)
+{
+    std::size_t components = 4;
+    switch (format)
+    {
+        case GL_RED:
+            components = 1;
+            break;
+        case GL_RG:
+            components = 2;
+            break;
+        case GL_RGB:
+        case GL_BGR:
+            components = 3;
+            break;
+    }
+    switch (type)
+    {
+        case GL_UNSIGNED_SHORT:
+        case GL_SHORT:
+        case GL_HALF_FLOAT:
+            return components * 2;
+        case GL_UNSIGNED_INT:
+        case GL_INT:
+        case GL_FLOAT:
+            return components * 4;
+        case GL_UNSIGNED_INT_8_8_8_8:
+        case GL_UNSIGNED_INT_8_8_8_8_REV:
+            return 4;
+        case GL_UNSIGNED_SHORT_5_6_5:
+        case GL_UNSIGNED_SHORT_5_6_5_REV:
+        case GL_UNSIGNED_SHORT_4_4_4_4:
+        case GL_UNSIGNED_SHORT_4_4_4_4_REV:
+        case GL_UNSIGNED_SHORT_1_5_5_5_REV:
+        case GL_UNSIGNED_SHORT_5_5_5_1:
+            return 2;
+    }
+    return components;
+}
+
+int KUploadRing::acquire(std::size_t size)
+{
+    if (size > slotSize)
+    {
+        return -1;
+    }
+    for (unsigned int tried = 0; tried < slots.size(); tried++)
+    {
+        unsigned int index = (next + tried) % slots.size();
+        Slot& slot = slots[index];
+        if (slot.mapped)
+        {
+            continue;
+        }
+        if (slot.fence)
+        {
+            GLenum status = glClientWaitSync(slot.fence, 0, 0);
+            if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            {
+                continue;
+            }
+            glDeleteSync(slot.fence);
+            slot.fence = nullptr;
+        }
+        KGLState::bindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+        slot.mapped = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, slotSize, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        KGLState::bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        if (slot.mapped == nullptr)
+        {
+            return -1;
+        }
+        next = (index + 1) % slots.size();
+        return index;
+    }
+    return -1;
+}
+
+void KUploadRing::texImage2D(int slot, unsigned int target, int level, int internalFormat, int width, int height, unsigned int format, unsigned int type)
+{
+    Slot& ringSlot = slots[slot];
+    KGLState::bindBuffer(GL_PIXEL_UNPACK_BUFFER, ringSlot.buffer);
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    ringSlot.mapped = nullptr;
+    // The pointer is an offset into the bound buffer
+    glTexImage2D(target, level, internalFormat, width, height, 0, format, type, nullptr);
+    KGLState::bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    ringSlot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    bytesUploaded += (unsigned long long)width * height * formatSize(format, type);
+}
+
+void KUploadRing::cancel(int slot)
+{
+    Slot& ringSlot = slots[slot];
+    KGLState::bindBuffer(GL_PIXEL_UNPACK_BUFFER, ringSlot.buffer);
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    KGLState::bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    ringSlot.mapped = nullptr;
+}
+
+void KUploadRing::upload(unsigned int target, int level, int internalFormat, int width, int height, unsigned int format, unsigned int type, const void* pixels)
+{
+    // Assumes tightly packed rows, as does everything which calls this
+    std::size_t size = (std::size_t)width * height * formatSize(format, type);
+    int slot = acquire(size);
+    if (slot < 0)
+    {
+        fallbacks++;
+        glTexImage2D(target, level, internalFormat, width, height, 0, format, type, pixels);
+        return;
+    }
+    std::memcpy(slots[slot].mapped, pixels, size);
+    texImage2D(slot, target, level, internalFormat, width, height, format, type);
+}
+
+void KUploadRing::benchmark(std::ostream& out, int width, int height, unsigned int count)
+{
+    std::size_t size = (std::size_t)width * height * 4;
+    std::vector<unsigned char> pixels(size);
+    for (std::size_t i = 0; i < size; i++)
+    {
+        pixels[i] = (unsigned char)(i * 31);
+    }
+    unsigned int textures[4];
+    glGenTextures(4, textures);
+    for (unsigned int texture : textures)
+    {
+        KGLState::bindTexture(GL_TEXTURE0, GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    }
+    glFinish();
+
+    KUploadRing ring(4, size);
+    double megabytes = (double)size * count / (1024.0 * 1024.0);
+    for (int pass = 0; pass < 2; pass++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        for (unsigned int i = 0; i < count; i++)
+        {
+            // Round robin over a few textures, so uploads don't all wait on
+            // the previous one
+            KGLState::bindTexture(GL_TEXTURE0, GL_TEXTURE_2D, textures[i % 4]);
+            if (pass == 0)
+            {
+                glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+            }
+            else
+            {
+                ring.upload(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+            }
+        }
+        glFinish();
+        std::chrono::duration<double> spent = std::chrono::steady_clock::now() - start;
+        out << (pass == 0 ? "Client memory: " : "PBO ring:      ") << megabytes / spent.count() << " MB/s";
+        if (pass == 1)
+        {
+            out << " (" << ring.getFallbacks() << " of " << count << " fell back to client memory)";
+        }
+        out << std::endl;
+    }
+
+    KGLState::bindTexture(GL_TEXTURE0, GL_TEXTURE_2D, 0);
+    for (unsigned int texture : textures)
+    {
+        KGLState::forgetTexture(texture);
+    }
+    glDeleteTextures(4, textures);
+}
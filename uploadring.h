@@ -0,0 +1,62 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <ostream>
+#include "glad.h"
+
+// A ring of pixel unpack buffers for streaming texture data to the GPU.
+//
+// A slot is mapped on the GL thread, written to from anywhere (e.g. an image
+// decoder on a worker thread), then unmapped and uploaded from on the GL
+// thread. The upload only copies from GPU-visible memory, so glTexImage2D
+// doesn't have to wait for it. Each slot gets a fence after its upload, and
+// isn't handed out again until the GPU is done with it.
+class KUploadRing
+{
+public:
+    KUploadRing(unsigned int slotCount, std::size_t slotSize);
+    ~KUploadRing();
+    KUploadRing(const KUploadRing&) = delete;
+    KUploadRing& operator= (const KUploadRing&) = delete;
+
+    std::size_t getSlotSize() const { return slotSize; }
+
+    // Map a free slot for writing. Returns -1 if the data won't fit, or every
+    // slot is mapped or still being read by the GPU. Never blocks.
+    int acquire(std::size_t size);
+    unsigned char* getPointer(int slot) const { return slots[slot].mapped; }
+    // Unmap the slot and upload from it to the texture bound to target on the
+    // active unit. The arguments are as for glTexImage2D, less the pointer.
+    void texImage2D(int slot, unsigned int target, int level, int internalFormat, int width, int height, unsigned int format, unsigned int type);
+    // Unmap the slot without uploading anything
+    void cancel(int slot);
+
+    // Copy the pixels into a slot and upload from there. Uploads straight
+    // from the pointer if no slot is free.
+    void upload(unsigned int target, int level, int internalFormat, int width, int height, unsigned int format, unsigned int type, const void* pixels);
+
+    unsigned long long getBytesUploaded() const { return bytesUploaded; }
+    unsigned int getFallbacks() const { return fallbacks; }
+
+    // Upload a width x height RGBA texture count times, straight from client
+    // memory and through a ring, and print the throughput of each in MB/s
+    static void benchmark(std::ostream& out, int width, int height, unsigned int count);
+
+    static std::size_t formatSize(unsigned int format, unsigned int type);
+
+private:
+    struct Slot
+    {
+        unsigned int buffer;
+        // Set after an upload, until the GPU has finished reading
+        GLsync fence;
+        // Non-null while mapped
+        unsigned char* mapped;
+    };
+    std::vector<Slot> slots;
+    std::size_t slotSize;
+    unsigned int next;
+    unsigned long long bytesUploaded;
+    unsigned int fallbacks;
+};
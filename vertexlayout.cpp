@@ -0,0 +1,278 @@
+#include "glad.h"
+#include "vertexlayout.h"
+#include "shader.h"
+#include "glstate.h"
+#include <iostream>
+#include <algorithm>
+
+std::unordered_map<std::string, KVAOCache::Entry> KVAOCache::vaos;
+unsigned int KVAOCache::hits = 0;
+unsigned int KVAOCache::misses = 0;
+
+// What a shader input type looks like from the vertex buffer's side
+struct KAttributeShape
+{
+    int components; // Per location
+    int locations; // Matrices take up one location per column
+    bool integer;
+};
+
+static bool attributeShape(unsigned int glslType, KAttributeShape& shape)
+{
+    shape.locations = 1;
+    shape.integer = false;
+    switch (glslType)
+    {
+        case GL_FLOAT:             shape.components = 1; return true;
+        case GL_FLOAT_VEC2:        shape.components = 2; return true;
+        case GL_FLOAT_VEC3:        shape.components = 3; return true;
+        case GL_FLOAT_VEC4:        shape.components = 4; return true;
+        case GL_FLOAT_MAT2:        shape.components = 2; shape.locations = 2; return true;
+        case GL_FLOAT_MAT3:        shape.components = 3; shape.locations = 3; return true;
+        case GL_FLOAT_MAT4:        shape.components = 4; shape.locations = 4; return true;
+        case GL_INT:
+        case GL_UNSIGNED_INT:      shape.components = 1; shape.integer = true; return true;
+        case GL_INT_VEC2:
+        case GL_UNSIGNED_INT_VEC2: shape.components = 2; shape.integer = true; return true;
+        case GL_INT_VEC3:
+        case GL_UNSIGNED_INT_VEC3: shape.components = 3; shape.integer = true; return true;
+        case GL_INT_VEC4:
+        case GL_UNSIGNED_INT_VEC4: shape.components = 4; shape.integer = true; return true;
+    }
+    return false;
+}
+
+unsigned int KVertexLayout::typeSize(unsigned int type)
+{
+    switch (type)
+    {
+        case GL_BYTE:
+        case GL_UNSIGNED_BYTE:
+            return 1;
+        case GL_SHORT:
+        case GL_UNSIGNED_SHORT:
+        case GL_HALF_FLOAT:
+            return 2;
+        case GL_INT:
+        case GL_UNSIGNED_INT:
+        case GL_FLOAT:
+            return 4;
+        case GL_DOUBLE:
+            return 8;
+    }
+    return 0;
+}
+
+KVertexLayout& KVertexLayout::add(const char* name, int components, unsigned int type, bool normalized, unsigned int stream, unsigned int divisor)
+{
+    if (stream >= MAX_STREAMS)
+    {
+        std::cerr << "Vertex attribute " << name << " is in stream " << stream << ", but only " << MAX_STREAMS << " are supported!" << std::endl;
+        return *this;
+    }
+    if (stream >= strides.size())
+    {
+        strides.resize(stream + 1, 0);
+    }
+    KVertexAttribute attribute;
+    attribute.name = name;
+    attribute.components = components;
+    attribute.type = type;
+    attribute.normalized = normalized;
+    attribute.stream = stream;
+    attribute.offset = strides[stream];
+    attribute.divisor = divisor;
+    attributes.push_back(attribute);
+    strides[stream] += components * typeSize(type);
+    updateSignature();
+    return *this;
+}
+
+void KVertexLayout::updateSignature()
+{
+    signature.clear();
+    for (const KVertexAttribute& attribute : attributes)
+    {
+        signature += attribute.name + ":" + std::to_string(attribute.components) + ":" +
+            std::to_string(attribute.type) + ":" + (attribute.normalized ? "n" : "u") + ":" +
+            std::to_string(attribute.stream) + ":" + std::to_string(attribute.offset) + ":" +
+            std::to_string(attribute.divisor) + ";";
+    }
+    for (unsigned int stride : strides)
+    {
+        signature += std::to_string(stride) + ",";
+    }
+}
+
+bool KVertexLayout::matchInputs(const KShaderProgram& program,
+    std::vector<std::pair<const KShaderAttribute*, const KVertexAttribute*>>* matched) const
+{
+    bool valid = true;
+    for (const KShaderAttribute& input : program.getAttributes())
+    {
+        const KVertexAttribute* attribute = nullptr;
+        for (const KVertexAttribute& candidate : attributes)
+        {
+            if (candidate.name == input.name)
+            {
+                attribute = &candidate;
+                break;
+            }
+        }
+        if (attribute == nullptr)
+        {
+            std::cerr << "Shader input " << input.name << " (location " << input.location << ") is not in the vertex layout!" << std::endl;
+            valid = false;
+            continue;
+        }
+        KAttributeShape shape;
+        if (!attributeShape(input.type, shape))
+        {
+            std::cerr << "Shader input " << input.name << " has an unsupported type (" << input.type << ")" << std::endl;
+            valid = false;
+            continue;
+        }
+        int expected = shape.components * shape.locations;
+        if (attribute->components != expected)
+        {
+            std::cerr << "Vertex attribute " << attribute->name << " has " << attribute->components <<
+                " components, but the shader expects " << expected << std::endl;
+            // Matrices can't be split into columns unless the sizes match.
+            // For vectors, GL fills in missing components with (0, 0, 0, 1),
+            // which is almost always a mistake, but not fatal.
+            if (shape.locations > 1)
+            {
+                valid = false;
+            }
+        }
+        bool integerData = attribute->type != GL_FLOAT && attribute->type != GL_HALF_FLOAT &&
+            attribute->type != GL_DOUBLE && !attribute->normalized;
+        if (shape.integer && !integerData)
+        {
+            std::cerr << "Shader input " << input.name << " is an integer, but the vertex attribute isn't!" << std::endl;
+            valid = false;
+        }
+        if (matched)
+        {
+            matched->push_back(std::make_pair(&input, attribute));
+        }
+    }
+    return valid;
+}
+
+bool KVertexLayout::validate(const KShaderProgram& program) const
+{
+    return matchInputs(program, nullptr);
+}
+
+unsigned int KVertexLayout::buildVAO(const KShaderProgram& program, const unsigned int* vbos, unsigned int ebo) const
+{
+    std::vector<std::pair<const KShaderAttribute*, const KVertexAttribute*>> matched;
+    if (!matchInputs(program, &matched))
+    {
+        return 0;
+    }
+    unsigned int vao;
+    glGenVertexArrays(1, &vao);
+    KGLState::bindVertexArray(vao);
+    for (const auto& pair : matched)
+    {
+        const KShaderAttribute* input = pair.first;
+        const KVertexAttribute* attribute = pair.second;
+        KAttributeShape shape;
+        attributeShape(input->type, shape);
+        KGLState::bindBuffer(GL_ARRAY_BUFFER, vbos[attribute->stream]);
+        // Matrices are fed one column per location
+        int components = attribute->components / shape.locations;
+        unsigned int columnSize = components * typeSize(attribute->type);
+        for (int column = 0; column < shape.locations; column++)
+        {
+            unsigned int location = input->location + column;
+            const void* offset = (const void*)(size_t)(attribute->offset + column * columnSize);
+            if (shape.integer)
+            {
+                glVertexAttribIPointer(location, components, attribute->type, strides[attribute->stream], offset);
+            }
+            else
+            {
+                glVertexAttribPointer(location, components, attribute->type, attribute->normalized ? GL_TRUE : GL_FALSE, strides[attribute->stream], offset);
+            }
+            glVertexAttribDivisor(location, attribute->divisor);
+            glEnableVertexAttribArray(location);
+        }
+    }
+    if (ebo != 0)
+    {
+        KGLState::bindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+    }
+    // Release bindings
+    KGLState::bindVertexArray(0);
+    KGLState::bindBuffer(GL_ARRAY_BUFFER, 0);
+    return vao;
+}
+
+unsigned int KVAOCache::get(const KVertexLayout& layout, const KShaderProgram& program, unsigned int vbo, unsigned int ebo)
+{
+    return get(layout, program, &vbo, ebo);
+}
+
+unsigned int KVAOCache::get(const KVertexLayout& layout, const KShaderProgram& program, const unsigned int* vbos, unsigned int ebo)
+{
+    // A VAO depends on the layout, the locations the program gives the
+    // attributes, and the buffers it points at.
+    std::string key = layout.getSignature() + "|" + program.getAttributeSignature() + "|";
+    Entry entry;
+    for (unsigned int stream = 0; stream < layout.getStreamCount(); stream++)
+    {
+        key += std::to_string(vbos[stream]) + ",";
+        entry.buffers.push_back(vbos[stream]);
+    }
+    key += std::to_string(ebo);
+    entry.buffers.push_back(ebo);
+
+    auto cached = vaos.find(key);
+    if (cached != vaos.end())
+    {
+        hits++;
+        return cached->second.vao;
+    }
+    misses++;
+    entry.vao = layout.buildVAO(program, vbos, ebo);
+    if (entry.vao != 0)
+    {
+        vaos.emplace(key, entry);
+    }
+    return entry.vao;
+}
+
+void KVAOCache::forgetBuffer(unsigned int buffer)
+{
+    if (buffer == 0)
+    {
+        return;
+    }
+    for (auto entry = vaos.begin(); entry != vaos.end();)
+    {
+        const std::vector<unsigned int>& buffers = entry->second.buffers;
+        if (std::find(buffers.begin(), buffers.end(), buffer) != buffers.end())
+        {
+            KGLState::forgetVertexArray(entry->second.vao);
+            glDeleteVertexArrays(1, &entry->second.vao);
+            entry = vaos.erase(entry);
+        }
+        else
+        {
+            entry++;
+        }
+    }
+}
+
+void KVAOCache::clear()
+{
+    for (auto& entry : vaos)
+    {
+        KGLState::forgetVertexArray(entry.second.vao);
+        glDeleteVertexArrays(1, &entry.second.vao);
+    }
+    vaos.clear();
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <utility>
+#include "glad.h"
+
+class KShaderProgram;
+struct KShaderAttribute;
+
+// Describes how vertex data is laid out in one or more vertex buffers.
+// Attributes are matched to shader inputs by name, so the locations come
+// from the program instead of being hardcoded.
+struct KVertexAttribute
+{
+    std::string name;
+    int components;
+    unsigned int type; // GL_FLOAT, GL_UNSIGNED_BYTE, etc.
+    bool normalized;
+    unsigned int stream; // Index of the vertex buffer the attribute is in
+    unsigned int offset;
+    unsigned int divisor; // 0 for per-vertex data, 1 for per-instance data
+};
+
+class KVertexLayout
+{
+protected:
+    std::vector<KVertexAttribute> attributes;
+    std::vector<unsigned int> strides;
+    std::string signature;
+
+    void updateSignature();
+    // Finds the layout's attribute for each of the program's inputs, and
+    // checks they fit. Prints what doesn't and returns false if the layout
+    // can't feed the program. matched gets the pairs, if it isn't null.
+    bool matchInputs(const KShaderProgram& program,
+        std::vector<std::pair<const KShaderAttribute*, const KVertexAttribute*>>* matched) const;
+public:
+    static const unsigned int MAX_STREAMS = 8;
+
+    // Attributes are packed in the order they are added
+    KVertexLayout& add(const char* name, int components, unsigned int type = GL_FLOAT,
+        bool normalized = false, unsigned int stream = 0, unsigned int divisor = 0);
+
+    // Check the layout against the program's active attributes. Prints what
+    // doesn't match and returns false if the layout can't feed the program.
+    bool validate(const KShaderProgram& program) const;
+
+    // Create a new VAO for the given buffers, one per stream
+    unsigned int buildVAO(const KShaderProgram& program, const unsigned int* vbos, unsigned int ebo = 0) const;
+
+    const std::vector<KVertexAttribute>& getAttributes() const { return attributes; }
+    unsigned int getStreamCount() const { return strides.size(); }
+    unsigned int getStride(unsigned int stream = 0) const { return stream < strides.size() ? strides[stream] : 0; }
+    const std::string& getSignature() const { return signature; }
+
+    static unsigned int typeSize(unsigned int type);
+};
+
+// VAOs created from layouts, shared between programs with the same attribute
+// interface
+class KVAOCache
+{
+protected:
+    struct Entry
+    {
+        unsigned int vao;
+        // The vertex buffers and element buffer it points at
+        std::vector<unsigned int> buffers;
+    };
+    static std::unordered_map<std::string, Entry> vaos;
+    static unsigned int hits;
+    static unsigned int misses;
+public:
+    static unsigned int get(const KVertexLayout& layout, const KShaderProgram& program, unsigned int vbo, unsigned int ebo = 0);
+    static unsigned int get(const KVertexLayout& layout, const KShaderProgram& program, const unsigned int* vbos, unsigned int ebo = 0);
+    // Delete the VAOs which point at buffer. Call it before deleting a buffer,
+    // since GL may give its name to a new one, which they'd then be used for.
+    static void forgetBuffer(unsigned int buffer);
+    // Delete all cached VAOs
+    static void clear();
+    static unsigned int getHits() { return hits; }
+    static unsigned int getMisses() { return misses; }
+};
@@ -0,0 +1,397 @@
+#include "glad.h"
+#include "virtualtexture.h"
+#include "glstate.h"
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstring>
+
+KVirtualTexture::KVirtualTexture(unsigned int cacheTiles) :
+    cacheTiles(cacheTiles), cacheTexture(0), pageTableTexture(0), feedbackFramebuffer(0), feedbackRenderbuffers{0, 0},
+    feedbackWidth(0), feedbackHeight(0), residentCount(0), frame(1), stats()
+{
+}
+
+KVirtualTexture::~KVirtualTexture()
+{
+    KGLState::forgetTexture(cacheTexture);
+    KGLState::forgetTexture(pageTableTexture);
+    glDeleteTextures(1, &cacheTexture);
+    glDeleteTextures(1, &pageTableTexture);
+    glDeleteFramebuffers(1, &feedbackFramebuffer);
+    glDeleteRenderbuffers(2, feedbackRenderbuffers);
+}
+
+bool KVirtualTexture::open(const char* path)
+{
+    if (cacheTexture != 0 || !file.open(path))
+    {
+        return false;
+    }
+    int maxSize;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+    int padded = file.getPaddedTileSize();
+    // Page table entries have a byte for each cache coordinate
+    if ((int)cacheTiles * padded > maxSize || cacheTiles > 256)
+    {
+        cacheTiles = std::min(maxSize / padded, 256);
+        std::cerr << "Virtual texture cache cut down to " << cacheTiles << "x" << cacheTiles << " tiles" << std::endl;
+    }
+    if (cacheTiles == 0)
+    {
+        std::cerr << path << " has tiles too big for a texture!" << std::endl;
+        return false;
+    }
+
+    glGenTextures(1, &cacheTexture);
+    KGLState::bindTexture(GL_TEXTURE0, GL_TEXTURE_2D, cacheTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, cacheTiles * padded, cacheTiles * padded, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    // The borders make linear filtering safe. There are no mip levels;
+    // coarser tiles do that job.
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+
+    glGenTextures(1, &pageTableTexture);
+    KGLState::bindTexture(GL_TEXTURE0, GL_TEXTURE_2D, pageTableTexture);
+    for (std::uint32_t level = 0; level < file.levels; level++)
+    {
+        std::uint32_t tiles = file.getTilesPerSide(level);
+        glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8UI, tiles, tiles, 0, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, nullptr);
+        pageLevels.emplace_back((std::size_t)tiles * tiles * 4);
+        pageDirty.push_back({{0, 0, tiles, tiles}, true});
+        levelStarts.push_back(file.getTileIndex(level, 0, 0));
+    }
+    // Integer textures can't be filtered
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, file.levels - 1);
+    KGLState::bindTexture(GL_TEXTURE0, GL_TEXTURE_2D, 0);
+
+    slots.assign(cacheTiles * cacheTiles, {-1, 0});
+    tileSlots.assign(file.getTileCount(), -1);
+    tileBuffer.resize(file.getTileBytes());
+
+    // The fallback for everything, for good
+    std::uint32_t last = file.levels - 1;
+    if (!load(file.getTileIndex(last, 0, 0), last, 0, 0, 0))
+    {
+        return false;
+    }
+    slots[0].lastUsed = ULLONG_MAX;
+    updatePageTable();
+    return true;
+}
+
+void KVirtualTexture::bind(int pageTableUnit, int cacheUnit) const
+{
+    KGLState::bindTexture(GL_TEXTURE0 + pageTableUnit, GL_TEXTURE_2D, pageTableTexture);
+    KGLState::bindTexture(GL_TEXTURE0 + cacheUnit, GL_TEXTURE_2D, cacheTexture);
+}
+
+void KVirtualTexture::beginFeedback(int width, int height)
+{
+    if (width != feedbackWidth || height != feedbackHeight)
+    {
+        if (feedbackFramebuffer == 0)
+        {
+            glGenFramebuffers(1, &feedbackFramebuffer);
+            glGenRenderbuffers(2, feedbackRenderbuffers);
+        }
+        glBindRenderbuffer(GL_RENDERBUFFER, feedbackRenderbuffers[0]);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA16UI, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, feedbackRenderbuffers[1]);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, feedbackFramebuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, feedbackRenderbuffers[0]);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, feedbackRenderbuffers[1]);
+        feedbackWidth = width;
+        feedbackHeight = height;
+        feedback.resize((std::size_t)width * height * 4);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, feedbackFramebuffer);
+    KGLState::viewport(0, 0, width, height);
+    const unsigned int nothing[] = {0, 0, 0, 0};
+    glClearBufferuiv(GL_COLOR, 0, nothing);
+    glClear(GL_DEPTH_BUFFER_BIT);
+}
+
+void KVirtualTexture::endFeedback()
+{
+    // Stalls until the feedback pass is drawn, but it's small. A pixel
+    // buffer read a frame later would hide that, at the cost of a frame of
+    // latency.
+    glReadPixels(0, 0, feedbackWidth, feedbackHeight, GL_RGBA_INTEGER, GL_UNSIGNED_SHORT, feedback.data());
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    addFeedback(feedback.data(), feedback.size() / 4);
+}
+
+void KVirtualTexture::addFeedback(const std::uint16_t* texels, std::size_t count)
+{
+    for (std::size_t i = 0; i < count; i++, texels += 4)
+    {
+        // Neighbouring pixels mostly want the same tile
+        if (texels[3] != 0 && (i == 0 || std::memcmp(texels, texels - 4, 3 * sizeof(std::uint16_t)) != 0))
+        {
+            request(texels[2], texels[0], texels[1]);
+        }
+    }
+}
+
+void KVirtualTexture::request(unsigned int level, unsigned int x, unsigned int y)
+{
+    if (level >= file.levels || x >= file.getTilesPerSide(level) || y >= file.getTilesPerSide(level))
+    {
+        return;
+    }
+    for (; level < file.levels; level++, x /= 2, y /= 2)
+    {
+        std::uint32_t index = levelStarts[level] + y * file.getTilesPerSide(level) + x;
+        if (!requested.insert(index).second)
+        {
+            // So are its ancestors
+            return;
+        }
+        requests.push_back(index);
+    }
+}
+
+void KVirtualTexture::locate(std::uint32_t index, std::uint32_t& level, std::uint32_t& x, std::uint32_t& y) const
+{
+    level = std::upper_bound(levelStarts.begin(), levelStarts.end(), index) - levelStarts.begin() - 1;
+    std::uint32_t inLevel = index - levelStarts[level];
+    x = inLevel % file.getTilesPerSide(level);
+    y = inLevel / file.getTilesPerSide(level);
+}
+
+int KVirtualTexture::findSlot()
+{
+    int best = -1;
+    for (std::size_t i = 0; i < slots.size(); i++)
+    {
+        if (slots[i].tile < 0)
+        {
+            return i;
+        }
+        if (slots[i].lastUsed < frame && (best < 0 || slots[i].lastUsed < slots[best].lastUsed))
+        {
+            best = i;
+        }
+    }
+    return best;
+}
+
+bool KVirtualTexture::load(std::uint32_t index, std::uint32_t level, std::uint32_t x, std::uint32_t y, unsigned int slot)
+{
+    if (!file.readTile(index, tileBuffer.data()))
+    {
+        return false;
+    }
+    Slot& cacheSlot = slots[slot];
+    if (cacheSlot.tile >= 0)
+    {
+        std::uint32_t oldLevel, oldX, oldY;
+        locate(cacheSlot.tile, oldLevel, oldX, oldY);
+        tileSlots[cacheSlot.tile] = -1;
+        markDirty(oldLevel, oldX, oldY);
+        residentCount--;
+        stats.evictions++;
+    }
+    int padded = file.getPaddedTileSize();
+    KGLState::bindTexture(GL_TEXTURE0, GL_TEXTURE_2D, cacheTexture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, (slot % cacheTiles) * padded, (slot / cacheTiles) * padded, padded, padded, GL_RGBA, GL_UNSIGNED_BYTE, tileBuffer.data());
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    cacheSlot.tile = index;
+    cacheSlot.lastUsed = frame;
+    tileSlots[index] = slot;
+    markDirty(level, x, y);
+    residentCount++;
+    stats.loads++;
+    stats.bytesRead += tileBuffer.size();
+    return true;
+}
+
+void KVirtualTexture::update(unsigned int maxLoads)
+{
+    stats = Stats();
+    stats.requested = requests.size();
+    // Coarsest first. Tile indices go up with the level.
+    std::sort(requests.begin(), requests.end(), [](std::uint32_t a, std::uint32_t b) { return a > b; });
+    std::vector<std::uint32_t> missing;
+    for (std::uint32_t index : requests)
+    {
+        if (tileSlots[index] >= 0)
+        {
+            Slot& slot = slots[tileSlots[index]];
+            slot.lastUsed = std::max(slot.lastUsed, frame);
+            stats.hits++;
+        }
+        else if (file.isStored(index))
+        {
+            missing.push_back(index);
+        }
+    }
+    for (std::uint32_t index : missing)
+    {
+        int slot = stats.loads < maxLoads ? findSlot() : -1;
+        if (slot < 0)
+        {
+            stats.deferred++;
+            continue;
+        }
+        std::uint32_t level, x, y;
+        locate(index, level, x, y);
+        load(index, level, x, y, slot);
+    }
+    requests.clear();
+    requested.clear();
+    updatePageTable();
+    frame++;
+}
+
+void KVirtualTexture::markDirty(std::uint32_t level, std::uint32_t x, std::uint32_t y)
+{
+    // The tile covers 2^n x 2^n tiles n levels down
+    for (std::int32_t below = level; below >= 0; below--)
+    {
+        std::uint32_t shift = level - below;
+        std::uint32_t rect[4] = {x << shift, y << shift, (x + 1) << shift, (y + 1) << shift};
+        DirtyRect& dirty = pageDirty[below];
+        if (!dirty.dirty)
+        {
+            std::copy(rect, rect + 4, dirty.rect);
+            dirty.dirty = true;
+        }
+        else
+        {
+            dirty.rect[0] = std::min(dirty.rect[0], rect[0]);
+            dirty.rect[1] = std::min(dirty.rect[1], rect[1]);
+            dirty.rect[2] = std::max(dirty.rect[2], rect[2]);
+            dirty.rect[3] = std::max(dirty.rect[3], rect[3]);
+        }
+    }
+}
+
+void KVirtualTexture::updatePageTable()
+{
+    bool bound = false;
+    // Coarsest first, since each level falls back on the one above
+    for (std::int32_t level = file.levels - 1; level >= 0; level--)
+    {
+        DirtyRect& dirty = pageDirty[level];
+        if (!dirty.dirty)
+        {
+            continue;
+        }
+        std::uint32_t tiles = file.getTilesPerSide(level);
+        std::vector<unsigned char>& entries = pageLevels[level];
+        for (std::uint32_t y = dirty.rect[1]; y < dirty.rect[3]; y++)
+        {
+            for (std::uint32_t x = dirty.rect[0]; x < dirty.rect[2]; x++)
+            {
+                unsigned char* entry = &entries[(y * tiles + x) * 4];
+                std::int32_t slot = tileSlots[levelStarts[level] + y * tiles + x];
+                if (slot >= 0)
+                {
+                    entry[0] = slot % cacheTiles;
+                    entry[1] = slot / cacheTiles;
+                    entry[2] = level;
+                    entry[3] = 255;
+                }
+                else if (level + 1 < (std::int32_t)file.levels)
+                {
+                    std::uint32_t parentTiles = file.getTilesPerSide(level + 1);
+                    std::memcpy(entry, &pageLevels[level + 1][((y / 2) * parentTiles + x / 2) * 4], 4);
+                }
+            }
+        }
+        if (!bound)
+        {
+            KGLState::bindTexture(GL_TEXTURE0, GL_TEXTURE_2D, pageTableTexture);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            bound = true;
+        }
+        // Just the rectangle, out of the whole level
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, tiles);
+        glTexSubImage2D(GL_TEXTURE_2D, level, dirty.rect[0], dirty.rect[1], dirty.rect[2] - dirty.rect[0], dirty.rect[3] - dirty.rect[1],
+            GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, &entries[(dirty.rect[1] * tiles + dirty.rect[0]) * 4]);
+        dirty.dirty = false;
+    }
+    if (bound)
+    {
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    }
+}
+
+void KVirtualTexture::exercise(std::ostream& out, const char* path, unsigned int frames)
+{
+    // Room for what a screen needs, but not for the whole image, so flying
+    // around has to evict
+    KVirtualTexture texture;
+    if (!texture.open(path))
+    {
+        return;
+    }
+    const KVTexFile& file = texture.getFile();
+    // As if from a 32x32 feedback buffer for a 1024 pixel wide screen
+    const int samples = 32;
+    const double screenWidth = 1024.;
+    const double pi = 3.14159265358979;
+    std::vector<std::uint16_t> feedback(samples * samples * 4);
+    Stats total = Stats();
+    unsigned int worstDeferred = 0;
+    std::chrono::duration<double> spent(0);
+    for (unsigned int frame = 0; frame < frames; frame++)
+    {
+        // Circle the middle of the image while zooming in and out, from the
+        // whole image down to a twentieth of it across
+        double t = (double)frame / frames;
+        double centre[2] = {.5 + .3 * std::cos(2 * pi * t), .5 + .3 * std::sin(2 * pi * t)};
+        double view = .05 + .95 * (.5 + .5 * std::cos(6 * pi * t));
+        double texelsAcross = view * std::max(file.width, file.height);
+        int level = std::min(std::max((int)std::floor(std::log2(texelsAcross / screenWidth)), 0), (int)file.levels - 1);
+        double tiles = file.getTilesPerSide(level);
+        for (int y = 0; y < samples; y++)
+        {
+            for (int x = 0; x < samples; x++)
+            {
+                double u = centre[0] + ((x + .5) / samples - .5) * view;
+                double v = centre[1] + ((y + .5) / samples - .5) * view;
+                std::uint16_t* texel = &feedback[(y * samples + x) * 4];
+                bool inside = u >= 0. && u < 1. && v >= 0. && v < 1.;
+                texel[0] = inside ? (std::uint16_t)(u * file.width / file.getVirtualSize() * tiles) : 0;
+                texel[1] = inside ? (std::uint16_t)(v * file.height / file.getVirtualSize() * tiles) : 0;
+                texel[2] = level;
+                texel[3] = inside;
+            }
+        }
+        auto start = std::chrono::steady_clock::now();
+        texture.addFeedback(feedback.data(), samples * samples);
+        texture.update();
+        glFinish();
+        spent += std::chrono::steady_clock::now() - start;
+
+        const Stats& stats = texture.getStats();
+        total.requested += stats.requested;
+        total.hits += stats.hits;
+        total.loads += stats.loads;
+        total.evictions += stats.evictions;
+        total.deferred += stats.deferred;
+        total.bytesRead += stats.bytesRead;
+        worstDeferred = std::max(worstDeferred, stats.deferred);
+    }
+    out << path << ": " << file.width << "x" << file.height << ", " << file.levels << " levels, " <<
+        texture.cacheTiles * texture.cacheTiles << " cache slots" << std::endl;
+    out << frames << " frames: " << total.requested << " tile requests, " <<
+        (total.requested ? 100. * total.hits / total.requested : 0.) << "% hits, " <<
+        total.loads << " loads, " << total.evictions << " evictions, " <<
+        total.deferred << " deferred (at most " << worstDeferred << " in a frame)" << std::endl;
+    out << total.bytesRead / (1024. * 1024.) << " MB streamed, " << spent.count() * 1000. / std::max(frames, 1u) << " ms per update" << std::endl;
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <vector>
+#include <unordered_set>
+#include <ostream>
+#include <cstdint>
+#include "vtexfile.h"
+
+// Streams the tiles of a virtual texture (made by vtiler) from disk into a
+// cache texture as they're needed, so an image bigger than VRAM can be
+// drawn as long as what's on screen fits.
+//
+// - The cache is a GL_TEXTURE_2D with room for cacheTiles x cacheTiles
+//   bordered tiles.
+// - The page table is a GL_RGBA8UI texture with a texel per tile and a mip
+//   level per level of the virtual texture: the tile's x and y in the
+//   cache, and the level of the tile really there. Tiles which aren't
+//   loaded point at their nearest loaded ancestor, which is blurrier but
+//   there. The single tile of the last level is loaded by open() and never
+//   evicted, so there always is one.
+// - Feedback says which tiles to load. Draw whatever uses the texture with
+//   vtfeedback.fp between beginFeedback() and endFeedback(), which reads
+//   back the tile each pixel wanted. Or call addFeedback() or request()
+//   with tiles worked out some other way.
+// - update(), once per frame, loads requested tiles coarsest first, so
+//   fallbacks arrive before the detail, and once the cache is full evicts
+//   the tiles requested least recently.
+//
+// vt.fp samples the texture; setUniforms() binds and sets what it needs.
+class KVirtualTexture
+{
+public:
+    struct Stats
+    {
+        // Different tiles asked for, and of those, ones already loaded
+        unsigned int requested;
+        unsigned int hits;
+        unsigned int loads;
+        unsigned int evictions;
+        // Left for later frames: over the load budget, or no room in the
+        // cache without evicting something needed this frame
+        unsigned int deferred;
+        unsigned long long bytesRead;
+    };
+
+    explicit KVirtualTexture(unsigned int cacheTiles = 16);
+    ~KVirtualTexture();
+    KVirtualTexture(const KVirtualTexture&) = delete;
+    KVirtualTexture& operator= (const KVirtualTexture&) = delete;
+
+    // Reads the tile index and makes the textures. Prints what went wrong
+    // and returns false on failure.
+    bool open(const char* path);
+    const KVTexFile& getFile() const { return file; }
+
+    // Draw into a width x height feedback buffer between these. A buffer
+    // smaller than the screen is cheaper to read back and still sees most
+    // tiles; set vtfeedback.fp's feedbackBias to log2 of how much smaller.
+    // Leaves the default framebuffer bound, but not the viewport.
+    void beginFeedback(int width, int height);
+    void endFeedback();
+    // Texels as vtfeedback.fp writes them: tile x, y, level, and 0 where
+    // nothing was drawn
+    void addFeedback(const std::uint16_t* texels, std::size_t count);
+    // Also requests the tile's ancestors, so its fallbacks stay loaded
+    void request(unsigned int level, unsigned int x, unsigned int y);
+
+    // Loads at most maxLoads tiles, then updates the page table
+    void update(unsigned int maxLoads = 16);
+    // For the last update()
+    const Stats& getStats() const { return stats; }
+    unsigned int getResidentCount() const { return residentCount; }
+
+    // Bind the page table and cache to units (as numbers, not GL_TEXTUREn)
+    // and set vt.fp's uniforms. The program must be in use.
+    template <class Program>
+    void setUniforms(Program& program, int pageTableUnit, int cacheUnit) const
+    {
+        bind(pageTableUnit, cacheUnit);
+        program.setUniform("pageTable", pageTableUnit);
+        program.setUniform("tileCache", cacheUnit);
+        program.setUniform("levelCount", (int)file.levels);
+        program.setUniform("tileSize", (float)file.tileSize);
+        program.setUniform("tileBorder", (float)file.border);
+        program.setUniform("cacheScale", 1.f / (cacheTiles * file.getPaddedTileSize()));
+        program.setUniform("imageScale", (float)file.width / file.getVirtualSize(), (float)file.height / file.getVirtualSize());
+    }
+    void bind(int pageTableUnit, int cacheUnit) const;
+
+    // Fly over the virtual texture with synthetic feedback for frames
+    // frames, streaming tiles as they're needed, and print the cache stats.
+    // Needs a GL context, but draws nothing, so runs under a software
+    // driver without a display.
+    static void exercise(std::ostream& out, const char* path, unsigned int frames);
+
+private:
+    struct Slot
+    {
+        // -1 if free
+        std::int32_t tile;
+        unsigned long long lastUsed;
+    };
+    // The area of a page table level to rebuild, as x0, y0, x1, y1
+    struct DirtyRect
+    {
+        std::uint32_t rect[4];
+        bool dirty;
+    };
+
+    KVTexFile file;
+    unsigned int cacheTiles;
+    unsigned int cacheTexture;
+    unsigned int pageTableTexture;
+    unsigned int feedbackFramebuffer;
+    unsigned int feedbackRenderbuffers[2];
+    int feedbackWidth;
+    int feedbackHeight;
+    std::vector<std::uint16_t> feedback;
+
+    // Index of each level's first tile
+    std::vector<std::uint32_t> levelStarts;
+    std::vector<Slot> slots;
+    // Slot of each tile, or -1
+    std::vector<std::int32_t> tileSlots;
+    unsigned int residentCount;
+    // What the page table texture has, a vector per level
+    std::vector<std::vector<unsigned char> > pageLevels;
+    std::vector<DirtyRect> pageDirty;
+    std::vector<std::uint32_t> requests;
+    std::unordered_set<std::uint32_t> requested;
+    std::vector<unsigned char> tileBuffer;
+    unsigned long long frame;
+    Stats stats;
+
+    // Load the tile into the slot, evicting what was there
+    bool load(std::uint32_t index, std::uint32_t level, std::uint32_t x, std::uint32_t y, unsigned int slot);
+    // -1 if every slot was used this frame
+    int findSlot();
+    // The tile's entries, and those of everything below it, need redoing
+    void markDirty(std::uint32_t level, std::uint32_t x, std::uint32_t y);
+    void updatePageTable();
+    // Tile index to level, x and y
+    void locate(std::uint32_t index, std::uint32_t& level, std::uint32_t& x, std::uint32_t& y) const;
+};
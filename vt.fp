@@ -0,0 +1,39 @@
+#version 330 core
+// Samples a KVirtualTexture: finds the tile for the level wanted in the
+// page table, then where that tile is in the cache
+in vec2 uv;
+out vec4 FragColor;
+
+// x and y of the tile in the cache, and the level it's really from
+uniform usampler2D pageTable;
+uniform sampler2D tileCache;
+uniform int levelCount;
+uniform float tileSize;
+uniform float tileBorder;
+// 1 / the cache's size in texels
+uniform float cacheScale;
+// How much of the virtual texture, which is padded out to a square, the
+// image covers
+uniform vec2 imageScale;
+
+vec4 sampleVirtual(vec2 imageUv)
+{
+    vec2 virtualUv = clamp(imageUv, 0.0, 1.0) * imageScale;
+    vec2 texel = virtualUv * tileSize * float(1 << (levelCount - 1));
+    float lod = log2(max(length(dFdx(texel)), length(dFdy(texel))));
+    int level = min(int(max(lod, 0.0)), levelCount - 1);
+    int tiles = 1 << (levelCount - 1 - level);
+    uvec4 entry = texelFetch(pageTable, min(ivec2(virtualUv * float(tiles)), tiles - 1), level);
+
+    // The tile there may be from a coarser level
+    float entryTiles = float(1 << (levelCount - 1 - int(entry.b)));
+    vec2 inTiles = virtualUv * entryTiles;
+    vec2 inTile = inTiles - min(floor(inTiles), entryTiles - 1.0);
+    vec2 cacheTexel = vec2(entry.rg) * (tileSize + 2.0 * tileBorder) + tileBorder + inTile * tileSize;
+    return textureLod(tileCache, cacheTexel * cacheScale, 0.0);
+}
+
+void main()
+{
+    FragColor = sampleVirtual(uv);
+}
@@ -0,0 +1,143 @@
+#include "vtexfile.h"
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+
+static const char vtexIdentifier[8] = {'K', 'V', 'T', 'E', 'X', ' ', '1', '\n'};
+
+struct KVTexHeader
+{
+    std::uint32_t width;
+    std::uint32_t height;
+    std::uint32_t tileSize;
+    std::uint32_t border;
+    std::uint32_t levels;
+};
+
+std::uint32_t KVTexFile::levelsFor(std::uint32_t width, std::uint32_t height, std::uint32_t tileSize)
+{
+    std::uint32_t levels = 1;
+    while ((std::uint64_t)tileSize << (levels - 1) < std::max(width, height))
+    {
+        levels++;
+    }
+    return levels;
+}
+
+std::uint32_t KVTexFile::getTileCount() const
+{
+    // Each level has a quarter of the tiles of the one before
+    std::uint32_t count = 0;
+    for (std::uint32_t level = 0; level < levels; level++)
+    {
+        count += getTilesPerSide(level) * getTilesPerSide(level);
+    }
+    return count;
+}
+
+std::uint32_t KVTexFile::getTileIndex(std::uint32_t level, std::uint32_t x, std::uint32_t y) const
+{
+    std::uint32_t index = 0;
+    for (std::uint32_t i = 0; i < level; i++)
+    {
+        index += getTilesPerSide(i) * getTilesPerSide(i);
+    }
+    return index + y * getTilesPerSide(level) + x;
+}
+
+bool KVTexFile::open(const char* path)
+{
+    file.open(path, std::ios::in | std::ios::binary);
+    if (!file)
+    {
+        std::cerr << "Failed to open " << path << std::endl;
+        return false;
+    }
+    char identifier[sizeof(vtexIdentifier)];
+    KVTexHeader header;
+    file.read(identifier, sizeof(identifier));
+    file.read((char*)&header, sizeof(header));
+    if (!file || std::memcmp(identifier, vtexIdentifier, sizeof(identifier)) != 0)
+    {
+        std::cerr << path << " is not a virtual texture!" << std::endl;
+        return false;
+    }
+    if (header.tileSize == 0 || header.levels == 0 || header.levels > MAX_LEVELS)
+    {
+        std::cerr << path << " has a bad header!" << std::endl;
+        return false;
+    }
+    width = header.width;
+    height = header.height;
+    tileSize = header.tileSize;
+    border = header.border;
+    levels = header.levels;
+    offsets.resize(getTileCount());
+    file.read((char*)offsets.data(), offsets.size() * sizeof(std::uint64_t));
+    if (!file)
+    {
+        std::cerr << path << " is truncated!" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool KVTexFile::readTile(std::uint32_t index, unsigned char* pixels)
+{
+    if (offsets[index] == 0)
+    {
+        return false;
+    }
+    file.seekg(offsets[index]);
+    file.read((char*)pixels, getTileBytes());
+    if (!file)
+    {
+        std::cerr << "Failed to read tile " << index << " of a virtual texture" << std::endl;
+        file.clear();
+        return false;
+    }
+    return true;
+}
+
+bool KVTexFile::create(const char* path)
+{
+    file.open(path, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!file)
+    {
+        std::cerr << "Failed to open " << path << " for writing" << std::endl;
+        return false;
+    }
+    KVTexHeader header = {width, height, tileSize, border, levels};
+    file.write(vtexIdentifier, sizeof(vtexIdentifier));
+    file.write((const char*)&header, sizeof(header));
+    // Filled in by finish()
+    offsets.assign(getTileCount(), 0);
+    file.write((const char*)offsets.data(), offsets.size() * sizeof(std::uint64_t));
+    return (bool)file;
+}
+
+bool KVTexFile::writeTile(std::uint32_t index, const unsigned char* pixels)
+{
+    file.seekp(0, std::ios::end);
+    offsets[index] = file.tellp();
+    file.write((const char*)pixels, getTileBytes());
+    if (!file)
+    {
+        std::cerr << "Failed to write a virtual texture tile" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool KVTexFile::finish()
+{
+    file.seekp(sizeof(vtexIdentifier) + sizeof(KVTexHeader));
+    file.write((const char*)offsets.data(), offsets.size() * sizeof(std::uint64_t));
+    file.close();
+    if (file.fail())
+    {
+        std::cerr << "Failed to write a virtual texture" << std::endl;
+        return false;
+    }
+    return true;
+}
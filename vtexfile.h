@@ -0,0 +1,62 @@
+#pragma once
+
+#include <vector>
+#include <fstream>
+#include <cstdint>
+
+// A virtual texture cut into square tiles, each level of its mip chain
+// separately, made by vtiler. Tiles are RGBA, tileSize texels square plus
+// border texels copied from their neighbours on every side, so they can be
+// filtered without seams wherever they end up in the cache.
+//
+// The image is padded up to a square of tileSize << (levels - 1) texels,
+// so level n has exactly half the tiles of level n - 1 each way, and the
+// last level is a single tile. Tiles entirely in the padding aren't
+// stored.
+//
+// Layout: header, then one 64 bit offset per tile (0 if not stored), level
+// 0 first and row by row, then the tiles.
+//
+// Doesn't need GL, so the offline tools can use it too.
+class KVTexFile
+{
+public:
+    std::uint32_t width;
+    std::uint32_t height;
+    std::uint32_t tileSize;
+    std::uint32_t border;
+    std::uint32_t levels;
+
+    // Past this the tile index alone would be gigabytes. 12 levels of 120
+    // texel tiles is still 245760 texels square.
+    static const std::uint32_t MAX_LEVELS = 12;
+
+    KVTexFile() : width(0), height(0), tileSize(0), border(0), levels(0) {}
+
+    // Levels needed to fit the image in tiles of tileSize
+    static std::uint32_t levelsFor(std::uint32_t width, std::uint32_t height, std::uint32_t tileSize);
+
+    std::uint32_t getTilesPerSide(std::uint32_t level) const { return 1u << (levels - 1 - level); }
+    // Of level 0, padding and all
+    std::uint32_t getVirtualSize() const { return tileSize << (levels - 1); }
+    std::uint32_t getPaddedTileSize() const { return tileSize + 2 * border; }
+    std::size_t getTileBytes() const { return (std::size_t)getPaddedTileSize() * getPaddedTileSize() * 4; }
+    std::uint32_t getTileCount() const;
+    std::uint32_t getTileIndex(std::uint32_t level, std::uint32_t x, std::uint32_t y) const;
+
+    // Reading. Both print what went wrong and return false on failure.
+    bool open(const char* path);
+    // False, quietly, for tiles which aren't stored
+    bool isStored(std::uint32_t index) const { return offsets[index] != 0; }
+    bool readTile(std::uint32_t index, unsigned char* pixels);
+
+    // Writing: set the fields, then create(), then writeTile() any tiles in
+    // any order, then finish()
+    bool create(const char* path);
+    bool writeTile(std::uint32_t index, const unsigned char* pixels);
+    bool finish();
+
+private:
+    std::fstream file;
+    std::vector<std::uint64_t> offsets;
+};
@@ -0,0 +1,22 @@
+#version 330 core
+// Writes which virtual texture tile vt.fp would want for each pixel, for
+// KVirtualTexture::endFeedback() to read back
+in vec2 uv;
+out uvec4 feedback;
+
+uniform int levelCount;
+uniform float tileSize;
+uniform vec2 imageScale;
+// log2 of how much smaller the feedback buffer is than the screen
+uniform float feedbackBias;
+
+void main()
+{
+    vec2 virtualUv = clamp(uv, 0.0, 1.0) * imageScale;
+    vec2 texel = virtualUv * tileSize * float(1 << (levelCount - 1));
+    float lod = log2(max(length(dFdx(texel)), length(dFdy(texel)))) - feedbackBias;
+    int level = min(int(max(lod, 0.0)), levelCount - 1);
+    int tiles = 1 << (levelCount - 1 - level);
+    // The last component says something was drawn here
+    feedback = uvec4(min(ivec2(virtualUv * float(tiles)), tiles - 1), level, 1);
+}
@@ -0,0 +1,223 @@
+#include <iostream>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include "vtexfile.h"
+#include "mipmap.h"
+
+// Use stb_image.h
+#define STB_IMAGE_IMPLEMENTATION
+#define STBI_ONLY_PNG
+#include "stb_image.h"
+
+// Offline tiler for virtual textures (see KVirtualTexture): PNG in, every
+// mip level cut into bordered tiles out.
+//
+// Usage: vtiler input.png output.vtex [--tile N] [--border N] [--linear]
+//        vtiler --synthetic SIZE output.vtex [--tile N] [--border N]
+//
+// The image is decoded whole, so this needs the memory the programs using
+// the result don't. --synthetic makes a SIZE x SIZE test pattern instead,
+// a tile at a time, so it can be far bigger than would fit in memory (or
+// than is sensible to keep in the repo).
+
+// A level of the padded image: the edges are repeated out to the size of
+// its tiles
+struct Level
+{
+    int width;
+    int height;
+    const unsigned char* pixels;
+};
+
+static void cutTile(const Level& level, const KVTexFile& vtex, int tileX, int tileY, unsigned char* tile)
+{
+    int padded = vtex.getPaddedTileSize();
+    for (int y = 0; y < padded; y++)
+    {
+        int sy = std::min(std::max(tileY * (int)vtex.tileSize - (int)vtex.border + y, 0), level.height - 1);
+        for (int x = 0; x < padded; x++)
+        {
+            int sx = std::min(std::max(tileX * (int)vtex.tileSize - (int)vtex.border + x, 0), level.width - 1);
+            std::memcpy(tile + (y * padded + x) * 4, level.pixels + ((std::size_t)sy * level.width + sx) * 4, 4);
+        }
+    }
+}
+
+// Gradient under a checkerboard, with each level tinted differently so
+// fallbacks to coarser tiles show. Point sampled at every level, so the
+// smaller levels alias.
+static void syntheticTile(const KVTexFile& vtex, int level, int tileX, int tileY, unsigned char* tile)
+{
+    int padded = vtex.getPaddedTileSize();
+    double scale = (double)(1 << level);
+    static const unsigned char tints[4][3] = {{255, 255, 255}, {255, 200, 200}, {200, 255, 200}, {200, 200, 255}};
+    const unsigned char* tint = tints[level % 4];
+    for (int y = 0; y < padded; y++)
+    {
+        double vy = std::min(std::max(((tileY * (int)vtex.tileSize - (int)vtex.border + y) + .5) * scale, 0.), vtex.height - 1.);
+        for (int x = 0; x < padded; x++)
+        {
+            double vx = std::min(std::max(((tileX * (int)vtex.tileSize - (int)vtex.border + x) + .5) * scale, 0.), vtex.width - 1.);
+            bool checker = (((int)vx >> 6) + ((int)vy >> 6)) & 1;
+            unsigned char* out = tile + (y * padded + x) * 4;
+            out[0] = (unsigned char)(vx * 255. / vtex.width * tint[0] / 255.);
+            out[1] = (unsigned char)(vy * 255. / vtex.height * tint[1] / 255.);
+            out[2] = (unsigned char)((checker ? 255 : 64) * tint[2] / 255);
+            out[3] = 255;
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 3)
+    {
+        std::cerr << "Usage: " << argv[0] << " input.png output.vtex [--tile N] [--border N] [--linear]" << std::endl <<
+            "       " << argv[0] << " --synthetic SIZE output.vtex [--tile N] [--border N]" << std::endl;
+        return 1;
+    }
+    bool synthetic = std::strcmp(argv[1], "--synthetic") == 0;
+    int firstOption = synthetic ? 4 : 3;
+    if (argc < firstOption)
+    {
+        std::cerr << "No output file given" << std::endl;
+        return 1;
+    }
+    const char* output = argv[firstOption - 1];
+    KVTexFile vtex;
+    // 128 texels square with the border, which divides the cache evenly
+    vtex.tileSize = 120;
+    vtex.border = 4;
+    bool gammaCorrect = true;
+    for (int arg = firstOption; arg < argc; arg++)
+    {
+        if (std::strcmp(argv[arg], "--tile") == 0 && arg < argc - 1)
+        {
+            vtex.tileSize = std::atoi(argv[++arg]);
+        }
+        else if (std::strcmp(argv[arg], "--border") == 0 && arg < argc - 1)
+        {
+            vtex.border = std::atoi(argv[++arg]);
+        }
+        else if (std::strcmp(argv[arg], "--linear") == 0)
+        {
+            gammaCorrect = false;
+        }
+        else
+        {
+            std::cerr << "Unknown option " << argv[arg] << std::endl;
+            return 1;
+        }
+    }
+    if (vtex.tileSize < 1 || vtex.border >= vtex.tileSize)
+    {
+        std::cerr << "The tiles need to be bigger than their border" << std::endl;
+        return 1;
+    }
+
+    std::vector<unsigned char> pixels;
+    if (synthetic)
+    {
+        vtex.width = vtex.height = std::atoi(argv[2]);
+        if (vtex.width == 0)
+        {
+            std::cerr << "Bad size " << argv[2] << std::endl;
+            return 1;
+        }
+    }
+    else
+    {
+        int width, height, channels;
+        unsigned char* data = stbi_load(argv[1], &width, &height, &channels, 4);
+        if (!data)
+        {
+            std::cerr << "Failed to load " << argv[1] << ": " << stbi_failure_reason() << std::endl;
+            return 1;
+        }
+        vtex.width = width;
+        vtex.height = height;
+        pixels.assign(data, data + (std::size_t)width * height * 4);
+        stbi_image_free(data);
+    }
+    vtex.levels = KVTexFile::levelsFor(vtex.width, vtex.height, vtex.tileSize);
+    if (vtex.levels > KVTexFile::MAX_LEVELS)
+    {
+        std::cerr << "Too big for tiles of " << vtex.tileSize << std::endl;
+        return 1;
+    }
+    if (!vtex.create(output))
+    {
+        return 1;
+    }
+
+    // The whole image, extended out to the virtual size, so the mip chain
+    // halves exactly from level to level and tiles at the edges come out
+    // clamped rather than fading to nothing
+    KMipChain chain;
+    std::vector<unsigned char> extended;
+    if (!synthetic)
+    {
+        int size = vtex.getVirtualSize();
+        extended.resize((std::size_t)size * size * 4);
+        for (int y = 0; y < size; y++)
+        {
+            const unsigned char* row = &pixels[(std::size_t)std::min(y, (int)vtex.height - 1) * vtex.width * 4];
+            unsigned char* out = &extended[(std::size_t)y * size * 4];
+            std::memcpy(out, row, vtex.width * 4);
+            for (int x = vtex.width; x < size; x++)
+            {
+                std::memcpy(out + x * 4, row + (vtex.width - 1) * 4, 4);
+            }
+        }
+        pixels.clear();
+        pixels.shrink_to_fit();
+        chain.generate(extended.data(), size, size, 4, MIP_BOX, gammaCorrect, 0);
+    }
+
+    std::vector<unsigned char> tile(vtex.getTileBytes());
+    unsigned int stored = 0;
+    for (std::uint32_t level = 0; level < vtex.levels; level++)
+    {
+        Level source = {0, 0, nullptr};
+        if (!synthetic)
+        {
+            source.width = source.height = vtex.getVirtualSize() >> level;
+            source.pixels = level == 0 ? extended.data() : chain.levels[level - 1].pixels.data();
+        }
+        std::uint32_t tiles = vtex.getTilesPerSide(level);
+        for (std::uint32_t y = 0; y < tiles; y++)
+        {
+            for (std::uint32_t x = 0; x < tiles; x++)
+            {
+                // Nothing from the image in tiles entirely in the padding
+                if (((std::uint64_t)x * vtex.tileSize << level) >= vtex.width ||
+                    ((std::uint64_t)y * vtex.tileSize << level) >= vtex.height)
+                {
+                    continue;
+                }
+                if (synthetic)
+                {
+                    syntheticTile(vtex, level, x, y, tile.data());
+                }
+                else
+                {
+                    cutTile(source, vtex, x, y, tile.data());
+                }
+                if (!vtex.writeTile(vtex.getTileIndex(level, x, y), tile.data()))
+                {
+                    return 1;
+                }
+                stored++;
+            }
+        }
+    }
+    if (!vtex.finish())
+    {
+        return 1;
+    }
+    std::cout << output << ": " << vtex.width << "x" << vtex.height << ", " << vtex.levels << " levels, " <<
+        stored << " of " << vtex.getTileCount() << " tiles of " << vtex.tileSize << "+" << vtex.border << std::endl;
+    return 0;
+}